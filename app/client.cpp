@@ -9,12 +9,15 @@
 #include <regex>
 #include <fstream>
 #include <vector>
-#include <iterator>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <algorithm>
 
 #include "XmlRpcClient.h"
 #include "XmlRpcValue.h"
 #include "Mensaje.h"
-#include "base64.h"  // misma lib que trae tu proyecto
+#include "Crc32.h"
 
 using namespace std;
 using namespace XmlRpc;
@@ -46,7 +49,7 @@ Comandos disponibles:
   abs                               -> G90 (modo absoluto)
   rel                               -> G91 (modo relativo)
   move x=<num> y=<num> z=<num>      -> G0 X.. Y.. Z..
-  upload <archivo.gcode>            -> sube archivo (base64)
+  upload <archivo.gcode>            -> sube archivo por partes (retoma si se corta)
   run <archivo.gcode>               -> ejecuta archivo previamente subido
   salir                             -> terminar
 
@@ -78,20 +81,91 @@ static Valor build_valor_from(const string& s) {
 }
 
 // --- Helpers para upload ---
-static bool read_file_to_string(const std::string& path, std::string& out) {
-    std::ifstream f(path, std::ios::binary);
-    if (!f) return false;
-    std::string buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
-    out.swap(buf);
-    return true;
+// El archivo se envia en partes con upload.begin / upload.chunk / upload.commit.
+// Si la conexion se corta, upload.begin devuelve el ultimo offset confirmado
+// por el servidor y se sigue desde ahi (si tamaño y CRC-32 coinciden).
+static const std::int64_t UPLOAD_CHUNK = 1 << 20;
+static const int UPLOAD_REINTENTOS = 5;
+
+static std::string fault_text(XmlRpcValue& result) {
+    if (result.getType() == XmlRpcValue::TypeStruct && result.hasMember("faultString"))
+        return static_cast<std::string&>(result["faultString"]);
+    return "error desconocido";
 }
-static std::string to_base64(const std::string& bin) {
-    base64<char> encoder;
-    std::vector<char> out;
-    int iostatus = 0;
-    std::back_insert_iterator<std::vector<char>> it = std::back_inserter(out);
-    encoder.put(bin.begin(), bin.end(), it, iostatus, base64<>::crlf());
-    return std::string(out.begin(), out.end());
+
+static bool leer_offset(XmlRpcValue& v, std::int64_t& out) {
+    if (v.getType() == XmlRpcValue::TypeInt64) { out = static_cast<std::int64_t&>(v); return true; }
+    if (v.getType() == XmlRpcValue::TypeInt) { out = static_cast<int&>(v); return true; }
+    return false;
+}
+
+static void upload_file(XmlRpcClient& client, const string& usuario, const string& clave,
+                        const string& path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) { cout << "No pude leer el archivo: " << path << "\n"; return; }
+
+    // Tamaño y CRC-32 del archivo completo
+    Crc32 crc;
+    std::int64_t size = 0;
+    {
+        std::vector<char> buf(UPLOAD_CHUNK);
+        while (f.read(buf.data(), UPLOAD_CHUNK) || f.gcount() > 0) {
+            crc.update(buf.data(), static_cast<size_t>(f.gcount()));
+            size += f.gcount();
+        }
+        f.clear();
+    }
+
+    auto pos = path.find_last_of("/\\");
+    std::string fname = (pos == std::string::npos) ? path : path.substr(pos+1);
+
+    for (int intento = 0; intento <= UPLOAD_REINTENTOS; ++intento) {
+        if (intento > 0) {
+            cerr << "\n[RPC] Conexion perdida, reintentando (" << intento << "/" << UPLOAD_REINTENTOS << ")...\n";
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+
+        XmlRpcValue args, result;
+        args[0] = usuario;
+        args[1] = clave;
+        args[2] = fname;
+        args[3] = size;
+        args[4] = static_cast<std::int64_t>(crc.getValor());   // solo retoma un parcial de este archivo
+        if (!client.execute("upload.begin", args, result)) continue;
+        if (client.isFault()) { cout << "Servidor: " << fault_text(result) << "\n"; return; }
+        std::int64_t offset;
+        if (!leer_offset(result, offset)) { cout << "Servidor devolvió un tipo inesperado.\n"; return; }
+
+        bool cortado = false;
+        while (offset < size) {
+            XmlRpcValue::BinaryData data(static_cast<size_t>(std::min(UPLOAD_CHUNK, size - offset)));
+            f.seekg(offset);
+            if (!f.read(data.data(), static_cast<std::streamsize>(data.size()))) {
+                cout << "\nNo pude leer el archivo: " << path << "\n";
+                return;
+            }
+
+            XmlRpcValue parte;
+            parte[0] = usuario;
+            parte[1] = clave;
+            parte[2] = fname;
+            parte[3] = offset;
+            parte[4] = XmlRpcValue(std::move(data));
+            if (!client.execute("upload.chunk", parte, result)) { cortado = true; break; }
+            if (client.isFault()) { cout << "\nServidor: " << fault_text(result) << "\n"; return; }
+            if (!leer_offset(result, offset)) { cout << "\nServidor devolvió un tipo inesperado.\n"; return; }
+            cout << "\r[upload] " << offset << " / " << size << " bytes" << std::flush;
+        }
+        if (cortado) continue;
+        if (size > 0) cout << "\n";
+
+        if (!client.execute("upload.commit", args, result)) continue;
+        if (client.isFault()) cout << "Servidor: " << fault_text(result) << "\n";
+        else if (result.getType() == XmlRpcValue::TypeString) cout << "Servidor: " << static_cast<std::string&>(result) << "\n";
+        else cout << "Servidor devolvió un tipo inesperado.\n";
+        return;
+    }
+    cerr << "[RPC] Error al subir: se agotaron los reintentos.\n";
 }
 
 // --- Mapea alias del usuario a las frases que entiende el servidor ---
@@ -174,33 +248,7 @@ int main(int argc, char* argv[]) {
             if (entrada.rfind("upload ", 0) == 0) {
                 std::string path = entrada.substr(7);
                 if (path.empty()) { cout << "Uso: upload <archivo.gcode>\n"; continue; }
-
-                std::string raw;
-                if (!read_file_to_string(path, raw)) {
-                    cout << "No pude leer el archivo: " << path << "\n";
-                    continue;
-                }
-                // basename
-                auto pos = path.find_last_of("/\\");
-                std::string fname = (pos == std::string::npos) ? path : path.substr(pos+1);
-
-                std::string b64 = to_base64(raw);
-                std::string peticion = "upload filename=" + fname + " data=" + b64;
-
-                Valor dato = peticion;  // string largo
-                Mensaje msg(nextID++, usuario, clave, dato);
-                const std::string serializado = msg.Serializar();
-
-                XmlRpcValue args, result;
-                args[0] = serializado;
-
-                bool ok = client.execute("RecibirMensaje", args, result);
-                if (!ok) { cerr << "[RPC] Error al subir.\n"; continue; }
-                try {
-                    cout << "Servidor: " << static_cast<std::string>(result) << "\n";
-                } catch (...) {
-                    cout << "Servidor devolvió un tipo inesperado.\n";
-                }
+                upload_file(client, usuario, clave, path);
                 continue;
             }
 
@@ -1,10 +1,13 @@
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <variant>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <map>
 #include <deque>
 #include <mutex>
 #include <atomic>
@@ -13,6 +16,7 @@
 #include <thread>
 #include <chrono>
 #include <memory>
+#include <cstdint>
 
 #include "XmlRpc.h"
 #include "Mensaje.h"
@@ -21,9 +25,11 @@
 #include "PALogger.h"
 #include "InterpreteDeComandos.h"
 #include "Reporte.h"
-#include "base64.h"
+#include "XmlRpcBase64.h"
+#include "XmlRpcThreadPool.h"
 #include "Controlador.h"   // <<<< agregado
 #include "Archivo.h"       // <<<< agregado para usar Archivo
+#include "Crc32.h"
 
 using namespace XmlRpc;
 
@@ -54,24 +60,20 @@ static std::string trim(std::string s) {
     return s;
 }
 
-static bool extractKV(const std::string& src, const std::string& key, std::string& out) {
+// Ubica el valor de key=... en src sin copiarlo
+static bool findKV(std::string_view src, const std::string& key, std::string_view& out) {
     auto pos = src.find(key + "=");
-    if (pos == std::string::npos) return false;
+    if (pos == std::string_view::npos) return false;
     pos += key.size() + 1;
     size_t end = src.find(' ', pos);
-    out = (end == std::string::npos) ? src.substr(pos) : src.substr(pos, end - pos);
+    out = (end == std::string_view::npos) ? src.substr(pos) : src.substr(pos, end - pos);
     return true;
 }
 
-// Decodifica base64<char> compatible con tu base64.h
-static bool from_base64(const std::string& b64, std::string& binOut) {
-    base64<char> decoder;
-    std::vector<char> out;
-    int iostatus = 0;
-    auto it = std::back_inserter(out);
-    decoder.get(b64.begin(), b64.end(), it, iostatus);
-    if (iostatus != 0) return false;
-    binOut.assign(out.begin(), out.end());
+static bool extractKV(const std::string& src, const std::string& key, std::string& out) {
+    std::string_view val;
+    if (!findKV(src, key, val)) return false;
+    out.assign(val.data(), val.size());
     return true;
 }
 
@@ -80,14 +82,51 @@ static void ensureUploadsDir() {
     if (!std::filesystem::exists(p)) std::filesystem::create_directories(p);
 }
 
-static bool saveFile(const std::string& fname, const std::string& data) {
+enum class UploadStatus { OK, BASE64_INVALIDO, ERROR_ESCRITURA };
+
+// Caracteres de base64 que se decodifican por vez
+static const size_t UPLOAD_CHUNK = 64 * 1024;
+static std::atomic<unsigned> g_uploadSeq{0};
+
+// Decodifica el base64 por partes de UPLOAD_CHUNK a un archivo temporal en
+// uploads/ y lo renombra al final, asi la memoria usada no depende del tamaño
+// del archivo y nunca queda un archivo a medio escribir con el nombre final.
+static UploadStatus saveBase64File(const std::string& fname, std::string_view b64) {
     ensureUploadsDir();
-    std::filesystem::path p = std::filesystem::path("uploads") / fname;
-    std::ofstream f(p, std::ios::binary);
-    if (!f) return false;
-    f.write(data.data(), static_cast<std::streamsize>(data.size()));
-    f.close();
-    return static_cast<bool>(f);
+    std::filesystem::path dest = std::filesystem::path("uploads") / fname;
+    std::filesystem::path tmp = std::filesystem::path("uploads") /
+        ("." + fname + ".part" + std::to_string(++g_uploadSeq));
+
+    UploadStatus status = UploadStatus::OK;
+    {
+        std::ofstream f(tmp, std::ios::binary);
+        if (!f) return UploadStatus::ERROR_ESCRITURA;
+
+        std::vector<char> buf(XmlRpcBase64::decodedSize(UPLOAD_CHUNK));
+        XmlRpcBase64::Decoder decoder;
+        size_t len = 0;
+        for (size_t pos = 0; pos < b64.size() && f; pos += UPLOAD_CHUNK) {
+            if (!decoder.decode(b64.substr(pos, UPLOAD_CHUNK), buf.data(), &len)) {
+                status = UploadStatus::BASE64_INVALIDO;
+                break;
+            }
+            f.write(buf.data(), static_cast<std::streamsize>(len));
+        }
+        if (status == UploadStatus::OK) {
+            if (!decoder.finish(buf.data(), &len)) status = UploadStatus::BASE64_INVALIDO;
+            else f.write(buf.data(), static_cast<std::streamsize>(len));
+        }
+        f.close();
+        if (status == UploadStatus::OK && !f) status = UploadStatus::ERROR_ESCRITURA;
+    }
+
+    std::error_code ec;
+    if (status == UploadStatus::OK) {
+        std::filesystem::rename(tmp, dest, ec);
+        if (ec) status = UploadStatus::ERROR_ESCRITURA;
+    }
+    if (status != UploadStatus::OK) std::filesystem::remove(tmp, ec);
+    return status;
 }
 
 // ===== Método remoto =====
@@ -96,11 +135,14 @@ private:
     // <<< integración Controlador >>>
     Controlador controlador_;
     std::atomic<bool> robotConectado_{false};
+    // execute() corre en los hilos de trabajo del servidor: un comando serie a la vez
+    std::mutex robotMutex_;
 
     // === Estado de grabación de trayectoria (modo “grabación”) ===
     bool grabacionActiva_ = false;                       // <<<< agregado
     std::unique_ptr<Archivo> archivoGrabacion_;          // <<<< agregado
     std::string nombreTrayectoria_;                      // <<<< agregado
+    std::mutex grabacionMutex_;
 
 public:
     RecibirMensaje(XmlRpcServer* s) : XmlRpcServerMethod("RecibirMensaje", s) {
@@ -116,6 +158,7 @@ public:
     void conectarRobot() {
         auto& logger = PALogger::getInstance();
         try {
+            std::lock_guard<std::mutex> lk(robotMutex_);
             bool ok = controlador_.conectar();
             robotConectado_.store(ok);
             if (ok) {
@@ -148,7 +191,7 @@ public:
         }
 
         // --- Deserializar mensaje ---
-        std::string serializado = static_cast<std::string>(params[0]);
+        const std::string& serializado = params[0];
         Mensaje msg;
         if (!msg.Deserializar(serializado)) {
             result = "Error al deserializar el mensaje.";
@@ -259,6 +302,7 @@ public:
                                  PALogger::Code::BAD_REQUEST, msg.getID());
                 return;
             }
+            std::lock_guard<std::mutex> lk(robotMutex_);
             if (robotConectado_.load()) {
                 controlador_.desconectar();
                 robotConectado_.store(false);
@@ -280,6 +324,7 @@ public:
                                  PALogger::Code::BAD_REQUEST, msg.getID());
                 return;
             }
+            std::lock_guard<std::mutex> lk(robotMutex_);
             if (!robotConectado_.load()) {
                 bool ok = controlador_.conectar();
                 robotConectado_.store(ok);
@@ -301,6 +346,8 @@ public:
         }
 
         // ===== NUEVO: Modo GRABACIÓN (con estado, usando Archivo) =====
+        std::unique_lock<std::mutex> lkGrabacion(grabacionMutex_);
+
         // guardar trayectoria=<archivo.gcode>
         if (peticion.rfind("guardar trayectoria=", 0) == 0) {
             if (grabacionActiva_) {
@@ -386,13 +433,15 @@ public:
             result = "Guardado en " + nombreTrayectoria_ + ": " + gcode;
             return;
         }
+        lkGrabacion.unlock();
 
         // ===== Manejo especial: UPLOAD / RUN =====
 
         // upload filename=... data=...
         if (peticion.rfind("upload ", 0) == 0) {
-            std::string fname, b64;
-            if (!extractKV(peticion, "filename", fname) || !extractKV(peticion, "data", b64)) {
+            std::string fname;
+            std::string_view b64;
+            if (!extractKV(peticion, "filename", fname) || !findKV(peticion, "data", b64)) {
                 result = "Error: formato de upload invalido. Use: upload filename=<NOMBRE> data=<BASE64>";
                 logger.logEvento(PALogger::LogLevel::ERROR,
                                  "Upload con formato invalido",
@@ -402,15 +451,15 @@ public:
             auto pos = fname.find_last_of("/\\");
             if (pos != std::string::npos) fname = fname.substr(pos+1);
 
-            std::string bin;
-            if (!from_base64(b64, bin)) {
+            UploadStatus st = saveBase64File(fname, b64);
+            if (st == UploadStatus::BASE64_INVALIDO) {
                 result = "Error: base64 invalido.";
                 logger.logEvento(PALogger::LogLevel::ERROR,
                                  "Upload base64 invalido",
                                  PALogger::Code::BAD_REQUEST, msg.getID());
                 return;
             }
-            if (!saveFile(fname, bin)) {
+            if (st != UploadStatus::OK) {
                 result = "Error: no se pudo guardar el archivo en 'uploads/'.";
                 logger.logEvento(PALogger::LogLevel::ERROR,
                                  "Fallo al guardar archivo: " + fname,
@@ -467,8 +516,13 @@ public:
                 if (line.empty()) continue; // ignorar líneas vacías
 
                 ++n;
-                // Enviar al controlador y registrar la respuesta
-                std::string respuesta = controlador_.enviarComandoGcode(line);
+                // Enviar al controlador y registrar la respuesta. El lock se
+                // libera entre lineas para que 'reporte' no espere todo el archivo.
+                std::string respuesta;
+                {
+                    std::lock_guard<std::mutex> lk(robotMutex_);
+                    respuesta = controlador_.enviarComandoGcode(line);
+                }
                 respLog << "L" << n << ": `" << line << "` -> `" << respuesta << "`\n";
                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
             }
@@ -490,6 +544,7 @@ public:
 
             std::string estado = "ROBOT DESCONECTADO";
             if (robotConectado_.load()) {
+                std::lock_guard<std::mutex> lk(robotMutex_);
                 estado = controlador_.enviarComandoGcode("M114");
             }
             reporte.SetEstadoROBOT(estado);
@@ -531,7 +586,11 @@ public:
             return;
         }
 
-        std::string respuestaArduino = controlador_.enviarComandoGcode(comandoGcode);
+        std::string respuestaArduino;
+        {
+            std::lock_guard<std::mutex> lk(robotMutex_);
+            respuestaArduino = controlador_.enviarComandoGcode(comandoGcode);
+        }
 
         result = "Peticion procesada: " + std::string(comandoGcode) +
                  " | Arduino: " + respuestaArduino;
@@ -544,6 +603,360 @@ public:
     }
 };
 
+// ===== Subida por partes: upload.begin / upload.chunk / upload.commit =====
+// Los datos llegan como parametros <base64> nativos y se escriben en su
+// offset dentro de uploads/.<archivo>.<usuario>.part. El tamaño de ese
+// archivo es el offset confirmado, asi una transferencia cortada (incluso
+// con reinicio del servidor) sigue desde donde quedo. El tamaño y el CRC-32
+// declarados en upload.begin se guardan al lado, en <parcial>.info: solo se
+// retoma un parcial de la misma subida, y ninguna parte puede pasar del
+// tamaño declarado. commit verifica tamaño y CRC-32 y renombra el archivo
+// a su nombre final.
+// Todos los metodos reciben primero usuario y clave.
+
+// nParams parametros, mas hasta nOpcionales al final
+static Usuario autenticarUpload(XmlRpcValue& params, int nParams, int nOpcionales = 0) {
+    if (params.getType() != XmlRpcValue::TypeArray
+        || params.size() < nParams || params.size() > nParams + nOpcionales
+        || params[0].getType() != XmlRpcValue::TypeString
+        || params[1].getType() != XmlRpcValue::TypeString
+        || params[2].getType() != XmlRpcValue::TypeString)
+        throw XmlRpcException("Parametros invalidos");
+
+    ValidadorUsuario validador("db/usuarios.db");
+    Usuario usuario;
+    if (!validador.validarCredenciales(params[0], params[1], usuario)) {
+        PALogger::getInstance().logLogin(static_cast<std::string&>(params[0]), false, -1);
+        throw XmlRpcException("Credenciales inválidas.");
+    }
+    if (!g_remoteAccessEnabled.load())
+        throw XmlRpcException("Acceso remoto deshabilitado por el administrador.");
+    return usuario;
+}
+
+// Nombre del archivo sin directorios
+static std::string nombreUpload(XmlRpcValue& v) {
+    std::string fname = v;
+    auto pos = fname.find_last_of("/\\");
+    if (pos != std::string::npos) fname = fname.substr(pos + 1);
+    if (fname.empty() || fname == "." || fname == "..")
+        throw XmlRpcException("Nombre de archivo invalido");
+    return fname;
+}
+
+static std::filesystem::path rutaParcial(const Usuario& usuario, const std::string& fname) {
+    return std::filesystem::path("uploads") / ("." + fname + "." + usuario.getNombre() + ".part");
+}
+
+static std::filesystem::path rutaInfo(const std::filesystem::path& part) {
+    std::filesystem::path info = part;
+    info += ".info";
+    return info;
+}
+
+// Acepta <i4> o <i8>
+static std::int64_t enteroUpload(XmlRpcValue& v) {
+    std::int64_t n;
+    if (v.getType() == XmlRpcValue::TypeInt) n = static_cast<int&>(v);
+    else if (v.getType() == XmlRpcValue::TypeInt64) n = static_cast<std::int64_t&>(v);
+    else throw XmlRpcException("Se esperaba un entero");
+    if (n < 0) throw XmlRpcException("Se esperaba un entero no negativo");
+    return n;
+}
+
+// Un <i4> trae el CRC como entero con signo (clientes sin <i8>)
+static std::uint32_t crcUpload(XmlRpcValue& v) {
+    if (v.getType() == XmlRpcValue::TypeInt)
+        return static_cast<std::uint32_t>(static_cast<int&>(v));
+    return static_cast<std::uint32_t>(enteroUpload(v));
+}
+
+// Lo declarado en upload.begin para un archivo parcial
+struct SubidaDeclarada {
+    std::int64_t tamano = -1;   // -1: no hay subida iniciada
+    std::int64_t crc = -1;      // -1: el cliente no lo envio
+};
+
+// Estado de un archivo parcial. Los metodos corren en varios hilos de
+// trabajo: quien lo lee o escribe toma antes el mutex de su subida.
+struct SubidaEnCurso {
+    std::mutex mutex;
+    SubidaDeclarada declarada;
+    bool leida = false;         // declarada ya se cargo de <parcial>.info
+};
+
+static std::mutex g_subidasMutex;
+static std::map<std::string, std::shared_ptr<SubidaEnCurso>> g_subidas;
+
+static std::shared_ptr<SubidaEnCurso> subidaEnCurso(const std::filesystem::path& part) {
+    std::lock_guard<std::mutex> lk(g_subidasMutex);
+    std::shared_ptr<SubidaEnCurso>& subida = g_subidas[part.string()];
+    if (!subida) subida = std::make_shared<SubidaEnCurso>();
+    return subida;
+}
+
+// Con el mutex de la subida tomado. Tras un reinicio se lee del .info
+static const SubidaDeclarada& leerDeclarada(SubidaEnCurso& subida, const std::filesystem::path& part) {
+    if (!subida.leida) {
+        std::ifstream f(rutaInfo(part));
+        SubidaDeclarada d;
+        if (!(f >> d.tamano >> d.crc)) d = SubidaDeclarada();
+        subida.declarada = d;
+        subida.leida = true;
+    }
+    return subida.declarada;
+}
+
+// Con el mutex de la subida tomado
+static void guardarDeclarada(SubidaEnCurso& subida, const std::filesystem::path& part,
+                             const SubidaDeclarada& d) {
+    std::ofstream f(rutaInfo(part), std::ios::trunc);
+    f << d.tamano << ' ' << d.crc << '\n';
+    f.close();
+    if (!f) throw XmlRpcException("No se pudo crear el archivo en 'uploads/'.");
+    subida.declarada = d;
+    subida.leida = true;
+}
+
+// Con el mutex de la subida tomado
+static void olvidarDeclarada(SubidaEnCurso& subida, const std::filesystem::path& part) {
+    std::error_code ec;
+    std::filesystem::remove(rutaInfo(part), ec);
+    subida.declarada = SubidaDeclarada();
+    subida.leida = true;
+}
+
+// Con el mutex de la subida tomado, al confirmarla o descartarla. Saca su
+// estado del mapa si nadie mas lo tiene: quien espera el mutex sigue con
+// el mismo objeto y ve la subida olvidada.
+static void terminarSubida(const std::shared_ptr<SubidaEnCurso>& subida,
+                           const std::filesystem::path& part) {
+    olvidarDeclarada(*subida, part);
+    std::lock_guard<std::mutex> lk(g_subidasMutex);
+    auto it = g_subidas.find(part.string());
+    if (it != g_subidas.end() && it->second == subida && subida.use_count() == 2)
+        g_subidas.erase(it);
+}
+
+// upload.begin(usuario, clave, archivo, tamaño[, crc32]) -> offset desde el que enviar
+class IniciarUpload : public XmlRpcServerMethod {
+public:
+    IniciarUpload(XmlRpcServer* s) : XmlRpcServerMethod("upload.begin", s) {}
+
+    void execute(XmlRpcValue& params, XmlRpcValue& result) override {
+        Usuario usuario = autenticarUpload(params, 4, 1);
+        std::string fname = nombreUpload(params[2]);
+        SubidaDeclarada pedida;
+        pedida.tamano = enteroUpload(params[3]);
+        if (params.size() > 4) pedida.crc = crcUpload(params[4]);
+
+        ensureUploadsDir();
+        std::filesystem::path part = rutaParcial(usuario, fname);
+        std::shared_ptr<SubidaEnCurso> subida = subidaEnCurso(part);
+        std::lock_guard<std::mutex> lk(subida->mutex);
+
+        // Solo se retoma el parcial de una subida con el mismo tamaño y CRC
+        const SubidaDeclarada& previa = leerDeclarada(*subida, part);
+        std::int64_t offset = 0;
+        if (previa.tamano == pedida.tamano && previa.crc == pedida.crc) {
+            std::error_code ec;
+            std::int64_t actual = static_cast<std::int64_t>(std::filesystem::file_size(part, ec));
+            if (!ec && actual <= pedida.tamano) offset = actual;
+        }
+        if (offset == 0) {
+            std::ofstream f(part, std::ios::binary | std::ios::trunc);
+            if (!f) throw XmlRpcException("No se pudo crear el archivo en 'uploads/'.");
+            guardarDeclarada(*subida, part, pedida);
+        }
+        result = offset;
+    }
+
+    std::string help() override {
+        return "upload.begin(usuario, clave, archivo, tamaño[, crc32]): inicia o retoma una subida; "
+               "devuelve el offset desde el que hay que enviar";
+    }
+};
+
+// Escribe una parte en el parcial desde offset, con el mutex de su subida
+// tomado. escribir(f, tamaño declarado) pone los datos en f sin pasar de ese
+// tamaño y devuelve el offset en que terminan.
+template <typename Escribir>
+static std::int64_t escribirParte(const Usuario& usuario, const std::string& fname,
+                                  std::int64_t offset, Escribir escribir) {
+    std::filesystem::path part = rutaParcial(usuario, fname);
+    std::shared_ptr<SubidaEnCurso> subida = subidaEnCurso(part);
+    std::lock_guard<std::mutex> lk(subida->mutex);
+
+    const SubidaDeclarada& declarada = leerDeclarada(*subida, part);
+    std::error_code ec;
+    std::int64_t actual = static_cast<std::int64_t>(std::filesystem::file_size(part, ec));
+    if (ec || declarada.tamano < 0) throw XmlRpcException("Upload no iniciado: use upload.begin");
+    if (offset > actual) throw XmlRpcException("Offset mayor al confirmado: " + std::to_string(actual));
+
+    std::fstream f(part, std::ios::binary | std::ios::in | std::ios::out);
+    f.seekp(offset);
+    std::int64_t fin = escribir(f, declarada.tamano);
+    f.close();
+    if (!f) throw XmlRpcException("No se pudo escribir en 'uploads/'.");
+    return std::max(actual, fin);
+}
+
+static XmlRpcException excedeDeclarado(std::int64_t tamano) {
+    return XmlRpcException("Los datos pasan del tamaño declarado: " + std::to_string(tamano));
+}
+
+// upload.chunk(usuario, clave, archivo, offset, datos) -> nuevo offset confirmado
+class EnviarParteUpload : public XmlRpcServerMethod {
+public:
+    EnviarParteUpload(XmlRpcServer* s) : XmlRpcServerMethod("upload.chunk", s) {}
+
+    // Lee los parametros a medida que se parsean: el <base64> se decodifica
+    // de a UPLOAD_CHUNK caracteres directo al archivo, sin armar un valor
+    // con todos los datos.
+    bool executeStreamed(XmlRpcParser& params, XmlRpcValue& result) override {
+        XmlRpcValue cabecera;   // usuario, clave, archivo, offset
+        if (params.next() != XmlRpcParser::StartArray) throw XmlRpcException("Parametros invalidos");
+        for (int i = 0; i < 4; ++i) {
+            XmlRpcParser::Event event = params.next();
+            if (event == XmlRpcParser::String) cabecera[i] = params.getString();
+            else if (event == XmlRpcParser::Int) cabecera[i] = params.getInt();
+            else if (event == XmlRpcParser::Int64) cabecera[i] = params.getInt64();
+            else throw XmlRpcException("Parametros invalidos");
+        }
+        if (params.next() != XmlRpcParser::Base64)
+            throw XmlRpcException("Se esperaba <base64> con los datos");
+        std::string_view b64 = params.getText();
+        if (params.next() != XmlRpcParser::EndArray) throw XmlRpcException("Parametros invalidos");
+
+        Usuario usuario = autenticarUpload(cabecera, 4);
+        std::string fname = nombreUpload(cabecera[2]);
+        std::int64_t offset = enteroUpload(cabecera[3]);
+
+        result = escribirParte(usuario, fname, offset, [&](std::fstream& f, std::int64_t tamano) {
+            std::vector<char> buf(XmlRpcBase64::decodedSize(UPLOAD_CHUNK));
+            XmlRpcBase64::Decoder decoder;
+            std::int64_t fin = offset;
+            for (size_t pos = 0; ; pos += UPLOAD_CHUNK) {
+                bool ultima = pos >= b64.size();
+                size_t len = 0;
+                bool ok = ultima ? decoder.finish(buf.data(), &len)
+                                 : decoder.decode(b64.substr(pos, UPLOAD_CHUNK), buf.data(), &len);
+                if (!ok) throw XmlRpcException("Datos <base64> invalidos");
+                if (fin + static_cast<std::int64_t>(len) > tamano) throw excedeDeclarado(tamano);
+                f.write(buf.data(), static_cast<std::streamsize>(len));
+                fin += static_cast<std::int64_t>(len);
+                if (ultima) return fin;
+            }
+        });
+        return true;
+    }
+
+    // Desde system.multicall
+    void execute(XmlRpcValue& params, XmlRpcValue& result) override {
+        Usuario usuario = autenticarUpload(params, 5);
+        std::string fname = nombreUpload(params[2]);
+        std::int64_t offset = enteroUpload(params[3]);
+        if (params[4].getType() != XmlRpcValue::TypeBase64)
+            throw XmlRpcException("Se esperaba <base64> con los datos");
+        XmlRpcValue::BinaryData const& data = params[4];
+
+        result = escribirParte(usuario, fname, offset, [&](std::fstream& f, std::int64_t tamano) {
+            std::int64_t fin = offset + static_cast<std::int64_t>(data.size());
+            if (fin > tamano) throw excedeDeclarado(tamano);
+            f.write(data.data(), static_cast<std::streamsize>(data.size()));
+            return fin;
+        });
+    }
+
+    std::string help() override {
+        return "upload.chunk(usuario, clave, archivo, offset, datos): escribe los datos en su offset, "
+               "sin pasar del tamaño declarado; devuelve el offset confirmado";
+    }
+};
+
+// upload.commit(usuario, clave, archivo, tamaño, crc32) -> mensaje de resultado
+// Calcular el CRC-32 lee todo el archivo: se hace en hilos propios y el
+// resultado llega por la completion, sin ocupar mientras tanto un hilo de
+// trabajo del servidor. Por eso no se puede llamar desde system.multicall.
+class ConfirmarUpload : public XmlRpcServerMethod {
+private:
+    XmlRpcThreadPool verificaciones_;
+
+public:
+    ConfirmarUpload(XmlRpcServer* s) : XmlRpcServerMethod("upload.commit", s), verificaciones_(2) {}
+
+    void executeAsync(XmlRpcValue& params, std::shared_ptr<XmlRpcServerCompletion> done) override {
+        Usuario usuario = autenticarUpload(params, 5);
+        std::string fname = nombreUpload(params[2]);
+        std::int64_t size = enteroUpload(params[3]);
+        std::uint32_t crc = crcUpload(params[4]);
+
+        verificaciones_.submit([=]() {
+            try {
+                done->complete(XmlRpcValue(confirmar(usuario, fname, size, crc)));
+            } catch (const XmlRpcException& e) {
+                done->fail(e.getMessage(), e.getCode());
+            } catch (const std::exception& e) {
+                done->fail(e.what());
+            }
+        });
+    }
+
+    std::string help() override {
+        return "upload.commit(usuario, clave, archivo, tamaño, crc32): verifica la subida y "
+               "guarda el archivo en 'uploads/'";
+    }
+
+private:
+    // Verifica tamaño y CRC-32 del parcial y lo renombra a su nombre final
+    static std::string confirmar(const Usuario& usuario, const std::string& fname,
+                                 std::int64_t size, std::uint32_t crc) {
+        auto& logger = PALogger::getInstance();
+        std::filesystem::path part = rutaParcial(usuario, fname);
+        std::shared_ptr<SubidaEnCurso> subida = subidaEnCurso(part);
+        std::lock_guard<std::mutex> lk(subida->mutex);
+
+        const SubidaDeclarada& declarada = leerDeclarada(*subida, part);
+        std::error_code ec;
+        std::int64_t actual = static_cast<std::int64_t>(std::filesystem::file_size(part, ec));
+        if (ec || declarada.tamano < 0) throw XmlRpcException("Upload no iniciado: use upload.begin");
+        if (size != declarada.tamano)
+            throw XmlRpcException("Tamaño distinto al declarado en upload.begin: " +
+                                  std::to_string(declarada.tamano));
+        if (actual != size)
+            throw XmlRpcException("Upload incompleto: " + std::to_string(actual) + " de " +
+                                  std::to_string(size) + " bytes");
+
+        Crc32 calc;
+        {
+            std::ifstream f(part, std::ios::binary);
+            std::vector<char> buf(UPLOAD_CHUNK);
+            while (f.read(buf.data(), static_cast<std::streamsize>(buf.size())) || f.gcount() > 0)
+                calc.update(buf.data(), static_cast<size_t>(f.gcount()));
+        }
+        if (calc.getValor() != crc) {
+            std::filesystem::remove(part, ec);
+            terminarSubida(subida, part);
+            logger.logEvento(PALogger::LogLevel::ERROR,
+                             "Upload con CRC distinto: " + fname,
+                             PALogger::Code::BAD_REQUEST, -1);
+            throw XmlRpcException("CRC-32 distinto: el archivo se descarto, vuelva a subirlo");
+        }
+
+        std::filesystem::rename(part, std::filesystem::path("uploads") / fname, ec);
+        if (ec) {
+            logger.logEvento(PALogger::LogLevel::ERROR,
+                             "Fallo al guardar archivo: " + fname,
+                             PALogger::Code::SERVER_ERROR, -1);
+            throw XmlRpcException("No se pudo guardar el archivo en 'uploads/'.");
+        }
+        terminarSubida(subida, part);
+
+        logger.logPeticion(usuario.getNombre(), "upload " + fname, -1, PALogger::Code::OK);
+        return std::string("Archivo subido: ") + fname;
+    }
+};
+
 int main(int argc, char* argv[]) {
     if (argc != 2) {
         std::cerr << "Uso: ./server <puerto>\n";
@@ -552,8 +965,19 @@ int main(int argc, char* argv[]) {
 
     int port = std::atoi(argv[1]);
     XmlRpcServer server;
+    // Los metodos corren en hilos de trabajo: un 'run' largo no bloquea al resto
+    server.setWorkerThreads(4);
+    // Clientes colgados o inactivos no retienen conexiones indefinidamente
+    server.setIdleTimeout(300.0);
+    server.setHeaderTimeout(10.0);
+    server.setBodyTimeout(60.0);
+    // Ante una avalancha de reconexiones se responde 503 en lugar de agotar descriptores
+    server.setMaxConnections(512);
 
     RecibirMensaje recibir(&server);
+    IniciarUpload iniciarUpload(&server);
+    EnviarParteUpload enviarParteUpload(&server);
+    ConfirmarUpload confirmarUpload(&server);
 
     auto& logger = PALogger::getInstance();
     logger.setLevel(PALogger::LogLevel::DEBUG);
@@ -0,0 +1,218 @@
+import os
+import shutil
+import socket
+import subprocess
+import tempfile
+import threading
+import time
+import unittest
+import base64
+import zlib
+import xmlrpc.client
+
+RAIZ = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+SERVIDOR = os.path.join(RAIZ, "bin", "server")
+USUARIO = ("juan", "1234")
+
+
+def crc(datos):
+    # El servidor acepta el CRC-32 como <i4> con signo
+    c = zlib.crc32(datos)
+    return c - (1 << 32) if c >= 1 << 31 else c
+
+
+def puerto_libre():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+@unittest.skipUnless(os.path.exists(SERVIDOR), "falta bin/server (make all)")
+class TestServidorUploads(unittest.TestCase):
+    """Levanta bin/server en un directorio temporal con su propia db/ y uploads/."""
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        os.makedirs(os.path.join(self.dir, "db"))
+        shutil.copy(os.path.join(RAIZ, "db", "usuarios.db"), os.path.join(self.dir, "db"))
+        self.uploads = os.path.join(self.dir, "uploads")
+        self.proceso = None
+        self.iniciar()
+
+    def tearDown(self):
+        self.detener()
+        shutil.rmtree(self.dir, ignore_errors=True)
+
+    def iniciar(self):
+        self.puerto = puerto_libre()
+        self.proceso = subprocess.Popen([SERVIDOR, str(self.puerto)], cwd=self.dir,
+                                        stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        limite = time.time() + 10
+        while True:
+            try:
+                socket.create_connection(("127.0.0.1", self.puerto), timeout=1).close()
+                break
+            except OSError:
+                if time.time() > limite or self.proceso.poll() is not None:
+                    self.fail("bin/server no quedo escuchando")
+                time.sleep(0.05)
+
+    def detener(self):
+        if self.proceso:
+            self.proceso.kill()
+            self.proceso.wait()
+            self.proceso = None
+
+    def proxy(self):
+        p = xmlrpc.client.ServerProxy("http://127.0.0.1:%d/RPC2" % self.puerto)
+        self.addCleanup(p("close"))
+        return p
+
+    def falla(self, llamada, texto):
+        with self.assertRaises(xmlrpc.client.Fault) as ctx:
+            llamada()
+        self.assertIn(texto, ctx.exception.faultString)
+
+    def archivos(self):
+        return sorted(os.listdir(self.uploads))
+
+    def leer(self, nombre):
+        with open(os.path.join(self.uploads, nombre), "rb") as f:
+            return f.read()
+
+    def recibir(self, peticion):
+        # formato: ID|usuario|clave|tipo|valor
+        return self.proxy().RecibirMensaje("1|%s|%s|string|%s" % (USUARIO + (peticion,)))
+
+    def escribir(self, nombre, datos):
+        os.makedirs(self.uploads, exist_ok=True)
+        with open(os.path.join(self.uploads, nombre), "wb") as f:
+            f.write(datos)
+
+    # ===== RecibirMensaje: upload filename=... data=... =====
+
+    def test_upload_reemplaza_con_un_rename(self):
+        self.escribir("e.gcode", b"viejo")
+        nuevo = os.urandom(200000)
+        with open(os.path.join(self.uploads, "e.gcode"), "rb") as anterior:
+            res = self.recibir("upload filename=e.gcode data=" + base64.b64encode(nuevo).decode())
+            self.assertEqual(res, "Archivo subido: e.gcode")
+            # El archivo abierto sigue siendo el viejo: el nuevo llego con otro inodo
+            self.assertEqual(anterior.read(), b"viejo")
+        self.assertEqual(self.leer("e.gcode"), nuevo)
+        self.assertEqual(self.archivos(), ["e.gcode"])
+
+    def test_upload_base64_invalido_a_mitad(self):
+        self.escribir("f.gcode", b"viejo")
+        # Se decodifica de a 64 KB: la primera parte llega a escribirse
+        b64 = base64.b64encode(os.urandom(90000)).decode()
+        b64 = b64[:100000] + "*" + b64[100001:]
+        res = self.recibir("upload filename=f.gcode data=" + b64)
+        self.assertEqual(res, "Error: base64 invalido.")
+        # Ni el temporal ni cambios en el destino
+        self.assertEqual(self.archivos(), ["f.gcode"])
+        self.assertEqual(self.leer("f.gcode"), b"viejo")
+
+    # ===== upload.begin / upload.chunk / upload.commit =====
+
+    def test_retoma_desde_el_parcial(self):
+        datos = os.urandom(1000)
+        p = self.proxy()
+        self.assertEqual(p.upload.begin(*USUARIO, "a.bin", len(datos), crc(datos)), 0)
+        self.assertEqual(p.upload.chunk(*USUARIO, "a.bin", 0, xmlrpc.client.Binary(datos[:300])), 300)
+        self.assertEqual(p.upload.begin(*USUARIO, "a.bin", len(datos), crc(datos)), 300)
+
+        # El offset sale del .part aunque el servidor se reinicie
+        self.detener()
+        self.iniciar()
+        p = self.proxy()
+        self.assertEqual(p.upload.begin(*USUARIO, "a.bin", len(datos), crc(datos)), 300)
+        self.assertEqual(p.upload.chunk(*USUARIO, "a.bin", 300, xmlrpc.client.Binary(datos[300:])), 1000)
+        self.assertIn("a.bin", p.upload.commit(*USUARIO, "a.bin", len(datos), crc(datos)))
+        self.assertEqual(self.leer("a.bin"), datos)
+        self.assertEqual(self.archivos(), ["a.bin"])
+
+    def test_otra_subida_no_retoma_el_parcial(self):
+        viejo = b"A" * 10
+        nuevo = b"B" * 8
+        p = self.proxy()
+        self.assertEqual(p.upload.begin(*USUARIO, "b.txt", len(viejo), crc(viejo)), 0)
+        self.assertEqual(p.upload.chunk(*USUARIO, "b.txt", 0, xmlrpc.client.Binary(viejo[:5])), 5)
+
+        # Mismo nombre con otro tamaño y CRC: empieza de cero
+        self.assertEqual(p.upload.begin(*USUARIO, "b.txt", len(nuevo), crc(nuevo)), 0)
+        # y la parte que seguia a la subida anterior se rechaza
+        self.falla(lambda: p.upload.chunk(*USUARIO, "b.txt", 5, xmlrpc.client.Binary(viejo[5:])),
+                   "Offset mayor")
+        self.falla(lambda: p.upload.commit(*USUARIO, "b.txt", len(viejo), crc(viejo)),
+                   "Tamaño distinto")
+
+        self.assertEqual(p.upload.chunk(*USUARIO, "b.txt", 0, xmlrpc.client.Binary(nuevo)), 8)
+        p.upload.commit(*USUARIO, "b.txt", len(nuevo), crc(nuevo))
+        self.assertEqual(self.leer("b.txt"), nuevo)
+
+    def test_parte_que_pasa_del_tamano_declarado(self):
+        datos = b"0123456789"
+        p = self.proxy()
+        self.assertEqual(p.upload.begin(*USUARIO, "c.txt", 8, crc(datos[:8])), 0)
+        self.falla(lambda: p.upload.chunk(*USUARIO, "c.txt", 0, xmlrpc.client.Binary(datos)),
+                   "pasan del tamaño declarado")
+        self.assertEqual(p.upload.chunk(*USUARIO, "c.txt", 0, xmlrpc.client.Binary(datos[:6])), 6)
+        self.falla(lambda: p.upload.chunk(*USUARIO, "c.txt", 6, xmlrpc.client.Binary(datos[6:])),
+                   "pasan del tamaño declarado")
+
+        # Lo rechazado no se escribio
+        self.assertEqual(p.upload.begin(*USUARIO, "c.txt", 8, crc(datos[:8])), 6)
+        self.assertEqual(p.upload.chunk(*USUARIO, "c.txt", 6, xmlrpc.client.Binary(datos[6:8])), 8)
+        p.upload.commit(*USUARIO, "c.txt", 8, crc(datos[:8]))
+        self.assertEqual(self.leer("c.txt"), datos[:8])
+
+    def test_crc_distinto_descarta_la_subida(self):
+        esperado = b"hola mundo"
+        recibido = b"hola munda"
+        p = self.proxy()
+        self.assertEqual(p.upload.begin(*USUARIO, "d.txt", len(esperado), crc(esperado)), 0)
+        self.assertEqual(p.upload.chunk(*USUARIO, "d.txt", 0, xmlrpc.client.Binary(recibido)), 10)
+        self.falla(lambda: p.upload.commit(*USUARIO, "d.txt", len(esperado), crc(esperado)),
+                   "CRC-32 distinto")
+
+        # No queda el parcial, ni su .info, ni el archivo final
+        self.assertEqual(self.archivos(), [])
+        self.falla(lambda: p.upload.chunk(*USUARIO, "d.txt", 0, xmlrpc.client.Binary(esperado)),
+                   "Upload no iniciado")
+        self.falla(lambda: p.upload.commit(*USUARIO, "d.txt", len(esperado), crc(esperado)),
+                   "Upload no iniciado")
+
+        # Se puede volver a subir desde cero
+        self.assertEqual(p.upload.begin(*USUARIO, "d.txt", len(esperado), crc(esperado)), 0)
+        p.upload.chunk(*USUARIO, "d.txt", 0, xmlrpc.client.Binary(esperado))
+        p.upload.commit(*USUARIO, "d.txt", len(esperado), crc(esperado))
+        self.assertEqual(self.leer("d.txt"), esperado)
+        self.assertEqual(self.archivos(), ["d.txt"])
+
+    def test_commits_simultaneos(self):
+        # Mas commits a la vez que hilos de trabajo tiene el servidor
+        archivos = {"g%d.bin" % i: os.urandom(1 << 20) for i in range(8)}
+        p = self.proxy()
+        for nombre, datos in archivos.items():
+            self.assertEqual(p.upload.begin(*USUARIO, nombre, len(datos), crc(datos)), 0)
+            p.upload.chunk(*USUARIO, nombre, 0, xmlrpc.client.Binary(datos))
+
+        resultados = {}
+        def confirmar(nombre, datos):
+            with xmlrpc.client.ServerProxy("http://127.0.0.1:%d/RPC2" % self.puerto) as q:
+                resultados[nombre] = q.upload.commit(*USUARIO, nombre, len(datos), crc(datos))
+        hilos = [threading.Thread(target=confirmar, args=item) for item in archivos.items()]
+        for h in hilos:
+            h.start()
+        for h in hilos:
+            h.join()
+
+        for nombre, datos in archivos.items():
+            self.assertEqual(resultados[nombre], "Archivo subido: " + nombre)
+            self.assertEqual(self.leer(nombre), datos)
+        self.assertEqual(self.archivos(), sorted(archivos))
+
+
+if __name__ == "__main__":
+    unittest.main()
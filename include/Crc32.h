@@ -0,0 +1,23 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (el de zlib/PNG, polinomio 0xEDB88320), calculado por partes.
+// Cliente y servidor lo usan para verificar los archivos subidos.
+class Crc32 {
+private:
+    uint32_t crc;
+
+public:
+    Crc32() : crc(0xFFFFFFFFu) {}
+
+    // Agrega n bytes al calculo
+    void update(const void* data, std::size_t n);
+
+    // CRC de los bytes agregados hasta ahora
+    uint32_t getValor() const { return crc ^ 0xFFFFFFFFu; }
+};
+
+#endif
@@ -29,7 +29,7 @@ public:
     int getID() const { return ID; }
     std::string getUsuario() const { return nombreUsuario; }
     std::string getClave() const { return clave; }
-    Valor obtenerDato() const { return datos; }
+    const Valor& obtenerDato() const { return datos; }
 
     // --- Serialización / deserialización ---
     std::string Serializar() const;
@@ -25,9 +25,12 @@
 # include <string>
 #endif
 
+#include "XmlRpcBase64.h"
 #include "XmlRpcClient.h"
 #include "XmlRpcException.h"
+#include "XmlRpcParser.h"
 #include "XmlRpcServer.h"
+#include "XmlRpcServerCompletion.h"
 #include "XmlRpcServerMethod.h"
 #include "XmlRpcValue.h"
 #include "XmlRpcUtil.h"
@@ -0,0 +1,72 @@
+#ifndef _XMLRPCBASE64_H_
+#define _XMLRPCBASE64_H_
+//
+// XmlRpc++ Copyright (c) 2002-2003 by Chris Morley
+//
+#if defined(_MSC_VER)
+# pragma warning(disable:4786)    // identifier was truncated in debug info
+#endif
+
+#ifndef MAKEDEPEND
+# include <stddef.h>
+# include <string>
+# include <string_view>
+# include <vector>
+#endif
+
+namespace XmlRpc {
+
+  //! Base64 encoding of binary data, as in <base64> values. Data is
+  //! converted 16 or 32 bytes at a time where the cpu allows, straight
+  //! into an output buffer sized beforehand.
+  class XmlRpcBase64 {
+  public:
+    //! What ends each line of 72 chars in the encoded text
+    enum LineBreaks {
+      NoBreaks,       //!< a single line
+      LF,             //!< "\n", after every full line including the last
+      CRLF            //!< "\r\n", likewise
+    };
+
+    //! Length of the encoding of length bytes
+    static size_t encodedSize(size_t length, LineBreaks breaks = LF);
+
+    //! Append the encoding of the length bytes at data to encoded
+    static void encode(const void* data, size_t length, std::string& encoded, LineBreaks breaks = LF);
+
+    //! Largest number of bytes the text can decode to
+    static size_t decodedSize(size_t length) { return (length + 3) / 4 * 3; }
+
+    //! Append the data encoded in text to data. Whitespace is ignored and
+    //! the padding is optional. Returns false, leaving data as it was, if
+    //! the text holds other chars or ends in the middle of a byte.
+    static bool decode(std::string_view text, std::string& data);
+    static bool decode(std::string_view text, std::vector<char>& data);
+
+    //! Decodes text given in pieces, which may split groups of chars
+    class Decoder {
+    public:
+      Decoder();
+
+      //! Decode the next piece of text into data, which must have room for
+      //! decodedSize(text.size()) bytes. Sets length to the number of bytes
+      //! written. Returns false if the text is not valid.
+      bool decode(std::string_view text, char* data, size_t* length);
+
+      //! Write the bytes of an unpadded last group (at most 2) to data and
+      //! start over. Returns false if the text ended in the middle of a byte.
+      bool finish(char* data, size_t* length);
+
+    protected:
+      unsigned _group;      // Bits of the chars of a partial group
+      int _nChars;
+      bool _padded;
+    };
+
+  protected:
+    // Decode into the buffer at data, which has room for decodedSize() bytes
+    static bool decode(std::string_view text, char* data, size_t* length);
+  };
+} // namespace XmlRpc
+
+#endif // _XMLRPCBASE64_H_
@@ -14,6 +14,7 @@
 #endif
 
 #include "XmlRpcDispatch.h"
+#include "XmlRpcHttpHeader.h"
 #include "XmlRpcSource.h"
 
 namespace XmlRpc {
@@ -60,6 +61,9 @@ namespace XmlRpc {
     //! Returns true if the result of the last execute() was a fault response.
     bool isFault() const { return _isFault; }
 
+    //! Fail requests whose response header is larger than the specified number of bytes.
+    void setMaxHeaderSize(size_t n) { _headerParser.setMaxSize(n); }
+
 
     // XmlRpcSource interface implementation
     //! Close the connection
@@ -91,11 +95,16 @@ namespace XmlRpc {
     std::string _uri;
     int _port;
 
-    // The xml-encoded request, http header of response, and response xml
+    // The http header and xml-encoded body of the request (written together),
+    // http header of response, and response xml
+    std::string _requestHeader;
     std::string _request;
     std::string _header;
     std::string _response;
 
+    // Parses the response header as it arrives
+    XmlRpcHttpHeader _headerParser;
+
     // Number of times the client has attempted to send the request
     int _sendAttempts;
 
@@ -108,9 +117,9 @@ namespace XmlRpc {
 
     // True if the server closed the connection
     bool _eof;
-
-    // True if a fault response was returned by the server
-    bool _isFault;
+
+    // True if a fault response was returned by the server
+    bool _isFault;
 
     // Number of bytes expected in the response body (parsed from response header)
     int _contentLength;
@@ -9,21 +9,33 @@
 #endif
 
 #ifndef MAKEDEPEND
+# include <atomic>
+# include <functional>
 # include <list>
+# include <mutex>
+# include <unordered_map>
+# include <vector>
 #endif
 
+#include "XmlRpcPoller.h"
+
 namespace XmlRpc {
 
   // An RPC source represents a file descriptor to monitor
   class XmlRpcSource;
 
+  // A callback to run after a delay
+  class XmlRpcTimer;
+
   //! An object which monitors file descriptors for events and performs
   //! callbacks when interesting events happen.
   class XmlRpcDispatch {
   public:
     //! Constructor
-    XmlRpcDispatch();
-    ~XmlRpcDispatch();
+    //!  @param poller The mechanism used to wait for events. The dispatcher takes
+    //!  ownership of it. By default the best one for the platform is used.
+    XmlRpcDispatch(XmlRpcPoller* poller = 0);
+    virtual ~XmlRpcDispatch();
 
     //! Values indicating the type of events a source is interested in
     enum EventType {
@@ -53,20 +65,46 @@ namespace XmlRpc {
     //! Exit from work routine
     void exit();
 
+    //! Allow exit() to be called from other threads. Once enabled, an exit()
+    //! requested while work() is not running makes the next work() return
+    //! after its first pass. Call before work() is started.
+    //! Returns false if the platform cannot wake up a waiting dispatcher.
+    bool enableWakeup();
+
+    //! Run a function on the thread executing work(), after the events being
+    //! processed. May be called from any thread once wakeups are enabled.
+    void post(std::function<void()> const& task);
+
     //! Clear all sources from the monitored sources list. Sources are closed.
     void clear();
 
+    //! Return the number of sources being monitored
+    size_t getSourceCount() const { return _sources.size() - _removed.size(); }
+
+    //! Run the timer's callback after delay seconds, then every interval seconds
+    //! if interval is positive. Scheduling a scheduled timer moves it. Timers
+    //! must be scheduled and cancelled on the thread executing work().
+    void schedule(XmlRpcTimer* timer, double delay, double interval = 0.0);
+
+    //! Stop a scheduled timer.
+    void cancel(XmlRpcTimer* timer);
+
+    //! Resolution of timers, in seconds
+    static const double TIMER_TICK;
+
   protected:
 
-    // helper
-    double getTime();
+    // helper (seconds on a monotonic clock)
+    virtual double getTime();
 
-    // A source to monitor and what to monitor it for
+    // A source to monitor and what to monitor it for. The poller reports
+    // events with a pointer to this entry, so entries must not move.
     struct MonitoredSource {
-      MonitoredSource(XmlRpcSource* src, unsigned mask) : _src(src), _mask(mask) {}
+      MonitoredSource(XmlRpcSource* src, int fd, unsigned mask) : _src(src), _fd(fd), _mask(mask) {}
       XmlRpcSource* getSource() const { return _src; }
       unsigned& getMask() { return _mask; }
-      XmlRpcSource* _src;
+      XmlRpcSource* _src;     // 0 once the source has been removed
+      int _fd;                // The fd registered with the poller
       unsigned _mask;
     };
 
@@ -76,12 +114,68 @@ namespace XmlRpc {
     // Sources being monitored
     SourceList _sources;
 
+    // Entries indexed by source, so sources are found without searching the
+    // list even after they have closed or replaced their socket
+    std::unordered_map< XmlRpcSource*, SourceList::iterator > _bySource;
+
+    // Locate the entry of a source, or _sources.end()
+    SourceList::iterator findSource(XmlRpcSource* source);
+
+    // Forget a source. During work() the entry is only marked as removed
+    // because the poller may still report events for it in the current batch.
+    void removeEntry(SourceList::iterator it);
+
+    // Free the entries of sources removed while processing events
+    void purgeRemoved();
+
+    // Run the functions passed to post()
+    void runPosted();
+
+    // Entries of sources removed during the current batch of events
+    std::vector< SourceList::iterator > _removed;
+
+    // Waits for events on the monitored sources
+    XmlRpcPoller* _poller;
+
+    // Events reported by the last wait
+    std::vector< XmlRpcPoller::Event > _events;
+
     // When work should stop (-1 implies wait forever, or until exit is called)
     double _endTime;
 
     bool _doClear;
     bool _inWork;
 
+    // Whether exit() may be called from other threads (see enableWakeup)
+    bool _wakeupEnabled;
+
+    // Set by exit() when wakeups are enabled, cleared when work returns
+    std::atomic<bool> _exitRequested;
+
+    // Functions passed to post() by other threads
+    std::mutex _postMutex;
+    std::vector< std::function<void()> > _posted;
+
+    // Run the callbacks of expired timers
+    void runTimers();
+
+    // Timer wheel slot list operations
+    void linkTimer(XmlRpcTimer* timer);
+    void unlinkTimer(XmlRpcTimer* timer);
+
+    // First tick after the current one with a timer in its slot
+    long long nextTimerTick();
+
+    // Timers are hashed into the slots of a wheel by their expiry tick. Only
+    // the slots of the ticks that have passed are visited.
+    enum { WHEEL_SIZE = 512 };
+    XmlRpcTimer* _wheel[WHEEL_SIZE];
+    unsigned long long _slotsUsed[WHEEL_SIZE / 64];
+
+    long long _currentTick;   // Last tick whose timers have been run
+    long long _nextTick;      // No timer expires before this tick
+    int _timerCount;
+
   };
 } // namespace XmlRpc
 
@@ -0,0 +1,93 @@
+#ifndef _XMLRPCHTTPHEADER_H_
+#define _XMLRPCHTTPHEADER_H_
+//
+// XmlRpc++ Copyright (c) 2002-2003 by Chris Morley
+//
+#if defined(_MSC_VER)
+# pragma warning(disable:4786)    // identifier was truncated in debug info
+#endif
+
+#ifndef MAKEDEPEND
+# include <string>
+#endif
+
+namespace XmlRpc {
+
+  //! Incremental parser for the header of an HTTP/1.x request or response.
+  //! Data is passed in as it arrives and each byte is examined once, so a
+  //! header received in many small pieces is not rescanned.
+  class XmlRpcHttpHeader {
+  public:
+    //! Result of parse()
+    enum Status {
+      INCOMPLETE,   //!< More data is needed
+      COMPLETE,     //!< The blank line ending the header was found
+      TOO_LARGE,    //!< The header exceeds the maximum size
+      INVALID       //!< A field could not be parsed
+    };
+
+    //! Default limit on the size of a header
+    static const size_t DEFAULT_MAX_SIZE = 65536;
+
+    //! Constructor
+    //!   @param maxSize Largest header accepted, in bytes
+    XmlRpcHttpHeader(size_t maxSize = DEFAULT_MAX_SIZE);
+
+    //! Forget the parsed fields to parse a new header
+    void reset();
+
+    //! Parse the next length bytes of the message. When the header is complete,
+    //! *consumed is the number of those bytes that belong to the header, the
+    //! rest are the start of the body.
+    Status parse(const char* data, size_t length, size_t* consumed);
+
+    //! Return the number of header bytes parsed so far.
+    size_t size() const { return _size; }
+
+    //! Specify the largest header accepted.
+    void setMaxSize(size_t maxSize) { _maxSize = maxSize; }
+    size_t getMaxSize() const { return _maxSize; }
+
+    //! The request or status line
+    const std::string& startLine() const { return _startLine; }
+
+    //! The Content-Length field, or -1 if there is none. Values above
+    //! INT_MAX make parse() return INVALID.
+    long contentLength() const { return _contentLength; }
+
+    //! The Connection field
+    const std::string& connection() const { return _connection; }
+
+    //! The Content-Encoding field
+    const std::string& contentEncoding() const { return _contentEncoding; }
+
+    //! The Transfer-Encoding field
+    const std::string& transferEncoding() const { return _transferEncoding; }
+
+    //! Return true if the message is HTTP/1.0
+    bool isHttp10() const;
+
+    //! Return true if the connection persists after this message: HTTP/1.1
+    //! unless Connection is close, HTTP/1.0 only if Connection is keep-alive.
+    bool keepAlive() const;
+
+  private:
+    // Parse a complete line, without its line ending
+    Status parseLine();
+
+    size_t _maxSize;
+    size_t _size;
+
+    // The line being received
+    std::string _line;
+    bool _complete;
+
+    std::string _startLine;
+    long _contentLength;
+    std::string _connection;
+    std::string _contentEncoding;
+    std::string _transferEncoding;
+  };
+} // namespace XmlRpc
+
+#endif  // _XMLRPCHTTPHEADER_H_
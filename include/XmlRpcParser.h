@@ -0,0 +1,176 @@
+
+#ifndef _XMLRPCPARSER_H_
+#define _XMLRPCPARSER_H_
+//
+// XmlRpc++ Copyright (c) 2002-2003 by Chris Morley
+//
+#if defined(_MSC_VER)
+# pragma warning(disable:4786)    // identifier was truncated in debug info
+#endif
+
+#ifndef MAKEDEPEND
+# include <cstdint>
+# include <string>
+# include <string_view>
+# include <vector>
+# include <time.h>
+#endif
+
+#include "XmlRpcTokenizer.h"
+
+namespace XmlRpc {
+
+  //! Reads the xml of a value as a sequence of events, without building
+  //! the value. Arrays and structs are reported by start and end events
+  //! around the events of their elements; each struct member is announced
+  //! by a Member event carrying its name.
+  //!
+  //! Events are pulled with next(), or pushed to a Handler with parse().
+  //! The xml must not be modified while it is parsed.
+  class XmlRpcParser {
+  public:
+
+    enum Event {
+      Error,          //!< the xml is not a valid value
+      End,            //!< the value has been read entirely
+      Boolean,
+      Int,
+      Int64,
+      Double,
+      String,
+      DateTime,
+      Base64,
+      StartArray,
+      EndArray,
+      StartStruct,
+      Member,         //!< a struct member, whose value follows
+      EndStruct
+    };
+
+    //! What the xml holds
+    enum Input {
+      ValueXml,       //!< a <value> element
+      ParamsXml       //!< the <params> of a request, read as an array of the parameters
+    };
+
+    //! Receives the events of a value pushed by parse(). Each method
+    //! returns false to stop parsing. The defaults ignore the event.
+    class Handler {
+    public:
+      virtual ~Handler() {}
+
+      virtual bool onBoolean(bool) { return true; }
+      virtual bool onInt(int) { return true; }
+      virtual bool onInt64(std::int64_t) { return true; }
+      virtual bool onDouble(double) { return true; }
+      //! text has its entities decoded, and is only valid during the call
+      virtual bool onString(std::string_view) { return true; }
+      virtual bool onDateTime(struct tm const&) { return true; }
+      virtual bool onBase64(std::vector<char> const&) { return true; }
+      virtual bool onStartArray() { return true; }
+      virtual bool onEndArray() { return true; }
+      virtual bool onStartStruct() { return true; }
+      //! name has its entities decoded, and is only valid during the call
+      virtual bool onMember(std::string_view) { return true; }
+      virtual bool onEndStruct() { return true; }
+    };
+
+    //! Parse the value (or the parameters) starting at offset chars into xml
+    XmlRpcParser(std::string const& xml, int offset = 0, Input input = ValueXml);
+
+    //! Read the next event. Error and End are repeated once reached.
+    Event next();
+
+    //! Skip the contents of the array or struct just started: the next
+    //! event is the one following its end. Returns false on error.
+    bool skip();
+
+    //! Push the remaining events to handler. Returns true if the end of
+    //! the value was reached.
+    bool parse(Handler& handler);
+
+    //! The last event read
+    Event getEvent() const { return _event; }
+
+    //! The xml being parsed
+    std::string const& getXml() const { return _xml; }
+
+    //! Offset in the xml of the first char not parsed yet
+    int getOffset() const { return int(_tokens.getOffset()); }
+
+    //! Offset in the xml of the value of the last event (for a value or a start event)
+    int getValueOffset() const { return _valueOffset; }
+
+    // Data of the last event
+    bool getBool() const { return _number.asBool; }
+    int getInt() const { return _number.asInt; }
+    std::int64_t getInt64() const { return _number.asInt64; }
+    double getDouble() const { return _number.asDouble; }
+
+    //! The text of a String, Base64 or Member event, as it is in the xml
+    std::string_view getText() const { return _text; }
+
+    //! Whether the text contains entities to decode
+    bool isEncoded() const { return _encoded; }
+
+    //! The text of a String or Member event with its entities decoded
+    std::string getString() const;
+
+    //! The fields of a DateTime event, as in the xml (tm_year is the year,
+    //! tm_mon the month from 1)
+    void getTime(struct tm& t) const;
+
+    //! Append the decoded data of a Base64 event to data. Returns false if
+    //! the text is not valid base64.
+    bool getBinary(std::vector<char>& data) const;
+
+  protected:
+    // Read the value whose <value> tag was just read
+    Event parseValue();
+
+    // Read the text and end tag of a scalar whose type tag was just read
+    bool readScalar();
+
+    // Read the number in the text of a scalar
+    template <typename T>
+    bool readNumber(T& value);
+
+    // Read the next tag, skipping whitespace. Any other text is an error.
+    XmlRpcTokenizer::Token nextTag();
+
+    // Whether the next tag is the specified start or end tag
+    bool nextTagIs(XmlRpcTokenizer::Token token, const char* name);
+
+    // Leave an array or struct
+    Event endContainer(Event event);
+
+    Event fail() { return _event = Error; }
+
+    // Arrays and structs can be nested this deep
+    enum { MAX_DEPTH = 256 };
+
+    // What is being read at each level of nesting
+    enum Level { IN_ARRAY, IN_STRUCT, IN_MEMBER, AFTER_MEMBER, IN_PARAMS, AFTER_PARAM, NO_PARAMS };
+
+    std::string const& _xml;
+    XmlRpcTokenizer _tokens;
+    int _valueOffset;
+    Event _event;
+
+    unsigned char _levels[MAX_DEPTH];
+    int _depth;
+    bool _started;
+
+    std::string_view _text;
+    bool _encoded;
+    union {
+      bool asBool;
+      int asInt;
+      std::int64_t asInt64;
+      double asDouble;
+    } _number;
+    int _time[6];
+  };
+} // namespace XmlRpc
+
+#endif // _XMLRPCPARSER_H_
@@ -0,0 +1,67 @@
+#ifndef _XMLRPCPOLLER_H_
+#define _XMLRPCPOLLER_H_
+//
+// XmlRpc++ Copyright (c) 2002-2003 by Chris Morley
+//
+#if defined(_MSC_VER)
+# pragma warning(disable:4786)    // identifier was truncated in debug info
+#endif
+
+#ifndef MAKEDEPEND
+# include <vector>
+#endif
+
+namespace XmlRpc {
+
+  //! The operating system mechanism an XmlRpcDispatch uses to wait for
+  //! events on file descriptors. Event masks are XmlRpcDispatch::EventType values.
+  class XmlRpcPoller {
+  public:
+    //! A file descriptor that became ready: the cookie it was registered
+    //! with and the events that occurred.
+    struct Event {
+      void* cookie;
+      unsigned events;
+    };
+
+    //! Create the most efficient poller available on this platform
+    //! (epoll on linux, select elsewhere).
+    static XmlRpcPoller* create();
+
+    //! Create a poller based on select(). Limited to descriptors below FD_SETSIZE.
+    static XmlRpcPoller* createSelect();
+
+    //! Create a poller based on epoll. Returns 0 if epoll is not available.
+    static XmlRpcPoller* createEpoll();
+
+    //! Destructor
+    virtual ~XmlRpcPoller() {}
+
+    //! Watch fd for the events in mask. The cookie is reported back with each event.
+    //! Returns false if the descriptor cannot be monitored.
+    virtual bool add(int fd, unsigned mask, void* cookie) = 0;
+
+    //! Change the events watched on a descriptor that was added.
+    virtual bool modify(int fd, unsigned mask, void* cookie) = 0;
+
+    //! Stop watching fd.
+    virtual void remove(int fd) = 0;
+
+    //! Wait up to timeout seconds (-1 means forever) for events and store
+    //! them in events. Returns the number of ready descriptors, or -1 on error.
+    virtual int wait(double timeout, std::vector<Event>& events) = 0;
+
+    //! Create the descriptor used by interrupt(). Returns false if the
+    //! platform does not support it. Call before waiting.
+    virtual bool enableInterrupt() = 0;
+
+    //! Make a wait in progress (or the next one) return early. This may be
+    //! called from any thread once enableInterrupt() has succeeded.
+    virtual void interrupt() = 0;
+
+    //! Name of the mechanism, for log messages.
+    virtual const char* name() const = 0;
+  };
+} // namespace XmlRpc
+
+#endif  // _XMLRPCPOLLER_H_
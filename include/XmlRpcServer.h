@@ -9,8 +9,12 @@
 #endif
 
 #ifndef MAKEDEPEND
+# include <atomic>
 # include <map>
+# include <mutex>
+# include <set>
 # include <string>
+# include <vector>
 #endif
 
 #include "XmlRpcDispatch.h"
@@ -28,6 +32,12 @@ namespace XmlRpc {
   // Class representing argument and result values
   class XmlRpcValue;
 
+  // An additional event loop thread of a multi-reactor server
+  class XmlRpcServerReactor;
+
+  // Threads executing methods outside of the event loops
+  class XmlRpcThreadPool;
+
 
   //! A class to handle XML RPC requests
   class XmlRpcServer : public XmlRpcSource {
@@ -52,17 +62,74 @@ namespace XmlRpc {
     //! Look up a method by name
     XmlRpcServerMethod* findMethod(const std::string& name) const;
 
+    //! Specify the number of event loop threads (reactors) used by work().
+    //! Each reactor has its own dispatcher and its own listening socket bound
+    //! to the port with SO_REUSEPORT, and serves the connections it accepts.
+    //! Methods may then execute concurrently, and must not be added or removed
+    //! while the server is working. Call before bindAndListen. Default is 1.
+    void setReactorCount(int n);
+
+    //! Return the number of event loop threads used by work().
+    int getReactorCount() const { return _reactorCount; }
+
+    //! Execute methods on a pool of n worker threads rather than in the event
+    //! loop, so a long running method does not hold up other clients. Methods
+    //! may then execute concurrently. 0 (the default) executes methods in the
+    //! event loop. Call before work(). The threads are stopped by shutdown()
+    //! and started again by the next work().
+    void setWorkerThreads(int n);
+
+    //! Return the pool of threads executing methods, or 0 if methods are
+    //! executed in the event loop.
+    XmlRpcThreadPool* getWorkerPool() const { return _workers; }
+
+    //! Close client connections that stay idle between requests for longer
+    //! than seconds. 0 (the default) means no limit.
+    void setIdleTimeout(double seconds) { _idleTimeout = seconds; }
+    double getIdleTimeout() const { return _idleTimeout; }
+
+    //! Close client connections that take longer than seconds to send the
+    //! header of a request once it has started. 0 (the default) means no limit.
+    void setHeaderTimeout(double seconds) { _headerTimeout = seconds; }
+    double getHeaderTimeout() const { return _headerTimeout; }
+
+    //! Close client connections that take longer than seconds to send the
+    //! body of a request after its header. 0 (the default) means no limit.
+    void setBodyTimeout(double seconds) { _bodyTimeout = seconds; }
+    double getBodyTimeout() const { return _bodyTimeout; }
+
+    //! Limit the number of client connections. Clients connecting beyond the
+    //! limit get a 503 response and are disconnected. 0 (the default) means no limit.
+    void setMaxConnections(int n) { _maxConnections = n; }
+    int getMaxConnections() const { return _maxConnections; }
+
+    //! Return the number of client connections currently open.
+    int getConnectionCount() const { return _connectionCount.load(); }
+
+    //! Only report connections once the client has sent data, or after the
+    //! specified number of seconds (where supported). 0 (the default) disables
+    //! this. Call before bindAndListen.
+    void setDeferAccept(int seconds) { _deferAccept = seconds; }
+
+    //! Close client connections that send a request header larger than
+    //! the specified number of bytes.
+    void setMaxHeaderSize(size_t n) { _maxHeaderSize = n; }
+    size_t getMaxHeaderSize() const { return _maxHeaderSize; }
+
     //! Create a socket, bind to the specified port, and
     //! set it in listen mode to make it available for clients.
-    bool bindAndListen(int port, int backlog = 5);
+    //! Backlog is the number of pending connections the kernel queues.
+    bool bindAndListen(int port, int backlog = 128);
 
     //! Process client requests for the specified time
     void work(double msTime);
 
     //! Temporarily stop processing client requests and exit the work() method.
+    //! May be called from another thread.
     void exit();
 
-    //! Close all connections with clients and the socket file descriptor
+    //! Close all connections with clients and the socket file descriptor,
+    //! including those waiting for the results of asynchronous methods
     void shutdown();
 
     //! Introspection support
@@ -73,23 +140,76 @@ namespace XmlRpc {
     //! Handle client connection requests
     virtual unsigned handleEvent(unsigned eventType);
 
-    //! Remove a connection from the dispatcher
+    //! Remove a connection from the dispatcher. Called when the connection is destroyed.
     virtual void removeConnection(XmlRpcServerConnection*);
 
+    //! Keep track of a connection waiting for the result of an asynchronous
+    //! method. It is not monitored by any dispatcher until the result arrives.
+    void addParkedConnection(XmlRpcServerConnection* sc);
+
+    //! Stop tracking a connection once the result has arrived.
+    void removeParkedConnection(XmlRpcServerConnection* sc);
+
   protected:
+    friend class XmlRpcServerReactor;
 
     //! Accept a client connection request
     virtual void acceptConnection();
 
+    //! Accept the connection requests pending on a listening socket and
+    //! monitor the new connections with the specified dispatcher.
+    void acceptConnection(int listenFd, XmlRpcDispatch* disp);
+
+    //! Turn away a client when the connection limit is reached.
+    virtual void rejectConnection(int socket, XmlRpcDispatch* disp);
+
     //! Create a new connection object for processing requests from a specific client.
     virtual XmlRpcServerConnection* createConnection(int socket);
 
+    //! Close the connections waiting for the results of asynchronous methods.
+    void closeParkedConnections();
+
+    //! Create a non-blocking socket bound to the specified port in listening mode.
+    //! Returns -1 on failure.
+    int listenSocket(int port, int backlog, bool reusePort);
+
+    //! Delay reporting connections on a listening socket until data arrives.
+    //! Failure is not fatal: connections are then reported as soon as they are made.
+    virtual bool deferAccept(int fd);
+
     // Whether the introspection API is supported by this server
     bool _introspectionEnabled;
 
     // Event dispatcher
     XmlRpcDispatch _disp;
 
+    // Number of event loop threads, including the one calling work()
+    int _reactorCount;
+
+    // Event loops run in additional threads by work()
+    std::vector<XmlRpcServerReactor*> _reactors;
+
+    // Threads executing methods, if any, and how many there are to be
+    XmlRpcThreadPool* _workers;
+    int _workerThreads;
+
+    // Connection admission
+    int _maxConnections;
+    std::atomic<int> _connectionCount;
+    int _deferAccept;
+
+    // Largest request header accepted
+    size_t _maxHeaderSize;
+
+    // Connections waiting for the results of asynchronous methods
+    std::set<XmlRpcServerConnection*> _parked;
+    std::mutex _parkedMutex;
+
+    // Connection timeouts in seconds (0 = none)
+    double _idleTimeout;
+    double _headerTimeout;
+    double _bodyTimeout;
+
     // Collection of methods. This could be a set keyed on method name if we wanted...
     typedef std::map< std::string, XmlRpcServerMethod* > MethodMap;
     MethodMap _methods;
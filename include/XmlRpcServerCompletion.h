@@ -0,0 +1,119 @@
+#ifndef _XMLRPCSERVERCOMPLETION_H_
+#define _XMLRPCSERVERCOMPLETION_H_
+//
+// XmlRpc++ Copyright (c) 2002-2003 by Chris Morley
+//
+#if defined(_MSC_VER)
+# pragma warning(disable:4786)    // identifier was truncated in debug info
+#endif
+
+#ifndef MAKEDEPEND
+# include <atomic>
+# include <condition_variable>
+# include <memory>
+# include <memory_resource>
+# include <mutex>
+# include <string>
+#endif
+
+#include "XmlRpcValue.h"
+
+namespace XmlRpc {
+
+  // The connection waiting for the result
+  class XmlRpcServerConnection;
+  class XmlRpcDispatch;
+
+  //! The pending result of an asynchronous method call. A method started with
+  //! XmlRpcServerMethod::executeAsync delivers its result by calling complete()
+  //! or fail() exactly once, from any thread, either before executeAsync returns
+  //! or later. A result delivered after the connection was closed is dropped.
+  class XmlRpcServerCompletion {
+  public:
+    //! The connection a completion answers on. It is shared with the connection,
+    //! which is closed without waiting for the result when the server shuts down.
+    struct Target {
+      Target(XmlRpcServerConnection* c, XmlRpcDispatch* d) : conn(c), disp(d), resumed(false) {}
+
+      std::mutex mutex;
+      XmlRpcServerConnection* conn;   //!< 0 once the connection is closed
+      XmlRpcDispatch* disp;           //!< Where the connection is resumed
+      bool resumed;                   //!< Set once the connection is posted to disp
+    };
+
+    //! The text of a request and the arena its parameters are allocated from.
+    //! A completion keeps its request, so the parameters passed to executeAsync
+    //! stay valid as long as the completion is referenced.
+    struct Request {
+      explicit Request(std::string&& text) : xml(std::move(text)), arena(xml.length()) {}
+
+      std::string xml;
+      std::pmr::monotonic_buffer_resource arena;
+    };
+
+    //! Create a completion that waits for the result in wait().
+    explicit XmlRpcServerCompletion(std::shared_ptr<Request> const& request = std::shared_ptr<Request>());
+
+    //! Create a completion that answers the request on a connection.
+    //! The connection is resumed in the event loop of disp.
+    XmlRpcServerCompletion(XmlRpcServerConnection* conn, XmlRpcDispatch* disp,
+                           std::shared_ptr<Request> const& request = std::shared_ptr<Request>());
+
+    //! Destructor. A completion destroyed without a result answers with a fault.
+    ~XmlRpcServerCompletion();
+
+    //! Deliver the result of the method.
+    void complete(XmlRpcValue const& result);
+
+    //! Deliver the result of the method, which is moved rather than copied.
+    void complete(XmlRpcValue&& result);
+
+    //! Deliver a fault response.
+    void fail(std::string const& message, int code = -1);
+
+    //! Return true once a result or fault has been delivered.
+    bool isDone() const { return _state.load() == DONE; }
+
+    //! Block until a result is delivered and store it in result. A fault is
+    //! thrown as an XmlRpcException.
+    void wait(XmlRpcValue& result);
+
+    //! Called by the connection when executeAsync has returned. Returns true if
+    //! the result is still to come, in which case the connection is resumed
+    //! when it arrives. Returns false if the response is already generated.
+    bool park();
+
+    //! Return the connection the result is delivered to, if any.
+    std::shared_ptr<Target> const& getTarget() const { return _target; }
+
+  private:
+    // Claim the right to deliver the result
+    bool claim();
+
+    // Lock the target, if any, and return its connection
+    XmlRpcServerConnection* lockTarget(std::unique_lock<std::mutex>& lock);
+
+    // Hand the result to whoever is waiting for it, with the target locked
+    void finish(XmlRpcServerConnection* conn);
+
+    enum State { PENDING, PARKED, DONE };
+
+    // Released last, a result moved in may be allocated from its arena
+    std::shared_ptr<Request> _request;
+
+    std::shared_ptr<Target> _target;
+
+    std::atomic<int> _state;
+    std::atomic<bool> _claimed;
+
+    // Result storage when there is no connection
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    XmlRpcValue _result;
+    bool _isFault;
+    std::string _faultString;
+    int _faultCode;
+  };
+} // namespace XmlRpc
+
+#endif  // _XMLRPCSERVERCOMPLETION_H_
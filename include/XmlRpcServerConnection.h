@@ -8,11 +8,15 @@
 #endif
 
 #ifndef MAKEDEPEND
+# include <memory>
 # include <string>
 #endif
 
+#include "XmlRpcHttpHeader.h"
+#include "XmlRpcServerCompletion.h"
 #include "XmlRpcValue.h"
 #include "XmlRpcSource.h"
+#include "XmlRpcTimer.h"
 
 namespace XmlRpc {
 
@@ -20,6 +24,7 @@ namespace XmlRpc {
   // The server waits for client connections and provides methods
   class XmlRpcServer;
   class XmlRpcServerMethod;
+  class XmlRpcDispatch;
 
   //! A class to handle XML RPC requests from a particular client
   class XmlRpcServerConnection : public XmlRpcSource {
@@ -48,17 +53,55 @@ namespace XmlRpc {
     //!   @param eventType Type of IO event that occurred. @see XmlRpcDispatch::EventType.
     virtual unsigned handleEvent(unsigned eventType);
 
+    //! Return the dispatcher monitoring this connection (0 means the server's own).
+    XmlRpcDispatch* getDispatch() const { return _disp; }
+
+    //! Specify the dispatcher monitoring this connection. This starts the
+    //! server's idle timeout for the connection.
+    void setDispatch(XmlRpcDispatch* disp);
+
+    //! Close the connection if it is waiting for the result of an asynchronous
+    //! method, unless the result has arrived. Called when the server shuts down.
+    void closeParked();
+
   protected:
 
     bool readHeader();
     bool readRequest();
     bool writeResponse();
 
+    // Hand the request to the server's worker threads. The connection is not
+    // monitored until the response is ready.
+    void executeOnWorker();
+
+    // Called in the event loop once a worker has generated the response.
+    void resumeResponse();
+
+    // Close the connection if the current state lasts more than seconds (0 = no limit)
+    void setDeadline(double seconds);
+
+    // The current state lasted too long
+    void deadlineExpired();
+
     // Parses the request, runs the method, generates the response xml.
-    virtual void executeRequest();
+    // Returns false if an asynchronous method will generate the response later.
+    virtual bool executeRequest();
+
+    // Start an asynchronous method. Returns false if the result is still to come.
+    bool executeAsync(XmlRpcServerMethod* method, XmlRpcValue& params,
+                      std::shared_ptr<XmlRpcServerCompletion::Request> const& request);
+
+    // Parse the method name from the request, and set offset past it
+    std::string parseMethodName(int* offset);
+
+    // Offer the parameters following offset in the request to a method that reads
+    // them as events. Returns false if the method needs them as values instead.
+    bool executeStreamed(XmlRpcServerMethod* method, int offset);
 
-    // Parse the methodName and parameters from the request.
-    std::string parseRequest(XmlRpcValue& params);
+    // Parse the parameters following offset in the request xml into an array. The
+    // parameters are allocated from arena if one is specified, and refer to xml.
+    bool parseParams(std::string const& xml, int offset, XmlRpcValue& params,
+                     std::pmr::memory_resource* arena = 0);
 
     // Execute a named method with the specified params.
     bool executeMethod(const std::string& methodName, XmlRpcValue& params, XmlRpcValue& result);
@@ -66,36 +109,68 @@ namespace XmlRpc {
     // Execute multiple calls and return the results in an array.
     bool executeMulticall(const std::string& methodName, XmlRpcValue& params, XmlRpcValue& result);
 
-    // Construct a response from the result XML.
-    void generateResponse(std::string const& resultXml);
+    // Construct a response from the result, encoded directly into _responseValue.
+    // An invalid result is sent as an empty string.
+    void generateResponse(XmlRpcValue const& result);
     void generateFaultResponse(std::string const& msg, int errorCode = -1);
-    std::string generateHeader(std::string const& body);
+    void generateHeader(size_t contentLength);
 
+    // Whether a response is waiting to be written
+    bool hasResponse() const { return _responseLength > 0; }
+
+    // Forget the response once written
+    void clearResponse();
+
+
+    // Asynchronous methods deliver their response through a completion
+    friend class XmlRpcServerCompletion;
 
     // The XmlRpc server that accepted this connection
     XmlRpcServer* _server;
 
+    // The dispatcher (event loop) monitoring this connection
+    XmlRpcDispatch* _disp;
+
     // Possible IO states for the connection
-    enum ServerConnectionState { READ_HEADER, READ_REQUEST, WRITE_RESPONSE };
+    enum ServerConnectionState { READ_HEADER, READ_REQUEST, EXECUTING, WRITE_RESPONSE };
     ServerConnectionState _connectionState;
 
-    // Request headers
+    // Request header data not yet parsed
     std::string _header;
 
+    // Parses the request header as it arrives
+    XmlRpcHttpHeader _headerParser;
+
     // Number of bytes expected in the request body (parsed from header)
     int _contentLength;
 
     // Request body
     std::string _request;
 
-    // Response
-    std::string _response;
+    // Request whose parameters are being passed to methods by executeRequest
+    std::shared_ptr<XmlRpcServerCompletion::Request> _executing;
+
+    // Data received after the current request, from requests pipelined by the client
+    std::string _pipelined;
+
+    // Response. It is written from these pieces without joining them.
+    std::string _responseHeader;    // HTTP header
+    const char* _responseStart;     // Start of the methodResponse envelope
+    std::string _responseValue;     // Xml of the result or fault value
+    const char* _responseEnd;       // End of the envelope
+    int _responseLength;            // Total length, 0 if there is no response
 
     // Number of bytes of the response written so far
     int _bytesWritten;
 
     // Whether to keep the current client connection open for further requests
     bool _keepAlive;
+
+    // Idle, header or body timeout of the current state
+    XmlRpcTimer _deadline;
+
+    // Where the result of the asynchronous method being waited for is delivered
+    std::shared_ptr<XmlRpcServerCompletion::Target> _parked;
   };
 } // namespace XmlRpc
 
@@ -9,6 +9,8 @@
 #endif
 
 #ifndef MAKEDEPEND
+# include <atomic>
+# include <memory>
 # include <string>
 #endif
 
@@ -20,6 +22,12 @@ namespace XmlRpc {
   // The XmlRpcServer processes client requests to call RPCs
   class XmlRpcServer;
 
+  // The pending result of an asynchronous method
+  class XmlRpcServerCompletion;
+
+  // Reads parameters as a sequence of events
+  class XmlRpcParser;
+
   //! Abstract class representing a single RPC method
   class XmlRpcServerMethod {
   public:
@@ -31,8 +39,26 @@ namespace XmlRpc {
     //! Returns the name of the method
     std::string& name() { return _name; }
 
-    //! Execute the method. Subclasses must provide a definition for this method.
-    virtual void execute(XmlRpcValue& params, XmlRpcValue& result) = 0;
+    //! Execute the method. Subclasses must override either this method or
+    //! executeAsync. The default starts executeAsync and waits for its result,
+    //! and throws an XmlRpcException if neither is overridden.
+    virtual void execute(XmlRpcValue& params, XmlRpcValue& result);
+
+    //! Start executing the method and deliver the result later through done,
+    //! from any thread. params, and values moved out of it, refer to the request
+    //! kept by done: they stay valid as long as done is referenced, and must be
+    //! destroyed before it. Copies do not refer to the request. The server
+    //! does not tie up a thread while the result is pending. Calls from
+    //! system.multicall fail if the result is still to come when this returns.
+    //! The default calls execute and completes immediately.
+    virtual void executeAsync(XmlRpcValue& params, std::shared_ptr<XmlRpcServerCompletion> done);
+
+    //! Execute the method reading its parameters as they are parsed, without
+    //! building them as values: params reports them as the elements of an array.
+    //! Return false, before reading any event, to be called through execute
+    //! instead. Calls from system.multicall always go through execute.
+    //! The default returns false.
+    virtual bool executeStreamed(XmlRpcParser& params, XmlRpcValue& result);
 
     //! Returns a help string for the method.
     //! Subclasses should define this method if introspection is being used.
@@ -41,6 +67,9 @@ namespace XmlRpc {
   protected:
     std::string _name;
     XmlRpcServer* _server;
+
+    // Set by the default executeAsync, so the default execute does not call it back
+    std::atomic<bool> _asyncNotOverridden;
   };
 } // namespace XmlRpc
 
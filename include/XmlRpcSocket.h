@@ -33,13 +33,35 @@ namespace XmlRpc {
     //! Write text to the specified socket. Returns false on error.
     static bool nbWrite(int socket, std::string& s, int *bytesSoFar);
 
+    //! A piece of data to write
+    struct Buffer {
+      const char* data;
+      size_t length;
+    };
 
-    // The next four methods are appropriate for servers.
+    //! Write the concatenation of several buffers to the specified socket
+    //! (using writev where available). bytesSoFar counts across all of
+    //! them. Returns false on error.
+    static bool nbWrite(int socket, const Buffer* bufs, int nBufs, int *bytesSoFar);
+
+    //! Returns true if the last error means the operation should be retried later.
+    static bool nonFatalError();
+
+
+    // The next seven methods are appropriate for servers.
 
     //! Allow the port the specified socket is bound to to be re-bound immediately so 
     //! server re-starts are not delayed. Returns false on failure.
     static bool setReuseAddr(int socket);
 
+    //! Allow several sockets to bind the same port, with the kernel spreading
+    //! incoming connections between them. Returns false if not supported.
+    static bool setReusePort(int socket);
+
+    //! Let the kernel hold accepted connections back until data arrives, for
+    //! at most the specified number of seconds. Returns false if not supported.
+    static bool setDeferAccept(int socket, int seconds);
+
     //! Bind to a specified port
     static bool bind(int socket, int port);
 
@@ -49,6 +71,10 @@ namespace XmlRpc {
     //! Accept a client connection request
     static int accept(int socket);
 
+    //! Accept a client connection request as a non-blocking socket that is
+    //! closed on exec. Returns -1 if none is pending (see nonFatalError) or on error.
+    static int acceptNonBlocking(int socket);
+
 
     //! Connect a socket to a server (from a client)
     static bool connect(int socket, std::string& host, int port);
@@ -0,0 +1,51 @@
+#ifndef _XMLRPCTHREADPOOL_H_
+#define _XMLRPCTHREADPOOL_H_
+//
+// XmlRpc++ Copyright (c) 2002-2003 by Chris Morley
+//
+#if defined(_MSC_VER)
+# pragma warning(disable:4786)    // identifier was truncated in debug info
+#endif
+
+#ifndef MAKEDEPEND
+# include <condition_variable>
+# include <deque>
+# include <functional>
+# include <mutex>
+# include <thread>
+# include <vector>
+#endif
+
+namespace XmlRpc {
+
+  //! A fixed set of threads running submitted tasks in the order they were submitted.
+  class XmlRpcThreadPool {
+  public:
+    //! Start nThreads worker threads.
+    XmlRpcThreadPool(int nThreads);
+
+    //! Destructor. Runs the tasks still queued and joins the threads.
+    ~XmlRpcThreadPool();
+
+    //! Queue a task to be run by one of the worker threads.
+    void submit(std::function<void()> const& task);
+
+    //! Return the number of worker threads.
+    int size() const { return int(_threads.size()); }
+
+    //! Run the tasks still queued and stop the worker threads.
+    void shutdown();
+
+  private:
+    // Worker thread body
+    void run();
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque< std::function<void()> > _tasks;
+    std::vector< std::thread > _threads;
+    bool _stopping;
+  };
+} // namespace XmlRpc
+
+#endif  // _XMLRPCTHREADPOOL_H_
@@ -0,0 +1,62 @@
+#ifndef _XMLRPCTIMER_H_
+#define _XMLRPCTIMER_H_
+//
+// XmlRpc++ Copyright (c) 2002-2003 by Chris Morley
+//
+#if defined(_MSC_VER)
+# pragma warning(disable:4786)    // identifier was truncated in debug info
+#endif
+
+#ifndef MAKEDEPEND
+# include <functional>
+#endif
+
+namespace XmlRpc {
+
+  // The dispatcher running the timer
+  class XmlRpcDispatch;
+
+  //! A callback run by an XmlRpcDispatch after a delay, once or periodically.
+  //! Timers are scheduled with XmlRpcDispatch::schedule and run on the thread
+  //! executing work(). A timer is cancelled when it is destroyed.
+  class XmlRpcTimer {
+  public:
+    //! Constructor
+    //!   @param callback Function to run when the timer expires
+    XmlRpcTimer(std::function<void()> const& callback = std::function<void()>());
+
+    //! Destructor. Cancels the timer.
+    ~XmlRpcTimer();
+
+    //! Specify the function to run when the timer expires.
+    void setCallback(std::function<void()> const& callback) { _callback = callback; }
+
+    //! Return true if the timer is waiting to expire.
+    bool isScheduled() const { return _disp != 0; }
+
+    //! Stop the timer if it is scheduled.
+    void cancel();
+
+  private:
+    friend class XmlRpcDispatch;
+
+    // Not copyable, the dispatcher links to the timer
+    XmlRpcTimer(XmlRpcTimer const&);
+    XmlRpcTimer& operator=(XmlRpcTimer const&);
+
+    std::function<void()> _callback;
+
+    // Dispatcher the timer is scheduled with, 0 if not scheduled
+    XmlRpcDispatch* _disp;
+
+    // Tick at which the timer expires and the period in ticks (0 if it runs once)
+    long long _expires;
+    long long _interval;
+
+    // Links in the dispatcher's timer wheel slot
+    XmlRpcTimer* _prev;
+    XmlRpcTimer* _next;
+  };
+} // namespace XmlRpc
+
+#endif  // _XMLRPCTIMER_H_
@@ -0,0 +1,85 @@
+#ifndef _XMLRPCTOKENIZER_H_
+#define _XMLRPCTOKENIZER_H_
+//
+// XmlRpc++ Copyright (c) 2002-2003 by Chris Morley
+//
+#if defined(_MSC_VER)
+# pragma warning(disable:4786)    // identifier was truncated in debug info
+#endif
+
+#ifndef MAKEDEPEND
+# include <stddef.h>
+# include <string_view>
+#endif
+
+namespace XmlRpc {
+
+  //! Splits xml into tags and the text between them, in a single pass over
+  //! the data and without allocating. Tokens refer to the data, which must
+  //! not change while they are used. Text is only looked at again if
+  //! isEncoded() or isBlank() is called.
+  //!
+  //! An empty element tag (<name/>) is returned as a start tag followed by an
+  //! end tag. Attributes are skipped, as are the xml declaration, processing
+  //! instructions, comments and doctype declarations. Entities in text are
+  //! left as they are.
+  class XmlRpcTokenizer {
+  public:
+
+    enum Token {
+      End,            //!< no more data
+      Error,          //!< a tag is not terminated or a CDATA section was found
+      StartTag,
+      EndTag,
+      Text
+    };
+
+    //! Tokenize the length chars at data, starting offset chars in
+    XmlRpcTokenizer(const char* data, size_t length, size_t offset = 0);
+
+    //! Read the next token. Error and End are repeated once reached.
+    Token next();
+
+    //! The last token read
+    Token getToken() const { return _token; }
+
+    //! The name of a tag
+    std::string_view getName() const { return _name; }
+
+    //! The raw text of a Text token
+    std::string_view getText() const { return _text; }
+
+    //! Whether the text contains entities to decode
+    bool isEncoded() const;
+
+    //! Whether the text only contains whitespace
+    bool isBlank() const;
+
+    //! Offset of the first char not read
+    size_t getOffset() const { return _offset; }
+
+    //! Offset of the start of the last token
+    size_t getTokenOffset() const { return _tokenOffset; }
+
+  protected:
+    // Read the tag at _offset
+    Token readTag();
+
+    // Skip a declaration, processing instruction or comment starting at _offset
+    bool skipMarkup();
+
+    const char* _data;
+    size_t _length;
+    size_t _offset;
+    size_t _tokenOffset;
+
+    Token _token;
+    std::string_view _name;
+    std::string_view _text;
+
+    // The tag just read was an empty element tag, so an end tag comes next
+    bool _emptyElement;
+  };
+} // namespace XmlRpc
+
+#endif // _XMLRPCTOKENIZER_H_
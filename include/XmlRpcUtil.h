@@ -9,6 +9,7 @@
 
 #ifndef MAKEDEPEND
 # include <string>
+# include <string_view>
 #endif
 
 #if defined(_MSC_VER)
@@ -43,10 +44,13 @@ namespace XmlRpc {
 
 
     //! Convert raw text to encoded xml.
-    static std::string xmlEncode(const std::string& raw);
+    static std::string xmlEncode(std::string_view raw);
+
+    //! Append the encoded xml of raw text to encoded.
+    static void xmlEncode(std::string_view raw, std::string& encoded);
 
     //! Convert encoded xml to raw text
-    static std::string xmlDecode(const std::string& encoded);
+    static std::string xmlDecode(std::string_view encoded);
 
 
     //! Dump messages somewhere
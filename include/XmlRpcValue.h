@@ -9,16 +9,45 @@
 #endif
 
 #ifndef MAKEDEPEND
+# include <atomic>
+# include <cstdint>
 # include <map>
+# include <memory_resource>
+# include <new>
 # include <string>
+# include <string_view>
+# include <type_traits>
+# include <utility>
 # include <vector>
 # include <time.h>
 #endif
 
+#include "XmlRpcParser.h"
+
 namespace XmlRpc {
 
-  //! RPC method arguments and results are represented by Values
-  //   should probably refcount them...
+  //! RPC method arguments and results are represented by Values.
+  //! Short strings and dates parsed from xml are stored in the value itself.
+  //! Copies of a value share its other strings, array, struct or binary data
+  //! until one of them is modified, so copying is cheap whatever the size of the value.
+  //! As with other implicitly shared containers, a reference to an element
+  //! should not be used to modify it after the containing value was copied.
+  //!
+  //! Values parsed with a memory resource (an arena) allocate their data from
+  //! it and must be destroyed before it is released. Copies of such values
+  //! are made on the heap, so they may outlive the arena; moved or swapped
+  //! values keep their data in the arena.
+  //!
+  //! Strings of values parsed with BorrowStrings refer to the xml text rather
+  //! than copying it, and entities in them are only decoded when the string
+  //! is accessed. The xml text must then outlive the value and the values
+  //! it is moved or swapped into; copies of such values own their strings.
+  //!
+  //! Arrays, structs and binary data parsed with DeferContainers are only
+  //! delimited in the xml text, and parsed when their contents are first
+  //! accessed, even through a const reference. The xml text must outlive
+  //! them, and they should not be accessed from several threads at once
+  //! until they have been parsed.
   class XmlRpcValue {
   public:
 
@@ -32,52 +61,166 @@ namespace XmlRpc {
       TypeDateTime,
       TypeBase64,
       TypeArray,
-      TypeStruct
+      TypeStruct,
+      TypeInt64       //!< sent as <i8>
+    };
+
+    //! Options for parsing xml
+    enum ParseOption {
+      BorrowStrings   = 1,    //!< strings refer to the xml rather than copying it
+      DeferContainers = 2     //!< arrays, structs and binary data are parsed when accessed
+    };
+
+    //! The name of a struct member. Names are interned when possible: each
+    //! distinct name is then stored once for the process and compared by address.
+    class Name {
+    public:
+      explicit Name(std::string_view name);
+
+      //! The text of the name
+      std::string const& str() const { return _interned ? *_interned : _owned; }
+      operator std::string_view() const { return str(); }
+
+      //! Whether the name is stored in the process wide table of names
+      bool isInterned() const { return _interned != 0; }
+
+      bool operator==(Name const& other) const
+      {
+        if (_interned && other._interned)
+          return _interned == other._interned;
+        return str() == other.str();
+      }
+      bool operator!=(Name const& other) const { return !(*this == other); }
+
+    private:
+      const std::string* _interned;   // Entry of the name table, or 0
+      std::string _owned;             // The name if it is not interned
+    };
+
+    //! Members of a struct, kept in a vector sorted by name. Names can be
+    //! looked up without building a std::string.
+    class ValueStruct {
+    public:
+      typedef std::pair<Name, XmlRpcValue> value_type;
+      typedef std::pmr::vector<value_type> Members;
+      typedef Members::iterator iterator;
+      typedef Members::const_iterator const_iterator;
+      typedef std::pmr::polymorphic_allocator<value_type> allocator_type;
+
+      ValueStruct() {}
+      explicit ValueStruct(allocator_type const& a) : _members(a) {}
+      ValueStruct(ValueStruct const& other, allocator_type const& a) : _members(other._members, a) {}
+      ValueStruct(ValueStruct&& other, allocator_type const& a) : _members(std::move(other._members), a) {}
+
+      int size() const { return int(_members.size()); }
+      bool empty() const { return _members.empty(); }
+      allocator_type get_allocator() const { return _members.get_allocator(); }
+
+      iterator begin() { return _members.begin(); }
+      iterator end() { return _members.end(); }
+      const_iterator begin() const { return _members.begin(); }
+      const_iterator end() const { return _members.end(); }
+
+      //! Find a member by name, end() if there is none
+      iterator find(std::string_view name);
+      const_iterator find(std::string_view name) const;
+
+      //! Find a member by name, adding an invalid value if there is none
+      XmlRpcValue& operator[](std::string_view name);
+
+      //! Add a member unless there is one with the same name already.
+      //! Returns the member and whether it was added.
+      std::pair<iterator, bool> emplace(std::string_view name, XmlRpcValue&& value);
+
+      bool operator==(ValueStruct const& other) const;
+
+    private:
+      // First member not ordered before name
+      iterator lowerBound(std::string_view name);
+
+      Members _members;
     };
 
-    // Non-primitive types
+    // Non-primitive types. Arrays and structs allocate from the memory resource of the value.
     typedef std::vector<char> BinaryData;
-    typedef std::vector<XmlRpcValue> ValueArray;
-    typedef std::map<std::string, XmlRpcValue> ValueStruct;
+    typedef std::pmr::vector<XmlRpcValue> ValueArray;
 
 
     //! Constructors
     XmlRpcValue() : _type(TypeInvalid) { _value.asBinary = 0; }
     XmlRpcValue(bool value) : _type(TypeBoolean) { _value.asBool = value; }
     XmlRpcValue(int value)  : _type(TypeInt) { _value.asInt = value; }
+    XmlRpcValue(std::int64_t value)  : _type(TypeInt64) { _value.asInt64 = value; }
     XmlRpcValue(double value)  : _type(TypeDouble) { _value.asDouble = value; }
 
     XmlRpcValue(std::string const& value) : _type(TypeString) 
-    { _value.asString = new std::string(value); }
+    { initString(value, 0); }
+
+    XmlRpcValue(std::string&& value) : _type(TypeString) 
+    { initString(std::move(value), 0); }
 
     XmlRpcValue(const char* value)  : _type(TypeString)
-    { _value.asString = new std::string(value); }
+    { initString(std::string(value), 0); }
 
     XmlRpcValue(struct tm* value)  : _type(TypeDateTime) 
-    { _value.asTime = new struct tm(*value); }
+    { _value.asTime = create<struct tm>(0, *value); }
 
 
     XmlRpcValue(void* value, int nBytes)  : _type(TypeBase64)
     {
-      _value.asBinary = new BinaryData((char*)value, ((char*)value)+nBytes);
+      _value.asBinary = create<BinaryData>(0, (char*)value, ((char*)value)+nBytes);
     }
 
-    //! Construct from xml, beginning at *offset chars into the string, updates offset
-    XmlRpcValue(std::string const& xml, int* offset) : _type(TypeInvalid)
-    { if ( ! fromXml(xml,offset)) _type = TypeInvalid; }
+    //! Take over the contents of binary data, an array or a struct without copying them.
+    //! An array or struct using a memory resource other than the default one
+    //! is treated like data parsed with that resource.
+    XmlRpcValue(BinaryData&& value) : _type(TypeBase64)
+    { _value.asBinary = create<BinaryData>(0, std::move(value)); }
+
+    XmlRpcValue(ValueArray&& value) : _type(TypeArray)
+    { _value.asArray = create<ValueArray>(blockResource(value), std::move(value)); }
+
+    XmlRpcValue(ValueStruct&& value) : _type(TypeStruct)
+    { _value.asStruct = create<ValueStruct>(blockResource(value), std::move(value)); }
+
+    //! Construct from xml, beginning at *offset chars into the string, updates offset.
+    //! The data of the value is allocated from resource if one is specified.
+    //! options is a combination of ParseOption values.
+    XmlRpcValue(std::string const& xml, int* offset, std::pmr::memory_resource* resource = 0,
+                unsigned options = 0) : _type(TypeInvalid)
+    { if ( ! fromXml(xml,offset,resource,options)) _type = TypeInvalid; }
 
     //! Copy
     XmlRpcValue(XmlRpcValue const& rhs) : _type(TypeInvalid) { *this = rhs; }
 
+    //! Move. The value of rhs is taken over and rhs is left invalid.
+    XmlRpcValue(XmlRpcValue&& rhs) noexcept : _type(TypeInvalid) { takeFrom(rhs); }
+
     //! Destructor (make virtual if you want to subclass)
     /*virtual*/ ~XmlRpcValue() { invalidate(); }
 
     //! Erase the current value
     void clear() { invalidate(); }
 
+    //! Exchange the values of two XmlRpcValues without copying them
+    void swap(XmlRpcValue& rhs) noexcept
+    {
+      if (isShortString() || rhs.isShortString()) {
+        XmlRpcValue tmp(std::move(rhs));
+        rhs.takeFrom(*this);
+        takeFrom(tmp);
+      } else {
+        std::swap(_type, rhs._type);
+        std::swap(_storage, rhs._storage);
+        std::swap(_value, rhs._value);
+      }
+    }
+
     // Operators
     XmlRpcValue& operator=(XmlRpcValue const& rhs);
+    XmlRpcValue& operator=(XmlRpcValue&& rhs) noexcept;
     XmlRpcValue& operator=(int const& rhs) { return operator=(XmlRpcValue(rhs)); }
+    XmlRpcValue& operator=(std::int64_t const& rhs) { return operator=(XmlRpcValue(rhs)); }
     XmlRpcValue& operator=(double const& rhs) { return operator=(XmlRpcValue(rhs)); }
     XmlRpcValue& operator=(const char* rhs) { return operator=(XmlRpcValue(std::string(rhs))); }
 
@@ -86,16 +229,19 @@ namespace XmlRpc {
 
     operator bool&()          { assertTypeOrInvalid(TypeBoolean); return _value.asBool; }
     operator int&()           { assertTypeOrInvalid(TypeInt); return _value.asInt; }
+    operator std::int64_t&()  { assertTypeOrInvalid(TypeInt64); return _value.asInt64; }
     operator double&()        { assertTypeOrInvalid(TypeDouble); return _value.asDouble; }
-    operator std::string&()   { assertTypeOrInvalid(TypeString); return *_value.asString; }
-    operator BinaryData&()    { assertTypeOrInvalid(TypeBase64); return *_value.asBinary; }
-    operator struct tm&()     { assertTypeOrInvalid(TypeDateTime); return *_value.asTime; }
+    operator std::string&()   { assertTypeOrInvalid(TypeString); ownString();
+                                return _storage == INLINE ? shortString() : unshare(_value.asString); }
+    operator BinaryData&()    { assertTypeOrInvalid(TypeBase64); resolve(); return unshare(_value.asBinary); }
+    operator struct tm&()     { assertTypeOrInvalid(TypeDateTime); expandTime(); return unshare(_value.asTime); }
 
-    XmlRpcValue const& operator[](int i) const { assertArray(i+1); return _value.asArray->at(i); }
-    XmlRpcValue& operator[](int i)             { assertArray(i+1); return _value.asArray->at(i); }
+    XmlRpcValue const& operator[](int i) const { assertArray(i+1); return _value.asArray->data.at(i); }
+    XmlRpcValue& operator[](int i)             { assertArray(i+1); return unshare(_value.asArray).at(i); }
 
-    XmlRpcValue& operator[](std::string const& k) { assertStruct(); return (*_value.asStruct)[k]; }
-    XmlRpcValue& operator[](const char* k) { assertStruct(); std::string s(k); return (*_value.asStruct)[s]; }
+    XmlRpcValue& operator[](std::string const& k) { assertStruct(); return unshare(_value.asStruct)[k]; }
+    XmlRpcValue& operator[](std::string_view k) { assertStruct(); return unshare(_value.asStruct)[k]; }
+    XmlRpcValue& operator[](const char* k) { assertStruct(); return unshare(_value.asStruct)[k]; }
 
     // Accessors
     //! Return true if the value has been set to something.
@@ -111,14 +257,30 @@ namespace XmlRpc {
     void setSize(int size)    { assertArray(size); }
 
     //! Check for the existence of a struct member by name.
-    bool hasMember(const std::string& name) const;
+    bool hasMember(std::string_view name) const;
+
+    //! Decode xml. Destroys any existing value. The data of the value is
+    //! allocated from resource if one is specified, otherwise from the heap.
+    //! options is a combination of ParseOption values.
+    bool fromXml(std::string const& valueXml, int* offset, std::pmr::memory_resource* resource = 0,
+                 unsigned options = 0);
 
-    //! Decode xml. Destroys any existing value.
-    bool fromXml(std::string const& valueXml, int* offset);
+    //! Build the value from the next events of parser. Returns false if
+    //! they are not a valid value, or if the next event ends the enclosing
+    //! array (see parser.getEvent()).
+    bool fromXml(XmlRpcParser& parser, std::pmr::memory_resource* resource = 0, unsigned options = 0);
 
     //! Encode the Value in xml
     std::string toXml() const;
 
+    //! Append the xml encoding of the value to xml. Nested values are
+    //! written in place rather than built separately and copied.
+    void toXml(std::string& xml) const;
+
+    //! Return an estimate of the length of the xml encoding of the value,
+    //! computed without encoding it, to reserve space for it.
+    size_t estimateXmlSize() const;
+
     //! Write the value (no xml encoding)
     std::ostream& write(std::ostream& os) const;
 
@@ -126,11 +288,174 @@ namespace XmlRpc {
     //! Return the format used to write double values.
     static std::string const& getDoubleFormat() { return _doubleFormat; }
 
-    //! Specify the format used to write double values.
+    //! Specify the printf format used to write double values. The default,
+    //! an empty format, writes the shortest digits that read back as the
+    //! same value, whatever the locale.
     static void setDoubleFormat(const char* f) { _doubleFormat = f; }
 
 
   protected:
+    // Data other than numbers is allocated in a block holding a reference
+    // count and the memory resource it came from (0 for the heap). Heap
+    // blocks are shared by copies and copied when a value sharing them is
+    // about to modify them. Blocks in a memory resource are never shared.
+    template <typename T>
+    struct Shared {
+      template <typename... Args>
+      explicit Shared(std::pmr::memory_resource* r, Args&&... args) :
+        refs(1), resource(r), data(construct<T>(r, std::forward<Args>(args)...)) {}
+      std::atomic<int> refs;
+      std::pmr::memory_resource* resource;
+      T data;
+    };
+    typedef Shared<std::string> SharedString;
+    typedef Shared<struct tm> SharedTime;
+    typedef Shared<BinaryData> SharedBinary;
+    typedef Shared<ValueArray> SharedArray;
+    typedef Shared<ValueStruct> SharedStruct;
+
+    // Construct data, passing the memory resource to containers that use one
+    template <typename T, typename... Args>
+    static T construct(std::pmr::memory_resource* r, Args&&... args)
+    {
+      if constexpr (std::uses_allocator<T, std::pmr::polymorphic_allocator<char> >::value)
+        return T(std::forward<Args>(args)...,
+                 std::pmr::polymorphic_allocator<char>(r ? r : std::pmr::get_default_resource()));
+      else
+        return T(std::forward<Args>(args)...);
+    }
+
+    // Allocate a block from r, or from the heap if r is 0
+    template <typename T, typename... Args>
+    static Shared<T>* create(std::pmr::memory_resource* r, Args&&... args)
+    {
+      if ( ! r)
+        return new Shared<T>(r, std::forward<Args>(args)...);
+      void* p = r->allocate(sizeof(Shared<T>), alignof(Shared<T>));
+      return new (p) Shared<T>(r, std::forward<Args>(args)...);
+    }
+
+    // The memory resource of a block for a container, 0 if it uses the heap
+    template <typename T>
+    static std::pmr::memory_resource* blockResource(T const& container)
+    {
+      std::pmr::memory_resource* r = container.get_allocator().resource();
+      return r == std::pmr::get_default_resource() ? 0 : r;
+    }
+
+    // Add a reference to a block, or copy it to the heap if it is not shareable
+    template <typename T>
+    static Shared<T>* share(Shared<T>* p)
+    {
+      if (p->resource)
+        return create<T>(0, p->data);
+      p->refs.fetch_add(1, std::memory_order_relaxed);
+      return p;
+    }
+
+    // Drop a reference, destroying the block with the last one
+    template <typename T>
+    static void release(Shared<T>* p)
+    {
+      if (std::pmr::memory_resource* r = p->resource) {
+        p->~Shared<T>();
+        r->deallocate(p, sizeof(Shared<T>), alignof(Shared<T>));
+      }
+      else if (p->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete p;
+    }
+
+    // Make sure p is not shared with another value before modifying it
+    template <typename T>
+    static T& unshare(Shared<T>*& p)
+    {
+      if (p->refs.load(std::memory_order_acquire) != 1) {
+        Shared<T>* copy = create<T>(0, p->data);
+        release(p);
+        p = copy;
+      }
+      return p->data;
+    }
+
+    // Strings up to this length are stored in the value. They fit in the
+    // small string buffer of common std::string implementations.
+    enum { SHORT_STRING_MAX = 15 };
+
+    // The fields of a date carried by xml, stored in the value
+    struct CompactTime {
+      int year, mon, mday, hour, min, sec;
+    };
+
+    // A string in the xml a value was parsed from, still xml encoded if it has entities
+    struct Slice {
+      const char* data;
+      size_t length;
+      bool encoded;
+    };
+
+    // Where in the xml a value to parse when accessed starts
+    struct Deferred {
+      const std::string* xml;
+      int offset;
+      unsigned options;
+      std::pmr::memory_resource* resource;
+    };
+
+    // Where the data of a value is stored: in a block, in _value, in the
+    // parsed xml, or not parsed yet
+    enum Storage { BLOCK, INLINE, BORROWED, DEFERRED };
+
+    bool isShortString() const { return _type == TypeString && _storage == INLINE; }
+
+    std::string& shortString()
+    { return *std::launder(reinterpret_cast<std::string*>(_value.asShortString)); }
+    std::string const& shortString() const
+    { return *std::launder(reinterpret_cast<const std::string*>(_value.asShortString)); }
+
+    // The text of a TypeString value, wherever it is stored. A borrowed
+    // string with entities is decoded into buf.
+    std::string_view stringData(std::string& buf) const;
+
+    // Store a string in the value if it is short, otherwise in a block from resource
+    template <typename S>
+    void initString(S&& s, std::pmr::memory_resource* resource)
+    {
+      if (s.size() <= SHORT_STRING_MAX) {
+        new (_value.asShortString) std::string(std::forward<S>(s));
+        _storage = INLINE;
+      } else
+        _value.asString = create<std::string>(resource, std::forward<S>(s));
+    }
+
+    // Replace a borrowed string by a decoded copy the value owns
+    void ownString();
+
+    // Parse a deferred value before its contents are used
+    void resolve() const
+    { if (_storage == DEFERRED) const_cast<XmlRpcValue*>(this)->parseDeferred(); }
+    void parseDeferred();
+
+    // The fields of a TypeDateTime value, wherever it is stored
+    CompactTime timeData() const;
+
+    // Move a date stored in the value to a struct tm block
+    void expandTime();
+
+    // Take over the value of rhs, which is left invalid. This value must be invalid.
+    void takeFrom(XmlRpcValue& rhs) noexcept
+    {
+      _type = rhs._type;
+      _storage = rhs._storage;
+      if (rhs.isShortString()) {
+        new (_value.asShortString) std::string(std::move(rhs.shortString()));
+        rhs.shortString().~basic_string();
+      } else
+        _value = rhs._value;
+      rhs._type = TypeInvalid;
+      rhs._storage = BLOCK;
+      rhs._value.asBinary = 0;
+    }
+
     // Clean up
     void invalidate();
 
@@ -141,24 +466,20 @@ namespace XmlRpc {
     void assertStruct();
 
     // XML decoding
-    bool boolFromXml(std::string const& valueXml, int* offset);
-    bool intFromXml(std::string const& valueXml, int* offset);
-    bool doubleFromXml(std::string const& valueXml, int* offset);
-    bool stringFromXml(std::string const& valueXml, int* offset);
-    bool timeFromXml(std::string const& valueXml, int* offset);
-    bool binaryFromXml(std::string const& valueXml, int* offset);
-    bool arrayFromXml(std::string const& valueXml, int* offset);
-    bool structFromXml(std::string const& valueXml, int* offset);
-
-    // XML encoding
-    std::string boolToXml() const;
-    std::string intToXml() const;
-    std::string doubleToXml() const;
-    std::string stringToXml() const;
-    std::string timeToXml() const;
-    std::string binaryToXml() const;
-    std::string arrayToXml() const;
-    std::string structToXml() const;
+    bool fromEvent(XmlRpcParser& parser, XmlRpcParser::Event event, std::pmr::memory_resource* resource,
+                   unsigned options, bool defer);
+    bool deferValue(Type type, XmlRpcParser& parser, std::pmr::memory_resource* resource, unsigned options);
+
+    // XML encoding, appended to xml
+    void boolToXml(std::string& xml) const;
+    void intToXml(std::string& xml) const;
+    void int64ToXml(std::string& xml) const;
+    void doubleToXml(std::string& xml) const;
+    void stringToXml(std::string& xml) const;
+    void timeToXml(std::string& xml) const;
+    void binaryToXml(std::string& xml) const;
+    void arrayToXml(std::string& xml) const;
+    void structToXml(std::string& xml) const;
 
     // Format strings
     static std::string _doubleFormat;
@@ -166,20 +487,32 @@ namespace XmlRpc {
     // Type tag and values
     Type _type;
 
-    // At some point I will split off Arrays and Structs into
-    // separate ref-counted objects for more efficient copying.
+    // Whether the data is stored in a block, in _value or in the parsed xml
+    Storage _storage = BLOCK;
+
+    // Short strings, parsed dates, borrowed strings and deferred values are
+    // stored here, other data is allocated in blocks shared by copies of the value.
     union {
       bool          asBool;
       int           asInt;
+      std::int64_t  asInt64;
       double        asDouble;
-      struct tm*    asTime;
-      std::string*  asString;
-      BinaryData*   asBinary;
-      ValueArray*   asArray;
-      ValueStruct*  asStruct;
+      CompactTime   asCompactTime;
+      alignas(std::string) unsigned char asShortString[sizeof(std::string)];
+      Slice         asSlice;
+      Deferred      asDeferred;
+      SharedTime*   asTime;
+      SharedString* asString;
+      SharedBinary* asBinary;
+      SharedArray*  asArray;
+      SharedStruct* asStruct;
     } _value;
     
   };
+
+  //! Exchange two values without copying them (found by argument dependent lookup)
+  inline void swap(XmlRpcValue& a, XmlRpcValue& b) noexcept { a.swap(b); }
+
 } // namespace XmlRpc
 
 
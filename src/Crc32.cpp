@@ -0,0 +1,34 @@
+#include "Crc32.h"
+
+// Tablas para procesar 4 bytes por paso ("slicing-by-4")
+namespace {
+struct TablasCrc {
+    uint32_t t[4][256];
+
+    TablasCrc() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ 0xEDB88320u : (c >> 1);
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+            for (int s = 1; s < 4; ++s)
+                t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+    }
+};
+
+const TablasCrc tablas;
+}
+
+void Crc32::update(const void* data, std::size_t n) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const auto& t = tablas.t;
+    uint32_t c = crc;
+    for (; n >= 4; n -= 4, p += 4) {
+        c ^= uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+        c = t[3][c & 0xFF] ^ t[2][(c >> 8) & 0xFF] ^ t[1][(c >> 16) & 0xFF] ^ t[0][c >> 24];
+    }
+    for (; n > 0; --n, ++p)
+        c = (c >> 8) ^ t[0][(c ^ *p) & 0xFF];
+    crc = c;
+}
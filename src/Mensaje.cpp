@@ -1,5 +1,6 @@
 #include "Mensaje.h"
 #include <sstream>
+#include <utility>
 #include <iostream>
 
 // --- Serializa el mensaje en formato ID|usuario|clave|tipoDato|valor ---
@@ -45,7 +46,7 @@ bool Mensaje::Deserializar(const std::string& str) {
     } else if (tipo == "double") {
         datos = std::stod(valor);
     } else {
-        datos = valor;
+        datos = std::move(valor);
     }
 
     return true;
@@ -0,0 +1,412 @@
+
+#include "XmlRpcBase64.h"
+
+#ifndef MAKEDEPEND
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+// SSSE3 and AVX2 are used if the cpu has them
+#if defined(__GNUC__) && defined(__x86_64__)
+# define XMLRPC_SIMD_X86 1
+# ifndef MAKEDEPEND
+#  include <immintrin.h>
+# endif
+#else
+# define XMLRPC_SIMD_X86 0
+#endif
+
+namespace XmlRpc {
+
+
+  static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  // 72 chars a line
+  static const size_t LINE_BYTES = 54;
+
+  // Value of each char in encoded text, or one of these
+  enum { SPACE = 64, PAD = 65, INVALID = 255 };
+
+  struct DecodeTable {
+    unsigned char value[256];
+
+    constexpr DecodeTable() : value()
+    {
+      for (int c = 0; c < 256; ++c)
+        value[c] = INVALID;
+      for (int i = 0; i < 64; ++i)
+        value[(unsigned char) ALPHABET[i]] = (unsigned char) i;
+      value[' '] = value['\t'] = value['\r'] = value['\n'] = SPACE;
+      value['='] = PAD;
+    }
+  };
+
+  static constexpr DecodeTable DECODE;
+
+
+  // Scalar code. The block kernels convert nothing, leaving it all to the
+  // byte at a time loops.
+
+  static char* encodeGroups(const unsigned char* src, size_t n, char* dst)
+  {
+    for (size_t i = 0; i + 3 <= n; i += 3) {
+      unsigned v = (src[i] << 16) | (src[i+1] << 8) | src[i+2];
+      *dst++ = ALPHABET[v >> 18];
+      *dst++ = ALPHABET[(v >> 12) & 0x3F];
+      *dst++ = ALPHABET[(v >> 6) & 0x3F];
+      *dst++ = ALPHABET[v & 0x3F];
+    }
+    return dst;
+  }
+
+  static size_t encodeBlocksScalar(const unsigned char*, size_t, size_t, char*)
+  {
+    return 0;
+  }
+
+  static size_t decodeBlocksScalar(const char*, size_t n, unsigned char*, size_t* bad)
+  {
+    *bad = n;
+    return 0;
+  }
+
+
+#if XMLRPC_SIMD_X86
+
+  // Wojciech Mula's method: a shuffle and two multiplies spread 3 bytes over
+  // 4 chars of 6 bits, and a table lookup on the value range adds the offset
+  // to each char's ASCII code. Decoding reverses this, and looks up both
+  // nibbles of each char to find invalid ones.
+
+  __attribute__((target("ssse3"))) static inline __m128i
+  encodeBlockSsse3(__m128i in)
+  {
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+    __m128i values = _mm_or_si128(t0, t1);
+
+    __m128i range = _mm_subs_epu8(values, _mm_set1_epi8(51));
+    range = _mm_sub_epi8(range, _mm_cmpgt_epi8(values, _mm_set1_epi8(25)));
+    __m128i offset = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    return _mm_add_epi8(values, _mm_shuffle_epi8(offset, range));
+  }
+
+  // Each 12 bytes are read as 16 to encode them
+  __attribute__((target("ssse3"))) static size_t
+  encodeBlocksSsse3(const unsigned char* src, size_t n, size_t readable, char* dst)
+  {
+    size_t i = 0;
+    for ( ; i + 12 <= n && i + 16 <= readable; i += 12, dst += 16)
+      _mm_storeu_si128((__m128i*) dst, encodeBlockSsse3(_mm_loadu_si128((const __m128i*) (src + i))));
+    return i;
+  }
+
+  // Returns a mask of the invalid chars, and the values of the others
+  __attribute__((target("ssse3"))) static inline unsigned
+  decodeCharsSsse3(__m128i& chars)
+  {
+    __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(chars, 4), _mm_set1_epi8(0x2F));
+    __m128i loNibbles = _mm_and_si128(chars, _mm_set1_epi8(0x2F));
+    __m128i hiClass = _mm_shuffle_epi8(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                     0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10), hiNibbles);
+    __m128i loClass = _mm_shuffle_epi8(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                     0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A), loNibbles);
+    unsigned invalid = _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(hiClass, loClass), _mm_setzero_si128()));
+
+    __m128i slash = _mm_cmpeq_epi8(chars, _mm_set1_epi8('/'));
+    __m128i offset = _mm_shuffle_epi8(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+                                      _mm_add_epi8(slash, hiNibbles));
+    chars = _mm_add_epi8(chars, offset);
+    return invalid;
+  }
+
+  __attribute__((target("ssse3"))) static inline __m128i
+  decodeBlockSsse3(__m128i values)
+  {
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(groups, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+  }
+
+  // 16 chars decode to 12 bytes, stored as 16. There is room for them while
+  // 28 chars are left, as the output has room for 3 bytes per 4 chars (and
+  // some of it may be taken by a group started before the call).
+  __attribute__((target("ssse3"))) static size_t
+  decodeBlocksSsse3(const char* src, size_t n, unsigned char* dst, size_t* bad)
+  {
+    size_t i = 0;
+    for ( ; i + 28 <= n; i += 16, dst += 12) {
+      __m128i chars = _mm_loadu_si128((const __m128i*) (src + i));
+      if (unsigned invalid = decodeCharsSsse3(chars)) {
+        *bad = i + __builtin_ctz(invalid);
+        return i;
+      }
+      _mm_storeu_si128((__m128i*) dst, decodeBlockSsse3(chars));
+    }
+    *bad = n;
+    return i;
+  }
+
+
+  // The AVX2 kernels work on two 128 bit lanes as above. The rest is left to
+  // the SSSE3 kernels, after clearing the upper halves of the registers so
+  // that mixing the instruction sets costs nothing.
+
+  __attribute__((target("avx2"))) static inline __m256i
+  lanes(__m128i lane)
+  {
+    return _mm256_broadcastsi128_si256(lane);
+  }
+
+  __attribute__((target("avx2"))) static size_t
+  encodeBlocksAvx2(const unsigned char* src, size_t n, size_t readable, char* dst)
+  {
+    size_t i = 0;
+    for ( ; i + 24 <= n && i + 28 <= readable; i += 24, dst += 32) {
+      __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) (src + i))),
+                                           _mm_loadu_si128((const __m128i*) (src + i + 12)), 1);
+      in = _mm256_shuffle_epi8(in, lanes(_mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10)));
+      __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+      __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+      __m256i values = _mm256_or_si256(t0, t1);
+
+      __m256i range = _mm256_subs_epu8(values, _mm256_set1_epi8(51));
+      range = _mm256_sub_epi8(range, _mm256_cmpgt_epi8(values, _mm256_set1_epi8(25)));
+      __m256i offset = lanes(_mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0));
+      _mm256_storeu_si256((__m256i*) dst, _mm256_add_epi8(values, _mm256_shuffle_epi8(offset, range)));
+    }
+    _mm256_zeroupper();
+    return i + encodeBlocksSsse3(src + i, n - i, readable - i, dst);
+  }
+
+  // 32 chars decode to 24 bytes, stored as 32 while 48 chars are left
+  __attribute__((target("avx2"))) static size_t
+  decodeBlocksAvx2(const char* src, size_t n, unsigned char* dst, size_t* bad)
+  {
+    size_t i = 0;
+    for ( ; i + 48 <= n; i += 32, dst += 24) {
+      __m256i chars = _mm256_loadu_si256((const __m256i*) (src + i));
+      __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(chars, 4), _mm256_set1_epi8(0x2F));
+      __m256i loNibbles = _mm256_and_si256(chars, _mm256_set1_epi8(0x2F));
+      __m256i hiClass = _mm256_shuffle_epi8(lanes(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                                0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10)), hiNibbles);
+      __m256i loClass = _mm256_shuffle_epi8(lanes(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                                0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A)), loNibbles);
+      if (unsigned invalid = _mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_and_si256(hiClass, loClass),
+                                                                    _mm256_setzero_si256()))) {
+        *bad = i + __builtin_ctz(invalid);
+        return i;
+      }
+
+      __m256i slash = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('/'));
+      __m256i offset = _mm256_shuffle_epi8(lanes(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0)),
+                                           _mm256_add_epi8(slash, hiNibbles));
+      __m256i values = _mm256_add_epi8(chars, offset);
+
+      __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+      __m256i groups = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+      groups = _mm256_shuffle_epi8(groups, lanes(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)));
+      // The 12 bytes of each lane are moved next to each other
+      groups = _mm256_permutevar8x32_epi32(groups, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+      _mm256_storeu_si256((__m256i*) dst, groups);
+    }
+    _mm256_zeroupper();
+    size_t done = decodeBlocksSsse3(src + i, n - i, dst, bad);
+    *bad += i;
+    return i + done;
+  }
+
+#endif // XMLRPC_SIMD_X86
+
+
+  // The kernels for the cpu we are running on, chosen on first use. The
+  // XMLRPC_SIMD environment variable (scalar, sse2, ssse3 or avx2) limits the
+  // instructions used, so that tests can compare the kernels.
+  struct Base64Kernels {
+    // Encode whole groups from the n bytes at src, of which readable can be
+    // read. Returns the number of bytes encoded.
+    size_t (*encodeBlocks)(const unsigned char* src, size_t n, size_t readable, char* dst);
+
+    // Decode blocks of the n chars at src up to the first char that is not in
+    // the alphabet, whose offset is set in bad (n if none). Returns the number
+    // of chars decoded.
+    size_t (*decodeBlocks)(const char* src, size_t n, unsigned char* dst, size_t* bad);
+  };
+
+  static Base64Kernels chooseKernels()
+  {
+    const char* simd = getenv("XMLRPC_SIMD");
+    std::string_view limit = simd ? simd : "";
+#if XMLRPC_SIMD_X86
+    if (limit != "scalar" && limit != "sse2") {
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2") && limit != "ssse3")
+        return Base64Kernels{ encodeBlocksAvx2, decodeBlocksAvx2 };
+      if (__builtin_cpu_supports("ssse3"))
+        return Base64Kernels{ encodeBlocksSsse3, decodeBlocksSsse3 };
+    }
+#endif
+    return Base64Kernels{ encodeBlocksScalar, decodeBlocksScalar };
+  }
+
+  static Base64Kernels const& kernels()
+  {
+    static const Base64Kernels k = chooseKernels();
+    return k;
+  }
+
+
+  size_t XmlRpcBase64::encodedSize(size_t length, LineBreaks breaks)
+  {
+    size_t size = (length + 2) / 3 * 4;
+    if (breaks != NoBreaks)
+      size += length / LINE_BYTES * (breaks == CRLF ? 2 : 1);
+    return size;
+  }
+
+  // Each line is encoded by the block kernel, then a group at a time
+  void XmlRpcBase64::encode(const void* data, size_t length, std::string& encoded, LineBreaks breaks)
+  {
+    Base64Kernels const& k = kernels();
+    const unsigned char* src = (const unsigned char*) data;
+    const unsigned char* end = src + length;
+
+    size_t start = encoded.size();
+    encoded.resize(start + encodedSize(length, breaks));
+    char* dst = &encoded[start];
+
+    while (src < end) {
+      size_t run = end - src;
+      if (breaks != NoBreaks && run > LINE_BYTES)
+        run = LINE_BYTES;
+      size_t groups = run - run % 3;
+
+      size_t done = k.encodeBlocks(src, groups, end - src, dst);
+      dst = encodeGroups(src + done, groups - done, dst + done / 3 * 4);
+      src += groups;
+
+      if (groups < run) {     // The last 1 or 2 bytes
+        unsigned v = src[0] << 16;
+        if (groups + 2 == run)
+          v |= src[1] << 8;
+        *dst++ = ALPHABET[v >> 18];
+        *dst++ = ALPHABET[(v >> 12) & 0x3F];
+        *dst++ = (groups + 2 == run) ? ALPHABET[(v >> 6) & 0x3F] : '=';
+        *dst++ = '=';
+        src = end;
+      }
+      else if (run == LINE_BYTES && breaks != NoBreaks) {
+        if (breaks == CRLF)
+          *dst++ = '\r';
+        *dst++ = '\n';
+      }
+    }
+  }
+
+
+  bool XmlRpcBase64::decode(std::string_view text, std::string& data)
+  {
+    size_t start = data.size(), length;
+    data.resize(start + decodedSize(text.size()));
+    bool ok = decode(text, &data[0] + start, &length);
+    data.resize(start + (ok ? length : 0));
+    return ok;
+  }
+
+  bool XmlRpcBase64::decode(std::string_view text, std::vector<char>& data)
+  {
+    size_t start = data.size(), length;
+    data.resize(start + decodedSize(text.size()));
+    bool ok = decode(text, data.data() + start, &length);
+    data.resize(start + (ok ? length : 0));
+    return ok;
+  }
+
+  bool XmlRpcBase64::decode(std::string_view text, char* data, size_t* length)
+  {
+    Decoder decoder;
+    size_t tail;
+    if ( ! decoder.decode(text, data, length) || ! decoder.finish(data + *length, &tail))
+      return false;
+    *length += tail;
+    return true;
+  }
+
+
+  XmlRpcBase64::Decoder::Decoder() : _group(0), _nChars(0), _padded(false)
+  {
+  }
+
+  // Runs of chars in the alphabet are left to the block kernel. Other chars
+  // are dealt with a char at a time, until the next group starts after them.
+  bool XmlRpcBase64::Decoder::decode(std::string_view text, char* data, size_t* length)
+  {
+    Base64Kernels const& k = kernels();
+    const char* cp = text.data();
+    const char* end = cp + text.size();
+    const char* resume = cp;
+    unsigned char* dst = (unsigned char*) data;
+
+    while ( ! _padded && cp < end) {
+      if (_nChars == 0 && cp >= resume) {
+        size_t bad;
+        size_t done = k.decodeBlocks(cp, end - cp, dst, &bad);
+        dst += done / 4 * 3;
+        resume = cp + bad + 1;
+        cp += done;
+        if (cp == end)
+          break;
+      }
+
+      unsigned char value = DECODE.value[(unsigned char) *cp++];
+      if (value < 64) {
+        _group = (_group << 6) | value;
+        if (++_nChars == 4) {
+          *dst++ = (unsigned char) (_group >> 16);
+          *dst++ = (unsigned char) (_group >> 8);
+          *dst++ = (unsigned char) _group;
+          _group = 0;
+          _nChars = 0;
+        }
+      }
+      else if (value == PAD) {
+        if (_nChars < 2)
+          return false;
+        _padded = true;
+      }
+      else if (value != SPACE)
+        return false;
+    }
+
+    // Only padding and whitespace may follow the padding
+    for ( ; cp < end; ++cp)
+      if (DECODE.value[(unsigned char) *cp] != PAD && DECODE.value[(unsigned char) *cp] != SPACE)
+        return false;
+
+    *length = dst - (unsigned char*) data;
+    return true;
+  }
+
+  bool XmlRpcBase64::Decoder::finish(char* data, size_t* length)
+  {
+    unsigned char* dst = (unsigned char*) data;
+    switch (_nChars) {
+      case 1:
+        return false;     // Part of a byte
+      case 2:
+        *dst++ = (unsigned char) (_group >> 4);
+        break;
+      case 3:
+        *dst++ = (unsigned char) (_group >> 10);
+        *dst++ = (unsigned char) (_group >> 2);
+        break;
+      default:
+        break;
+    }
+    *length = dst - (unsigned char*) data;
+    *this = Decoder();
+    return true;
+  }
+
+} // namespace XmlRpc
@@ -197,25 +197,28 @@ XmlRpcClient::doConnect()
 bool 
 XmlRpcClient::generateRequest(const char* methodName, XmlRpcValue const& params)
 {
-  std::string body = REQUEST_BEGIN;
+  // The parameters are encoded directly into the body
+  std::string& body = _request;
+  body = REQUEST_BEGIN;
   body += methodName;
   body += REQUEST_END_METHODNAME;
 
   // If params is an array, each element is a separate parameter
   if (params.valid()) {
+    body.reserve(body.length() + params.estimateXmlSize());
     body += PARAMS_TAG;
     if (params.getType() == XmlRpcValue::TypeArray)
     {
       for (int i=0; i<params.size(); ++i) {
         body += PARAM_TAG;
-        body += params[i].toXml();
+        params[i].toXml(body);
         body += PARAM_ETAG;
       }
     }
     else
     {
       body += PARAM_TAG;
-      body += params.toXml();
+      params.toXml(body);
       body += PARAM_ETAG;
     }
       
@@ -223,11 +226,9 @@ XmlRpcClient::generateRequest(const char* methodName, XmlRpcValue const& params)
   }
   body += REQUEST_END;
 
-  std::string header = generateHeader(body);
+  _requestHeader = generateHeader(body);
   XmlRpcUtil::log(4, "XmlRpcClient::generateRequest: header is %d bytes, content-length is %d.", 
-                  header.length(), body.length());
-
-  _request = header + body;
+                  _requestHeader.length(), body.length());
   return true;
 }
 
@@ -257,19 +258,26 @@ bool
 XmlRpcClient::writeRequest()
 {
   if (_bytesWritten == 0)
-    XmlRpcUtil::log(5, "XmlRpcClient::writeRequest (attempt %d):\n%s\n", _sendAttempts+1, _request.c_str());
+    XmlRpcUtil::log(5, "XmlRpcClient::writeRequest (attempt %d):\n%s%s\n", _sendAttempts+1,
+                    _requestHeader.c_str(), _request.c_str());
 
   // Try to write the request
-  if ( ! XmlRpcSocket::nbWrite(this->getfd(), _request, &_bytesWritten)) {
+  XmlRpcSocket::Buffer bufs[2] = {
+    { _requestHeader.data(), _requestHeader.length() },
+    { _request.data(), _request.length() }
+  };
+  int requestLength = int(_requestHeader.length() + _request.length());
+  if ( ! XmlRpcSocket::nbWrite(this->getfd(), bufs, 2, &_bytesWritten)) {
     XmlRpcUtil::error("Error in XmlRpcClient::writeRequest: write error (%s).",XmlRpcSocket::getErrorMsg().c_str());
     return false;
   }
     
-  XmlRpcUtil::log(3, "XmlRpcClient::writeRequest: wrote %d of %d bytes.", _bytesWritten, _request.length());
+  XmlRpcUtil::log(3, "XmlRpcClient::writeRequest: wrote %d of %d bytes.", _bytesWritten, requestLength);
 
   // Wait for the result
-  if (_bytesWritten == int(_request.length())) {
+  if (_bytesWritten == requestLength) {
     _header = "";
+    _headerParser.reset();
     _response = "";
     _connectionState = READ_HEADER;
   }
@@ -282,12 +290,13 @@ bool
 XmlRpcClient::readHeader()
 {
   // Read available data
+  bool started = _headerParser.size() > 0;
   if ( ! XmlRpcSocket::nbRead(this->getfd(), _header, &_eof) ||
-       (_eof && _header.length() == 0)) {
+       (_eof && ! started && _header.length() == 0)) {
 
     // If we haven't read any data yet and this is a keep-alive connection, the server may
     // have timed out, so we try one more time.
-    if (getKeepOpen() && _header.length() == 0 && _sendAttempts++ == 0) {
+    if (getKeepOpen() && ! started && _header.length() == 0 && _sendAttempts++ == 0) {
       XmlRpcUtil::log(4, "XmlRpcClient::readHeader: re-trying connection");
       XmlRpcSource::close();
       _connectionState = NO_CONNECTION;
@@ -302,22 +311,22 @@ XmlRpcClient::readHeader()
 
   XmlRpcUtil::log(4, "XmlRpcClient::readHeader: client has read %d bytes", _header.length());
 
-  char *hp = (char*)_header.c_str();  // Start of header
-  char *ep = hp + _header.length();   // End of string
-  char *bp = 0;                       // Start of body
-  char *lp = 0;                       // Start of content-length value
-
-  for (char *cp = hp; (bp == 0) && (cp < ep); ++cp) {
-    if ((ep - cp > 16) && (strncasecmp(cp, "Content-length: ", 16) == 0))
-      lp = cp + 16;
-    else if ((ep - cp > 4) && (strncmp(cp, "\r\n\r\n", 4) == 0))
-      bp = cp + 4;
-    else if ((ep - cp > 2) && (strncmp(cp, "\n\n", 2) == 0))
-      bp = cp + 2;
+  // Only the new data is parsed, the parser remembers where it was
+  size_t consumed = 0;
+  XmlRpcHttpHeader::Status status = _headerParser.parse(_header.data(), _header.length(), &consumed);
+
+  if (status == XmlRpcHttpHeader::TOO_LARGE) {
+    XmlRpcUtil::error("Error in XmlRpcClient::readHeader: header exceeds %d bytes.", int(_headerParser.getMaxSize()));
+    return false;
+  }
+  if (status == XmlRpcHttpHeader::INVALID) {
+    XmlRpcUtil::error("Error in XmlRpcClient::readHeader: invalid header field.");
+    return false;
   }
 
   // If we haven't gotten the entire header yet, return (keep reading)
-  if (bp == 0) {
+  if (status == XmlRpcHttpHeader::INCOMPLETE) {
+    _header = "";
     if (_eof)          // EOF in the middle of a response is an error
     {
       XmlRpcUtil::error("Error in XmlRpcClient::readHeader: EOF while reading header");
@@ -328,12 +337,12 @@ XmlRpcClient::readHeader()
   }
 
   // Decode content length
-  if (lp == 0) {
+  if (_headerParser.contentLength() < 0) {
     XmlRpcUtil::error("Error XmlRpcClient::readHeader: No Content-length specified");
     return false;   // We could try to figure it out by parsing as we read, but for now...
   }
 
-  _contentLength = atoi(lp);
+  _contentLength = int(_headerParser.contentLength());
   if (_contentLength <= 0) {
     XmlRpcUtil::error("Error in XmlRpcClient::readHeader: Invalid Content-length specified (%d).", _contentLength);
     return false;
@@ -342,8 +351,8 @@ XmlRpcClient::readHeader()
   XmlRpcUtil::log(4, "client read content length: %d", _contentLength);
 
   // Otherwise copy non-header data to response buffer and set state to read response.
-  _response = bp;
-  _header = "";   // should parse out any interesting bits from the header (connection, etc)...
+  _response.assign(_header, consumed, std::string::npos);
+  _header = "";
   _connectionState = READ_RESPONSE;
   return true;    // Continue monitoring this source
 }
@@ -373,6 +382,11 @@ XmlRpcClient::readResponse()
   XmlRpcUtil::log(3, "XmlRpcClient::readResponse (read %d bytes)", _response.length());
   XmlRpcUtil::log(5, "response:\n%s", _response.c_str());
 
+  // A server that closes the connection after this response is treated
+  // like one that already has, so the next request reconnects.
+  if ( ! _headerParser.keepAlive())
+    _eof = true;
+
   _connectionState = IDLE;
 
   return false;    // Stop monitoring this source (causes return from work)
@@ -1,57 +1,74 @@
 
 #include "XmlRpcDispatch.h"
 #include "XmlRpcSource.h"
+#include "XmlRpcTimer.h"
 #include "XmlRpcUtil.h"
 
 #include <math.h>
-#include <sys/timeb.h>
+#include <limits>
 
 #if defined(_WINDOWS)
 # include <winsock2.h>
-
-# define USE_FTIME
-# if defined(_MSC_VER)
-#  define timeb _timeb
-#  define ftime _ftime
-# endif
 #else
-# include <sys/time.h>
+# include <time.h>
 #endif  // _WINDOWS
 
 
 using namespace XmlRpc;
 
 
-XmlRpcDispatch::XmlRpcDispatch()
+XmlRpcDispatch::XmlRpcDispatch(XmlRpcPoller* poller /*= 0*/)
 {
+  _poller = poller ? poller : XmlRpcPoller::create();
   _endTime = -1.0;
   _doClear = false;
   _inWork = false;
+  _wakeupEnabled = false;
+  _exitRequested = false;
+
+  for (int i=0; i<WHEEL_SIZE; ++i)
+    _wheel[i] = 0;
+  for (int i=0; i<WHEEL_SIZE/64; ++i)
+    _slotsUsed[i] = 0;
+  _currentTick = 0;
+  _nextTick = std::numeric_limits<long long>::max();
+  _timerCount = 0;
+
+  XmlRpcUtil::log(3, "XmlRpcDispatch: using %s.", _poller->name());
 }
 
 
 XmlRpcDispatch::~XmlRpcDispatch()
 {
+  // Forget the timers still scheduled so they do not refer back to us
+  for (int i=0; i<WHEEL_SIZE; ++i)
+    for (XmlRpcTimer* t = _wheel[i]; t != 0; t = t->_next)
+      t->_disp = 0;
+  delete _poller;
 }
 
+
+const double XmlRpcDispatch::TIMER_TICK = 0.01;
+
 // Monitor this source for the specified events and call its event handler
 // when the event occurs
 void
 XmlRpcDispatch::addSource(XmlRpcSource* source, unsigned mask)
 {
-  _sources.push_back(MonitoredSource(source, mask));
+  int fd = source->getfd();
+  SourceList::iterator it = _sources.insert(_sources.end(), MonitoredSource(source, fd, mask));
+  _bySource[source] = it;
+  if ( ! _poller->add(fd, mask, &*it))
+    XmlRpcUtil::error("XmlRpcDispatch::addSource: could not monitor fd %d.", fd);
 }
 
 // Stop monitoring this source. Does not close the source.
 void
 XmlRpcDispatch::removeSource(XmlRpcSource* source)
 {
-  for (SourceList::iterator it=_sources.begin(); it!=_sources.end(); ++it)
-    if (it->getSource() == source)
-    {
-      _sources.erase(it);
-      break;
-    }
+  SourceList::iterator it = findSource(source);
+  if (it != _sources.end())
+    removeEntry(it);
 }
 
 
@@ -59,15 +76,49 @@ XmlRpcDispatch::removeSource(XmlRpcSource* source)
 void 
 XmlRpcDispatch::setSourceEvents(XmlRpcSource* source, unsigned eventMask)
 {
-  for (SourceList::iterator it=_sources.begin(); it!=_sources.end(); ++it)
-    if (it->getSource() == source)
-    {
-      it->getMask() = eventMask;
-      break;
-    }
+  SourceList::iterator it = findSource(source);
+  if (it != _sources.end() && it->getMask() != eventMask) {
+    it->getMask() = eventMask;
+    _poller->modify(it->_fd, eventMask, &*it);
+  }
+}
+
+
+XmlRpcDispatch::SourceList::iterator
+XmlRpcDispatch::findSource(XmlRpcSource* source)
+{
+  std::unordered_map< XmlRpcSource*, SourceList::iterator >::iterator found = _bySource.find(source);
+  return (found != _bySource.end()) ? found->second : _sources.end();
+}
+
+
+void
+XmlRpcDispatch::removeEntry(SourceList::iterator it)
+{
+  // A source that closed its socket before being removed has already been
+  // dropped by the poller, and the fd may now belong to another source.
+  if (it->getSource()->getfd() == it->_fd)
+    _poller->remove(it->_fd);
+
+  _bySource.erase(it->getSource());
+
+  if (_inWork) {
+    it->_src = 0;
+    it->_mask = 0;
+    _removed.push_back(it);
+  } else
+    _sources.erase(it);
 }
 
 
+void
+XmlRpcDispatch::purgeRemoved()
+{
+  for (size_t i=0; i<_removed.size(); ++i)
+    _sources.erase(_removed[i]);
+  _removed.clear();
+}
+
 
 // Watch current set of sources and process events
 void
@@ -81,95 +132,131 @@ XmlRpcDispatch::work(double timeout)
   // Only work while there is something to monitor
   while (_sources.size() > 0) {
 
-    // Construct the sets of descriptors we are interested in
-    fd_set inFd, outFd, excFd;
-	  FD_ZERO(&inFd);
-	  FD_ZERO(&outFd);
-	  FD_ZERO(&excFd);
-
-    int maxFd = -1;     // Not used on windows
-    SourceList::iterator it;
-    for (it=_sources.begin(); it!=_sources.end(); ++it) {
-      int fd = it->getSource()->getfd();
-      if (it->getMask() & ReadableEvent) FD_SET(fd, &inFd);
-      if (it->getMask() & WritableEvent) FD_SET(fd, &outFd);
-      if (it->getMask() & Exception)     FD_SET(fd, &excFd);
-      if (it->getMask() && fd > maxFd)   maxFd = fd;
+    // Wake up for the next timer
+    double waitTime = timeout;
+    if (_timerCount > 0) {
+      double untilTimer = double(_nextTick) * TIMER_TICK - getTime();
+      if (untilTimer < 0.0) untilTimer = 0.0;
+      if (waitTime < 0.0 || untilTimer < waitTime)
+        waitTime = untilTimer;
     }
 
     // Check for events
-    int nEvents;
-    if (timeout < 0.0)
-      nEvents = select(maxFd+1, &inFd, &outFd, &excFd, NULL);
-    else 
-    {
-      struct timeval tv;
-      tv.tv_sec = (int)floor(timeout);
-      tv.tv_usec = ((int)floor(1000000.0 * (timeout-floor(timeout)))) % 1000000;
-      nEvents = select(maxFd+1, &inFd, &outFd, &excFd, &tv);
-    }
+    int nEvents = _poller->wait(waitTime, _events);
 
     if (nEvents < 0)
     {
-      XmlRpcUtil::error("Error in XmlRpcDispatch::work: error in select (%d).", nEvents);
+      XmlRpcUtil::error("Error in XmlRpcDispatch::work: error in %s (%d).", _poller->name(), nEvents);
+      _exitRequested = false;
       _inWork = false;
       return;
     }
 
-    // Process events
-    for (it=_sources.begin(); it != _sources.end(); )
+    // Process events. Only the sources that are ready are visited.
+    for (int i=0; i<nEvents; ++i)
     {
-      SourceList::iterator thisIt = it++;
-      XmlRpcSource* src = thisIt->getSource();
-      int fd = src->getfd();
+      MonitoredSource* ms = static_cast<MonitoredSource*>(_events[i].cookie);
+      XmlRpcSource* src = ms->getSource();
+      if ( ! src) continue;           // Removed while handling an earlier event
+
+      unsigned ready = _events[i].events & ms->getMask();
+      if ( ! ready) continue;
+
       unsigned newMask = (unsigned) -1;
-      if (fd <= maxFd) {
-        // If you select on multiple event types this could be ambiguous
-        if (FD_ISSET(fd, &inFd))
-          newMask &= src->handleEvent(ReadableEvent);
-        if (FD_ISSET(fd, &outFd))
-          newMask &= src->handleEvent(WritableEvent);
-        if (FD_ISSET(fd, &excFd))
-          newMask &= src->handleEvent(Exception);
-
-        if ( ! newMask) {
-          _sources.erase(thisIt);  // Stop monitoring this one
-          if ( ! src->getKeepOpen())
-            src->close();
-        } else if (newMask != (unsigned) -1) {
-          thisIt->getMask() = newMask;
-        }
+      // If you select on multiple event types this could be ambiguous
+      if (ready & ReadableEvent)
+        newMask &= src->handleEvent(ReadableEvent);
+      if ((ready & WritableEvent) && ms->getSource() == src)
+        newMask &= src->handleEvent(WritableEvent);
+      if ((ready & Exception) && ms->getSource() == src)
+        newMask &= src->handleEvent(Exception);
+
+      // The handler may have removed (and re-added) its own source
+      if (ms->getSource() != src)
+        continue;
+
+      if ( ! newMask) {
+        removeSource(src);  // Stop monitoring this one
+        if ( ! src->getKeepOpen())
+          src->close();
+      } else if (newMask != (unsigned) -1 && newMask != ms->getMask()) {
+        ms->getMask() = newMask;
+        _poller->modify(ms->_fd, newMask, ms);
       }
     }
 
+    runTimers();
+
+    purgeRemoved();
+
+    runPosted();
+
     // Check whether to clear all sources
     if (_doClear)
     {
-      SourceList closeList = _sources;
-      _sources.clear();
-      for (SourceList::iterator it=closeList.begin(); it!=closeList.end(); ++it) {
-	XmlRpcSource *src = it->getSource();
-        src->close();
-      }
-
+      _inWork = false;
+      clear();
+      _inWork = true;
       _doClear = false;
     }
 
-    // Check whether end time has passed
-    if (0 <= _endTime && getTime() > _endTime)
+    // Check whether exit was requested or end time has passed
+    if (_exitRequested || (0 <= _endTime && getTime() > _endTime))
       break;
   }
 
+  _exitRequested = false;
   _inWork = false;
 }
 
 
 // Exit from work routine. Presumably this will be called from
-// one of the source event handlers.
+// one of the source event handlers, or from another thread if
+// wakeups have been enabled.
 void
 XmlRpcDispatch::exit()
 {
-  _endTime = 0.0;   // Return from work asap
+  if (_wakeupEnabled) {
+    _exitRequested = true;
+    _poller->interrupt();   // In case work is waiting in another thread
+  } else
+    _endTime = 0.0;   // Return from work asap
+}
+
+
+// Queue a function to run on the thread executing work()
+void
+XmlRpcDispatch::post(std::function<void()> const& task)
+{
+  {
+    std::lock_guard<std::mutex> lock(_postMutex);
+    _posted.push_back(task);
+  }
+  _poller->interrupt();
+}
+
+
+void
+XmlRpcDispatch::runPosted()
+{
+  std::vector< std::function<void()> > tasks;
+  {
+    std::lock_guard<std::mutex> lock(_postMutex);
+    if (_posted.empty()) return;
+    tasks.swap(_posted);
+  }
+  for (size_t i=0; i<tasks.size(); ++i)
+    tasks[i]();
+}
+
+
+// Allow exit to be called from other threads
+bool
+XmlRpcDispatch::enableWakeup()
+{
+  if ( ! _wakeupEnabled)
+    _wakeupEnabled = _poller->enableInterrupt();
+  return _wakeupEnabled;
 }
 
 // Clear all sources from the monitored sources list
@@ -180,30 +267,176 @@ XmlRpcDispatch::clear()
     _doClear = true;  // Finish reporting current events before clearing
   else
   {
-    SourceList closeList = _sources;
-    _sources.clear();
+    // Let posted functions run first, they may hand sources back
+    runPosted();
+
+    SourceList closeList;
+    closeList.swap(_sources);
+    _bySource.clear();
+    for (SourceList::iterator it=closeList.begin(); it!=closeList.end(); ++it) {
+      XmlRpcSource *src = it->getSource();
+      if (src->getfd() == it->_fd)
+        _poller->remove(it->_fd);
+    }
     for (SourceList::iterator it=closeList.begin(); it!=closeList.end(); ++it)
       it->getSource()->close();
   }
 }
 
 
+// Schedule a timer
+void
+XmlRpcDispatch::schedule(XmlRpcTimer* timer, double delay, double interval /*= 0.0*/)
+{
+  if (timer->_disp)
+    timer->_disp->cancel(timer);
+
+  double t = getTime();
+  long long now = (long long) floor(t / TIMER_TICK);
+  if (_timerCount == 0)
+    _currentTick = now;     // Nothing to catch up on
+
+  // Round up so the timer never runs early
+  long long expires = (long long) ceil((t + delay) / TIMER_TICK);
+  timer->_expires = (expires > now) ? expires : now + 1;
+  long long ticks = (long long) ceil(interval / TIMER_TICK);
+  timer->_interval = (interval <= 0.0) ? 0 : ((ticks < 1) ? 1 : ticks);
+  timer->_disp = this;
+
+  linkTimer(timer);
+  ++_timerCount;
+  if (timer->_expires < _nextTick)
+    _nextTick = timer->_expires;
+}
+
+
+// Stop a timer
+void
+XmlRpcDispatch::cancel(XmlRpcTimer* timer)
+{
+  if (timer->_disp != this)
+    return;
+  unlinkTimer(timer);
+  timer->_disp = 0;
+  --_timerCount;
+}
+
+
+// Run the callbacks of the timers that expired since the last call
+void
+XmlRpcDispatch::runTimers()
+{
+  if (_timerCount == 0)
+    return;
+
+  long long now = (long long) floor(getTime() / TIMER_TICK);
+  if (now < _nextTick)
+    return;
+
+  // Visit each slot at most once, however long it has been
+  long long from = _currentTick + 1;
+  if (now - from >= WHEEL_SIZE)
+    from = now - WHEEL_SIZE + 1;
+  _currentTick = now;
+
+  for (long long tick = from; tick <= now && _timerCount > 0; ++tick) {
+    int slot = int(tick & (WHEEL_SIZE - 1));
+    XmlRpcTimer* timer = _wheel[slot];
+    while (timer) {
+      // Timers due in a later turn of the wheel share the slot
+      if (timer->_expires > now) {
+        timer = timer->_next;
+        continue;
+      }
+
+      unlinkTimer(timer);
+      if (timer->_interval > 0) {
+        timer->_expires = now + timer->_interval;
+        linkTimer(timer);
+      } else {
+        timer->_disp = 0;
+        --_timerCount;
+      }
+
+      // The callback may reschedule, cancel or destroy any timer
+      std::function<void()> callback = timer->_callback;
+      if (callback)
+        callback();
+      timer = _wheel[slot];
+    }
+  }
+
+  _nextTick = nextTimerTick();
+}
+
+
+void
+XmlRpcDispatch::linkTimer(XmlRpcTimer* timer)
+{
+  int slot = int(timer->_expires & (WHEEL_SIZE - 1));
+  timer->_prev = 0;
+  timer->_next = _wheel[slot];
+  if (timer->_next)
+    timer->_next->_prev = timer;
+  _wheel[slot] = timer;
+  _slotsUsed[slot / 64] |= 1ULL << (slot % 64);
+}
+
+
+void
+XmlRpcDispatch::unlinkTimer(XmlRpcTimer* timer)
+{
+  int slot = int(timer->_expires & (WHEEL_SIZE - 1));
+  if (timer->_prev)
+    timer->_prev->_next = timer->_next;
+  else
+    _wheel[slot] = timer->_next;
+  if (timer->_next)
+    timer->_next->_prev = timer->_prev;
+  timer->_prev = timer->_next = 0;
+
+  if ( ! _wheel[slot])
+    _slotsUsed[slot / 64] &= ~(1ULL << (slot % 64));
+}
+
+
+// Find the next used slot of the wheel, searching a word of the bitmap at a time
+long long
+XmlRpcDispatch::nextTimerTick()
+{
+  if (_timerCount == 0)
+    return std::numeric_limits<long long>::max();
+
+  const int nWords = WHEEL_SIZE / 64;
+  int start = int((_currentTick + 1) & (WHEEL_SIZE - 1));
+  for (int i=0; i<=nWords; ++i) {
+    int w = ((start / 64) + i) % nWords;
+    unsigned long long bits = _slotsUsed[w];
+    if (i == 0)
+      bits &= ~0ULL << (start % 64);              // Slots from start on
+    else if (i == nWords)
+      bits &= ~(~0ULL << (start % 64));           // Slots before start, wrapped around
+    if (bits) {
+      int bit = 0;
+      while ( ! (bits & 1ULL)) { bits >>= 1; ++bit; }
+      int slot = w * 64 + bit;
+      return _currentTick + 1 + ((slot - start) & (WHEEL_SIZE - 1));
+    }
+  }
+  return std::numeric_limits<long long>::max();
+}
+
+
 double
 XmlRpcDispatch::getTime()
 {
-#ifdef USE_FTIME
-  struct timeb	tbuff;
-
-  ftime(&tbuff);
-  return ((double) tbuff.time + ((double)tbuff.millitm / 1000.0) +
-	  ((double) tbuff.timezone * 60));
+#if defined(_WINDOWS)
+  return GetTickCount64() / 1000.0;
 #else
-  struct timeval	tv;
-  struct timezone	tz;
-
-  gettimeofday(&tv, &tz);
-  return (tv.tv_sec + tv.tv_usec / 1000000.0);
-#endif /* USE_FTIME */
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+#endif  // _WINDOWS
 }
 
 
@@ -0,0 +1,158 @@
+
+#include "XmlRpcHttpHeader.h"
+
+#ifndef MAKEDEPEND
+# include <ctype.h>
+# include <limits.h>
+# include <stdlib.h>
+# include <string.h>
+# include <strings.h>
+#endif
+
+using namespace XmlRpc;
+
+
+// Case insensitive search for a token in a comma separated field value
+static bool
+hasToken(std::string const& value, const char* token)
+{
+  size_t n = strlen(token);
+  size_t i = 0;
+  while (i < value.length()) {
+    while (i < value.length() && (value[i] == ',' || isspace((unsigned char)value[i]))) ++i;
+    size_t start = i;
+    while (i < value.length() && value[i] != ',') ++i;
+    size_t end = i;
+    while (end > start && isspace((unsigned char)value[end-1])) --end;
+    if (end - start == n && strncasecmp(value.c_str() + start, token, n) == 0)
+      return true;
+  }
+  return false;
+}
+
+
+XmlRpcHttpHeader::XmlRpcHttpHeader(size_t maxSize) : _maxSize(maxSize)
+{
+  reset();
+}
+
+
+void
+XmlRpcHttpHeader::reset()
+{
+  _size = 0;
+  _line.clear();
+  _complete = false;
+  _startLine.clear();
+  _contentLength = -1;
+  _connection.clear();
+  _contentEncoding.clear();
+  _transferEncoding.clear();
+}
+
+
+// Parse the next piece of the header, a line at a time
+XmlRpcHttpHeader::Status
+XmlRpcHttpHeader::parse(const char* data, size_t length, size_t* consumed)
+{
+  *consumed = 0;
+  if (_complete)
+    return COMPLETE;
+
+  const char* cp = data;
+  const char* ep = data + length;
+  while (cp < ep) {
+    const char* nl = (const char*) memchr(cp, '\n', ep - cp);
+    size_t n = (nl ? nl + 1 : ep) - cp;
+    if (_size + n > _maxSize)
+      return TOO_LARGE;
+    _size += n;
+
+    if ( ! nl) {
+      _line.append(cp, n);    // Keep the partial line for the next call
+      break;
+    }
+
+    _line.append(cp, nl - cp);
+    if ( ! _line.empty() && _line[_line.length()-1] == '\r')
+      _line.erase(_line.length()-1);
+    cp = nl + 1;
+
+    Status status = parseLine();
+    _line.clear();
+    if (status != INCOMPLETE) {
+      *consumed = cp - data;
+      return status;
+    }
+  }
+
+  *consumed = length;
+  return INCOMPLETE;
+}
+
+
+XmlRpcHttpHeader::Status
+XmlRpcHttpHeader::parseLine()
+{
+  if (_line.empty()) {
+    // Blank lines before the start line are ignored, after it they end the header
+    if (_startLine.empty())
+      return INCOMPLETE;
+    _complete = true;
+    return COMPLETE;
+  }
+
+  if (_startLine.empty()) {
+    _startLine = _line;
+    return INCOMPLETE;
+  }
+
+  size_t colon = _line.find(':');
+  if (colon == std::string::npos)
+    return INCOMPLETE;      // Not a field (or an obsolete continuation line)
+
+  // Field names are case insensitive, the value is trimmed
+  size_t nameEnd = colon;
+  while (nameEnd > 0 && isspace((unsigned char)_line[nameEnd-1])) --nameEnd;
+  size_t vp = colon + 1;
+  size_t ve = _line.length();
+  while (vp < ve && isspace((unsigned char)_line[vp])) ++vp;
+  while (ve > vp && isspace((unsigned char)_line[ve-1])) --ve;
+
+  const char* name = _line.c_str();
+  if (nameEnd == 14 && strncasecmp(name, "Content-Length", 14) == 0) {
+    // Lengths are kept as int by the connections, larger ones are refused
+    // rather than truncated
+    const char* value = _line.c_str() + vp;
+    char* end;
+    long len = strtol(value, &end, 10);
+    if (end == value || end != _line.c_str() + ve || len < 0 || len > INT_MAX ||
+        (_contentLength >= 0 && len != _contentLength))
+      return INVALID;
+    _contentLength = len;
+  }
+  else if (nameEnd == 10 && strncasecmp(name, "Connection", 10) == 0)
+    _connection.assign(_line, vp, ve - vp);
+  else if (nameEnd == 16 && strncasecmp(name, "Content-Encoding", 16) == 0)
+    _contentEncoding.assign(_line, vp, ve - vp);
+  else if (nameEnd == 17 && strncasecmp(name, "Transfer-Encoding", 17) == 0)
+    _transferEncoding.assign(_line, vp, ve - vp);
+
+  return INCOMPLETE;
+}
+
+
+bool
+XmlRpcHttpHeader::isHttp10() const
+{
+  return _startLine.find("HTTP/1.0") != std::string::npos;
+}
+
+
+bool
+XmlRpcHttpHeader::keepAlive() const
+{
+  if (isHttp10())
+    return hasToken(_connection, "keep-alive");
+  return ! hasToken(_connection, "close");
+}
@@ -0,0 +1,392 @@
+
+#include "XmlRpcParser.h"
+#include "XmlRpcBase64.h"
+#include "XmlRpcUtil.h"
+
+#ifndef MAKEDEPEND
+# include <stdio.h>
+# include <string.h>
+# include <algorithm>
+# include <charconv>
+#endif
+
+namespace XmlRpc {
+
+
+  // Tag names
+  static const char VALUE_TAG[]     = "value";
+
+  static const char BOOLEAN_TAG[]   = "boolean";
+  static const char DOUBLE_TAG[]    = "double";
+  static const char INT_TAG[]       = "int";
+  static const char I4_TAG[]        = "i4";
+  static const char I8_TAG[]        = "i8";
+  static const char STRING_TAG[]    = "string";
+  static const char DATETIME_TAG[]  = "dateTime.iso8601";
+  static const char BASE64_TAG[]    = "base64";
+
+  static const char ARRAY_TAG[]     = "array";
+  static const char DATA_TAG[]      = "data";
+
+  static const char STRUCT_TAG[]    = "struct";
+  static const char MEMBER_TAG[]    = "member";
+  static const char NAME_TAG[]      = "name";
+
+  static const char PARAMS_TAG[]    = "params";
+  static const char PARAM_TAG[]     = "param";
+
+
+  // The parameters of a request are read as an array, which is empty if
+  // there is no <params> element.
+  XmlRpcParser::XmlRpcParser(std::string const& xml, int offset, Input input) :
+    _xml(xml), _tokens(xml.data(), xml.size(), offset), _valueOffset(offset), _event(Error),
+    _depth(0), _started(false), _encoded(false)
+  {
+    _number.asDouble = 0;
+    if (input == ParamsXml) {
+      XmlRpcTokenizer::Token token;
+      while ((token = _tokens.next()) != XmlRpcTokenizer::End && token != XmlRpcTokenizer::Error)
+        if (token == XmlRpcTokenizer::StartTag && _tokens.getName() == PARAMS_TAG)
+          break;
+      _levels[_depth++] = (token == XmlRpcTokenizer::StartTag) ? IN_PARAMS : NO_PARAMS;
+      _started = (token == XmlRpcTokenizer::Error);    // Report the error
+    }
+  }
+
+
+  XmlRpcParser::Event XmlRpcParser::next()
+  {
+    if (_started && _event == Error)
+      return Error;
+
+    if ( ! _started) {
+      _started = true;
+      if (_depth)
+        return _event = StartArray;
+      if ( ! nextTagIs(XmlRpcTokenizer::StartTag, VALUE_TAG))
+        return fail();
+      return parseValue();
+    }
+
+    if (_depth == 0)
+      return _event = End;
+
+    switch (_levels[_depth-1]) {
+      case IN_ARRAY:
+        switch (nextTag()) {
+          case XmlRpcTokenizer::StartTag:
+            if (_tokens.getName() == VALUE_TAG)
+              return parseValue();
+            break;
+          case XmlRpcTokenizer::EndTag:
+            if (_tokens.getName() == DATA_TAG && nextTagIs(XmlRpcTokenizer::EndTag, ARRAY_TAG))
+              return endContainer(EndArray);
+            break;
+          default:
+            break;
+        }
+        return fail();
+
+      case AFTER_MEMBER:
+        if ( ! nextTagIs(XmlRpcTokenizer::EndTag, MEMBER_TAG))
+          return fail();
+        _levels[_depth-1] = IN_STRUCT;
+        [[fallthrough]];    // to the next member
+      case IN_STRUCT:
+        switch (nextTag()) {
+          case XmlRpcTokenizer::StartTag:
+            if (_tokens.getName() != MEMBER_TAG ||
+                ! nextTagIs(XmlRpcTokenizer::StartTag, NAME_TAG) || ! readScalar())
+              return fail();
+            _levels[_depth-1] = IN_MEMBER;
+            return _event = Member;
+          case XmlRpcTokenizer::EndTag:
+            if (_tokens.getName() == STRUCT_TAG)
+              return endContainer(EndStruct);
+            break;
+          default:
+            break;
+        }
+        return fail();
+
+      case IN_MEMBER:
+        if ( ! nextTagIs(XmlRpcTokenizer::StartTag, VALUE_TAG))
+          return fail();
+        _levels[_depth-1] = AFTER_MEMBER;
+        return parseValue();
+
+      case AFTER_PARAM:
+        if ( ! nextTagIs(XmlRpcTokenizer::EndTag, PARAM_TAG))
+          return fail();
+        _levels[_depth-1] = IN_PARAMS;
+        [[fallthrough]];    // to the next parameter
+      case IN_PARAMS:
+        switch (nextTag()) {
+          case XmlRpcTokenizer::StartTag:
+            if (_tokens.getName() != PARAM_TAG || ! nextTagIs(XmlRpcTokenizer::StartTag, VALUE_TAG))
+              return fail();
+            _levels[_depth-1] = AFTER_PARAM;
+            return parseValue();
+          case XmlRpcTokenizer::EndTag:
+            if (_tokens.getName() == PARAMS_TAG) {
+              --_depth;
+              return _event = EndArray;
+            }
+            break;
+          default:
+            break;
+        }
+        return fail();
+
+      default:    // NO_PARAMS
+        --_depth;
+        return _event = EndArray;
+    }
+  }
+
+
+  // A value is either text, which is a string, or a type tag
+  XmlRpcParser::Event XmlRpcParser::parseValue()
+  {
+    _valueOffset = int(_tokens.getTokenOffset());
+
+    XmlRpcTokenizer::Token token = _tokens.next();
+    bool blank = true;
+    _text = std::string_view(_xml.data() + _tokens.getTokenOffset(), 0);
+    _encoded = false;
+    if (token == XmlRpcTokenizer::Text) {
+      _text = _tokens.getText();
+      _encoded = _tokens.isEncoded();
+      blank = _tokens.isBlank();
+      token = _tokens.next();
+    }
+    if (token == XmlRpcTokenizer::EndTag && _tokens.getName() == VALUE_TAG)
+      return _event = String;
+    if (token != XmlRpcTokenizer::StartTag || ! blank)
+      return fail();
+
+    std::string_view type = _tokens.getName();
+    if (type == ARRAY_TAG) {
+      if ( ! nextTagIs(XmlRpcTokenizer::StartTag, DATA_TAG) || _depth == MAX_DEPTH)
+        return fail();
+      _levels[_depth++] = IN_ARRAY;
+      return _event = StartArray;
+    }
+    if (type == STRUCT_TAG) {
+      if (_depth == MAX_DEPTH)
+        return fail();
+      _levels[_depth++] = IN_STRUCT;
+      return _event = StartStruct;
+    }
+
+    if ( ! readScalar())
+      return fail();
+
+    if (type == STRING_TAG)
+      _event = String;
+    else if (type == I4_TAG || type == INT_TAG) {
+      if ( ! readNumber(_number.asInt))
+        return fail();
+      _event = Int;
+    }
+    else if (type == DOUBLE_TAG) {
+      if ( ! readNumber(_number.asDouble))
+        return fail();
+      _event = Double;
+    }
+    else if (type == BOOLEAN_TAG) {
+      int ivalue;
+      if ( ! readNumber(ivalue) || (ivalue != 0 && ivalue != 1))
+        return fail();
+      _number.asBool = (ivalue == 1);
+      _event = Boolean;
+    }
+    else if (type == I8_TAG) {
+      if ( ! readNumber(_number.asInt64))
+        return fail();
+      _event = Int64;
+    }
+    else if (type == DATETIME_TAG) {
+      char buf[32];     // The text is not terminated
+      size_t n = std::min(_text.size(), sizeof(buf) - 1);
+      memcpy(buf, _text.data(), n);
+      buf[n] = 0;
+      int* t = _time;
+      if (sscanf(buf, "%4d%2d%2dT%2d:%2d:%2d", &t[0], &t[1], &t[2], &t[3], &t[4], &t[5]) != 6)
+        return fail();
+      _event = DateTime;
+    }
+    else if (type == BASE64_TAG)
+      _event = Base64;
+    else        // Unrecognized tag after <value>
+      return fail();
+
+    if ( ! nextTagIs(XmlRpcTokenizer::EndTag, VALUE_TAG))
+      return fail();
+    return _event;
+  }
+
+  // The text is optional
+  bool XmlRpcParser::readScalar()
+  {
+    std::string_view tag = _tokens.getName();
+    XmlRpcTokenizer::Token token = _tokens.next();
+    if (token == XmlRpcTokenizer::Text) {
+      _text = _tokens.getText();
+      _encoded = _tokens.isEncoded();
+      token = _tokens.next();
+    } else {
+      _text = std::string_view(_xml.data() + _tokens.getTokenOffset(), 0);
+      _encoded = false;
+    }
+    return token == XmlRpcTokenizer::EndTag && _tokens.getName() == tag;
+  }
+
+  // Numbers are read the same whatever the locale. Out of range values are
+  // errors, and so is anything but whitespace around the number.
+  template <typename T>
+  bool XmlRpcParser::readNumber(T& value)
+  {
+    const char* cp = _text.data();
+    const char* end = cp + _text.size();
+    while (cp < end && (*cp == ' ' || *cp == '\t' || *cp == '\r' || *cp == '\n'))
+      ++cp;
+    while (end > cp && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+      --end;
+    if (cp < end && *cp == '+' && ++cp < end && *cp == '-')
+      return false;
+
+    std::from_chars_result result = std::from_chars(cp, end, value);
+    return result.ec == std::errc() && result.ptr == end;
+  }
+
+  XmlRpcTokenizer::Token XmlRpcParser::nextTag()
+  {
+    XmlRpcTokenizer::Token token = _tokens.next();
+    if (token == XmlRpcTokenizer::Text)
+      token = _tokens.isBlank() ? _tokens.next() : XmlRpcTokenizer::Error;
+    return token;
+  }
+
+  bool XmlRpcParser::nextTagIs(XmlRpcTokenizer::Token token, const char* name)
+  {
+    return nextTag() == token && _tokens.getName() == name;
+  }
+
+  XmlRpcParser::Event XmlRpcParser::endContainer(Event event)
+  {
+    --_depth;
+    if ( ! nextTagIs(XmlRpcTokenizer::EndTag, VALUE_TAG))
+      return fail();
+    return _event = event;
+  }
+
+
+  // Find the </value> tag matching the <value> tag of the container. Only the
+  // value tags need to be looked at. The parameters of a request are not in a
+  // value, so they are read through.
+  bool XmlRpcParser::skip()
+  {
+    if ((_event != StartArray && _event != StartStruct) || _depth == 0)
+      return false;
+
+    if (_levels[_depth-1] >= IN_PARAMS) {
+      while (_depth > 0)
+        if (next() == Error)
+          return false;
+      return true;
+    }
+
+    for (int depth = 1; depth > 0; ) {
+      switch (_tokens.next()) {
+        case XmlRpcTokenizer::StartTag:
+          if (_tokens.getName() == VALUE_TAG)
+            ++depth;
+          break;
+        case XmlRpcTokenizer::EndTag:
+          if (_tokens.getName() == VALUE_TAG)
+            --depth;
+          break;
+        case XmlRpcTokenizer::Text:
+          break;
+        default:
+          fail();
+          return false;     // No end tag
+      }
+    }
+
+    --_depth;
+    _event = (_event == StartArray) ? EndArray : EndStruct;
+    return true;
+  }
+
+
+  bool XmlRpcParser::parse(Handler& handler)
+  {
+    std::string decoded;
+    std::vector<char> binary;
+    struct tm t;
+
+    for (;;) {
+      bool more = true;
+      switch (next()) {
+        case Error:       return false;
+        case End:         return true;
+        case Boolean:     more = handler.onBoolean(getBool()); break;
+        case Int:         more = handler.onInt(getInt()); break;
+        case Int64:       more = handler.onInt64(getInt64()); break;
+        case Double:      more = handler.onDouble(getDouble()); break;
+        case DateTime:    getTime(t); more = handler.onDateTime(t); break;
+        case StartArray:  more = handler.onStartArray(); break;
+        case EndArray:    more = handler.onEndArray(); break;
+        case StartStruct: more = handler.onStartStruct(); break;
+        case EndStruct:   more = handler.onEndStruct(); break;
+        case String:
+        case Member:
+          {
+            std::string_view text = _text;
+            if (_encoded) {
+              decoded = getString();
+              text = decoded;
+            }
+            more = (_event == String) ? handler.onString(text) : handler.onMember(text);
+          }
+          break;
+        case Base64:
+          binary.clear();
+          if ( ! getBinary(binary)) {
+            fail();
+            return false;
+          }
+          more = handler.onBase64(binary);
+          break;
+      }
+      if ( ! more)
+        return false;
+    }
+  }
+
+
+  std::string XmlRpcParser::getString() const
+  {
+    return XmlRpcUtil::xmlDecode(_text);
+  }
+
+  void XmlRpcParser::getTime(struct tm& t) const
+  {
+    memset(&t, 0, sizeof(t));
+    t.tm_year = _time[0];
+    t.tm_mon = _time[1];
+    t.tm_mday = _time[2];
+    t.tm_hour = _time[3];
+    t.tm_min = _time[4];
+    t.tm_sec = _time[5];
+    t.tm_isdst = -1;
+  }
+
+  bool XmlRpcParser::getBinary(std::vector<char>& data) const
+  {
+    return XmlRpcBase64::decode(_text, data);
+  }
+
+} // namespace XmlRpc
@@ -0,0 +1,348 @@
+
+#include "XmlRpcPoller.h"
+#include "XmlRpcDispatch.h"
+#include "XmlRpcUtil.h"
+
+#ifndef MAKEDEPEND
+# include <map>
+# include <math.h>
+# include <errno.h>
+#endif
+
+#if defined(_WINDOWS)
+# include <winsock2.h>
+#else
+# include <sys/time.h>
+# include <sys/types.h>
+# include <unistd.h>
+# include <fcntl.h>
+#endif  // _WINDOWS
+
+#if defined(__linux__)
+# define HAVE_EPOLL
+# include <stdint.h>
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+#endif
+
+
+using namespace XmlRpc;
+
+
+namespace {
+
+  // Portable poller built on select(). The descriptor sets are rebuilt on
+  // every wait, so this is only used where nothing better is available.
+  class SelectPoller : public XmlRpcPoller {
+  public:
+    SelectPoller()
+    {
+      _wakePipe[0] = _wakePipe[1] = -1;
+    }
+
+    ~SelectPoller()
+    {
+#if !defined(_WINDOWS)
+      if (_wakePipe[0] >= 0) {
+        ::close(_wakePipe[0]);
+        ::close(_wakePipe[1]);
+      }
+#endif
+    }
+
+    bool add(int fd, unsigned mask, void* cookie)
+    {
+#if !defined(_WINDOWS)
+      if (fd < 0 || fd >= FD_SETSIZE)
+      {
+        XmlRpcUtil::error("XmlRpcPoller(select)::add: fd %d exceeds FD_SETSIZE.", fd);
+        return false;
+      }
+#endif
+      _fds[fd] = Entry(mask, cookie);
+      return true;
+    }
+
+    bool modify(int fd, unsigned mask, void* cookie)
+    {
+      FdMap::iterator it = _fds.find(fd);
+      if (it == _fds.end())
+        return false;
+      it->second = Entry(mask, cookie);
+      return true;
+    }
+
+    void remove(int fd)
+    {
+      _fds.erase(fd);
+    }
+
+    int wait(double timeout, std::vector<Event>& events)
+    {
+      events.clear();
+
+      fd_set inFd, outFd, excFd;
+      FD_ZERO(&inFd);
+      FD_ZERO(&outFd);
+      FD_ZERO(&excFd);
+
+      int maxFd = -1;     // Not used on windows
+      FdMap::iterator it;
+      for (it=_fds.begin(); it!=_fds.end(); ++it) {
+        int fd = it->first;
+        unsigned mask = it->second.mask;
+        if (mask & XmlRpcDispatch::ReadableEvent) FD_SET(fd, &inFd);
+        if (mask & XmlRpcDispatch::WritableEvent) FD_SET(fd, &outFd);
+        if (mask & XmlRpcDispatch::Exception)     FD_SET(fd, &excFd);
+        if (mask && fd > maxFd)   maxFd = fd;
+      }
+
+      int nEvents;
+      if (timeout < 0.0)
+        nEvents = select(maxFd+1, &inFd, &outFd, &excFd, NULL);
+      else
+      {
+        struct timeval tv;
+        tv.tv_sec = (int)floor(timeout);
+        tv.tv_usec = ((int)floor(1000000.0 * (timeout-floor(timeout)))) % 1000000;
+        nEvents = select(maxFd+1, &inFd, &outFd, &excFd, &tv);
+      }
+
+      if (nEvents < 0)
+        return (errno == EINTR) ? 0 : -1;
+
+      for (it=_fds.begin(); nEvents > 0 && it!=_fds.end(); ++it) {
+        int fd = it->first;
+        if (fd == _wakePipe[0]) {
+          if (FD_ISSET(fd, &inFd))
+            drainWakePipe();
+          continue;
+        }
+        unsigned ready = 0;
+        if (FD_ISSET(fd, &inFd))  ready |= XmlRpcDispatch::ReadableEvent;
+        if (FD_ISSET(fd, &outFd)) ready |= XmlRpcDispatch::WritableEvent;
+        if (FD_ISSET(fd, &excFd)) ready |= XmlRpcDispatch::Exception;
+        if (ready) {
+          Event e;
+          e.cookie = it->second.cookie;
+          e.events = ready;
+          events.push_back(e);
+        }
+      }
+      return int(events.size());
+    }
+
+    bool enableInterrupt()
+    {
+#if defined(_WINDOWS)
+      return false;
+#else
+      if (_wakePipe[0] >= 0)
+        return true;
+      if (pipe(_wakePipe) != 0)
+        return false;
+      for (int i=0; i<2; ++i) {
+        fcntl(_wakePipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(_wakePipe[i], F_SETFD, FD_CLOEXEC);
+      }
+      return add(_wakePipe[0], XmlRpcDispatch::ReadableEvent, 0);
+#endif
+    }
+
+    void interrupt()
+    {
+#if !defined(_WINDOWS)
+      if (_wakePipe[1] >= 0) {
+        char c = 0;
+        ssize_t n = ::write(_wakePipe[1], &c, 1);   // A full pipe already wakes the poller
+        (void) n;
+      }
+#endif
+    }
+
+    const char* name() const { return "select"; }
+
+  private:
+    void drainWakePipe()
+    {
+#if !defined(_WINDOWS)
+      char buf[64];
+      while (::read(_wakePipe[0], buf, sizeof(buf)) > 0)
+        ;
+#endif
+    }
+
+    struct Entry {
+      Entry(unsigned m = 0, void* c = 0) : mask(m), cookie(c) {}
+      unsigned mask;
+      void* cookie;
+    };
+    typedef std::map<int, Entry> FdMap;
+    FdMap _fds;
+
+    // Self-pipe used to interrupt select
+    int _wakePipe[2];
+  };
+
+
+#if defined(HAVE_EPOLL)
+
+  // Level-triggered epoll poller. Registration changes are single epoll_ctl
+  // calls and each wait only reports the descriptors that are ready.
+  class EpollPoller : public XmlRpcPoller {
+  public:
+    EpollPoller(int epfd) : _epfd(epfd), _wakeFd(-1) {}
+    ~EpollPoller()
+    {
+      if (_wakeFd >= 0) ::close(_wakeFd);
+      ::close(_epfd);
+    }
+
+    bool add(int fd, unsigned mask, void* cookie)
+    {
+      // Descriptors with no interesting events are not registered, otherwise
+      // a hangup would be reported on every wait.
+      if (mask == 0)
+        return true;
+      struct epoll_event ev = toEpoll(mask, cookie);
+      if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) == 0 ||
+          (errno == EEXIST && epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) == 0))
+        return true;
+
+      XmlRpcUtil::error("XmlRpcPoller(epoll)::add: could not monitor fd %d (errno %d).", fd, errno);
+      return false;
+    }
+
+    bool modify(int fd, unsigned mask, void* cookie)
+    {
+      if (mask == 0)
+      {
+        remove(fd);
+        return true;
+      }
+      struct epoll_event ev = toEpoll(mask, cookie);
+      if (epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) == 0)
+        return true;
+      if (errno == ENOENT)
+        return add(fd, mask, cookie);
+
+      XmlRpcUtil::error("XmlRpcPoller(epoll)::modify: could not modify fd %d (errno %d).", fd, errno);
+      return false;
+    }
+
+    void remove(int fd)
+    {
+      struct epoll_event ev = { 0, { 0 } };   // Required by kernels before 2.6.9
+      epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, &ev);
+    }
+
+    int wait(double timeout, std::vector<Event>& events)
+    {
+      events.clear();
+
+      int msTimeout = (timeout < 0.0) ? -1 : int(ceil(timeout * 1000.0));
+      int nEvents = epoll_wait(_epfd, _ready, MAX_EVENTS, msTimeout);
+      if (nEvents < 0)
+        return (errno == EINTR) ? 0 : -1;
+
+      int n = 0;
+      for (int i=0; i<nEvents; ++i) {
+        if (_ready[i].data.ptr == &_wakeFd) {
+          uint64_t count;
+          ssize_t r = ::read(_wakeFd, &count, sizeof(count));
+          (void) r;
+          continue;
+        }
+
+        uint32_t ev = _ready[i].events;
+        unsigned ready = 0;
+        if (ev & EPOLLIN)  ready |= XmlRpcDispatch::ReadableEvent;
+        if (ev & EPOLLOUT) ready |= XmlRpcDispatch::WritableEvent;
+        if (ev & EPOLLPRI) ready |= XmlRpcDispatch::Exception;
+        // Like select, report errors and hangups as readable/writable so the
+        // source finds out when it tries to do IO.
+        if (ev & (EPOLLERR | EPOLLHUP))
+          ready |= XmlRpcDispatch::ReadableEvent | XmlRpcDispatch::WritableEvent;
+
+        Event e;
+        e.cookie = _ready[i].data.ptr;
+        e.events = ready;
+        events.push_back(e);
+        ++n;
+      }
+      return n;
+    }
+
+    bool enableInterrupt()
+    {
+      if (_wakeFd >= 0)
+        return true;
+      _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (_wakeFd < 0)
+        return false;
+      return add(_wakeFd, XmlRpcDispatch::ReadableEvent, &_wakeFd);
+    }
+
+    void interrupt()
+    {
+      if (_wakeFd >= 0) {
+        uint64_t one = 1;
+        ssize_t n = ::write(_wakeFd, &one, sizeof(one));
+        (void) n;
+      }
+    }
+
+    const char* name() const { return "epoll"; }
+
+  private:
+    static struct epoll_event toEpoll(unsigned mask, void* cookie)
+    {
+      struct epoll_event ev;
+      ev.events = 0;
+      if (mask & XmlRpcDispatch::ReadableEvent) ev.events |= EPOLLIN;
+      if (mask & XmlRpcDispatch::WritableEvent) ev.events |= EPOLLOUT;
+      if (mask & XmlRpcDispatch::Exception)     ev.events |= EPOLLPRI;
+      ev.data.ptr = cookie;
+      return ev;
+    }
+
+    enum { MAX_EVENTS = 256 };
+
+    int _epfd;
+    int _wakeFd;      // eventfd used by interrupt()
+    struct epoll_event _ready[MAX_EVENTS];
+  };
+
+#endif  // HAVE_EPOLL
+
+} // namespace
+
+
+XmlRpcPoller*
+XmlRpcPoller::createSelect()
+{
+  return new SelectPoller();
+}
+
+
+XmlRpcPoller*
+XmlRpcPoller::createEpoll()
+{
+#if defined(HAVE_EPOLL)
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd >= 0)
+    return new EpollPoller(epfd);
+  XmlRpcUtil::error("XmlRpcPoller::createEpoll: epoll_create1 failed (errno %d).", errno);
+#endif
+  return 0;
+}
+
+
+XmlRpcPoller*
+XmlRpcPoller::create()
+{
+  XmlRpcPoller* poller = createEpoll();
+  if ( ! poller)
+    poller = createSelect();
+  return poller;
+}
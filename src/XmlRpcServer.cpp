@@ -1,20 +1,95 @@
 
 #include "XmlRpcServer.h"
 #include "XmlRpcServerConnection.h"
+#include "XmlRpcHttpHeader.h"
 #include "XmlRpcServerMethod.h"
 #include "XmlRpcSocket.h"
+#include "XmlRpcThreadPool.h"
+#include "XmlRpcTimer.h"
 #include "XmlRpcUtil.h"
 #include "XmlRpcException.h"
 
+#ifndef MAKEDEPEND
+# include <thread>
+#endif
+
 
 using namespace XmlRpc;
 
 
+namespace XmlRpc {
+
+  // An event loop run by its own thread in a multi-reactor server. It owns
+  // a listening socket bound to the server port with SO_REUSEPORT and the
+  // dispatcher monitoring that socket and the connections accepted on it.
+  class XmlRpcServerReactor : public XmlRpcSource {
+  public:
+    XmlRpcServerReactor(XmlRpcServer* server, int fd) : XmlRpcSource(fd), _server(server)
+    {
+      _disp.enableWakeup();
+      _disp.addSource(this, XmlRpcDispatch::ReadableEvent);
+    }
+
+    // Handle connection requests on this reactor's listening socket
+    unsigned handleEvent(unsigned /*eventType*/)
+    {
+      _server->acceptConnection(this->getfd(), &_disp);
+      return XmlRpcDispatch::ReadableEvent;
+    }
+
+    XmlRpcServer* _server;
+    XmlRpcDispatch _disp;
+  };
+
+
+  // A client turned away by the connection limit. Its input is discarded
+  // until it disconnects, for at most a second.
+  class XmlRpcRejectedConnection : public XmlRpcSource {
+  public:
+    XmlRpcRejectedConnection(int fd, XmlRpcDispatch* disp) :
+      XmlRpcSource(fd, true), _disp(disp), _linger([this]() { expired(); })
+    {
+      _disp->schedule(&_linger, 1.0);
+    }
+
+    unsigned handleEvent(unsigned /*eventType*/)
+    {
+      std::string discard;
+      bool eof = false;
+      if ( ! XmlRpcSocket::nbRead(this->getfd(), discard, &eof) || eof)
+        return 0;
+      return XmlRpcDispatch::ReadableEvent;
+    }
+
+  private:
+    void expired()
+    {
+      _disp->removeSource(this);
+      close();
+    }
+
+    XmlRpcDispatch* _disp;
+    XmlRpcTimer _linger;
+  };
+
+} // namespace XmlRpc
+
+
 XmlRpcServer::XmlRpcServer()
 {
   _introspectionEnabled = false;
   _listMethods = 0;
   _methodHelp = 0;
+  _reactorCount = 1;
+  _workers = 0;
+  _workerThreads = 0;
+  _maxConnections = 0;
+  _connectionCount = 0;
+  _deferAccept = 0;
+  _maxHeaderSize = XmlRpcHttpHeader::DEFAULT_MAX_SIZE;
+  _idleTimeout = 0.0;
+  _headerTimeout = 0.0;
+  _bodyTimeout = 0.0;
 }
 
 
@@ -64,53 +139,110 @@ XmlRpcServer::findMethod(const std::string& name) const
 }
 
 
-// Create a socket, bind to the specified port, and
-// set it in listen mode to make it available for clients.
-bool 
-XmlRpcServer::bindAndListen(int port, int backlog /*= 5*/)
+// Specify the number of event loop threads used by work()
+void
+XmlRpcServer::setReactorCount(int n)
+{
+  _reactorCount = (n < 1) ? 1 : n;
+}
+
+
+// Execute methods on a pool of worker threads
+void
+XmlRpcServer::setWorkerThreads(int n)
+{
+  delete _workers;
+  _workerThreads = (n > 0) ? n : 0;
+  _workers = (n > 0) ? new XmlRpcThreadPool(n) : 0;
+}
+
+
+// Delay reporting connections until data arrives
+bool
+XmlRpcServer::deferAccept(int fd)
+{
+  return XmlRpcSocket::setDeferAccept(fd, _deferAccept);
+}
+
+
+// Create a non-blocking socket bound to the specified port in listening mode.
+// Returns -1 on failure.
+int
+XmlRpcServer::listenSocket(int port, int backlog, bool reusePort)
 {
   int fd = XmlRpcSocket::socket();
   if (fd < 0)
   {
     XmlRpcUtil::error("XmlRpcServer::bindAndListen: Could not create socket (%s).", XmlRpcSocket::getErrorMsg().c_str());
-    return false;
+    return -1;
   }
 
-  this->setfd(fd);
+  const char* err = 0;
 
   // Don't block on reads/writes
   if ( ! XmlRpcSocket::setNonBlocking(fd))
-  {
-    this->close();
-    XmlRpcUtil::error("XmlRpcServer::bindAndListen: Could not set socket to non-blocking input mode (%s).", XmlRpcSocket::getErrorMsg().c_str());
-    return false;
-  }
+    err = "Could not set socket to non-blocking input mode";
 
   // Allow this port to be re-bound immediately so server re-starts are not delayed
-  if ( ! XmlRpcSocket::setReuseAddr(fd))
-  {
-    this->close();
-    XmlRpcUtil::error("XmlRpcServer::bindAndListen: Could not set SO_REUSEADDR socket option (%s).", XmlRpcSocket::getErrorMsg().c_str());
-    return false;
-  }
+  else if ( ! XmlRpcSocket::setReuseAddr(fd))
+    err = "Could not set SO_REUSEADDR socket option";
+
+  // Let each reactor listen on its own socket
+  else if (reusePort && ! XmlRpcSocket::setReusePort(fd))
+    err = "Could not set SO_REUSEPORT socket option";
 
   // Bind to the specified port on the default interface
-  if ( ! XmlRpcSocket::bind(fd, port))
-  {
-    this->close();
-    XmlRpcUtil::error("XmlRpcServer::bindAndListen: Could not bind to specified port (%s).", XmlRpcSocket::getErrorMsg().c_str());
-    return false;
-  }
+  else if ( ! XmlRpcSocket::bind(fd, port))
+    err = "Could not bind to specified port";
 
   // Set in listening mode
-  if ( ! XmlRpcSocket::listen(fd, backlog))
+  else if ( ! XmlRpcSocket::listen(fd, backlog))
+    err = "Could not set socket in listening mode";
+
+  // Wait for the request before reporting the connection
+  if ( ! err && _deferAccept > 0 && ! deferAccept(fd))
+    XmlRpcUtil::log(1, "XmlRpcServer::bindAndListen: TCP_DEFER_ACCEPT not supported.");
+
+  if (err)
   {
-    this->close();
-    XmlRpcUtil::error("XmlRpcServer::bindAndListen: Could not set socket in listening mode (%s).", XmlRpcSocket::getErrorMsg().c_str());
+    XmlRpcUtil::error("XmlRpcServer::bindAndListen: %s (%s).", err, XmlRpcSocket::getErrorMsg().c_str());
+    XmlRpcSocket::close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+// Create a socket, bind to the specified port, and
+// set it in listen mode to make it available for clients.
+bool 
+XmlRpcServer::bindAndListen(int port, int backlog /*= 128*/)
+{
+  bool reusePort = _reactorCount > 1;
+  int fd = listenSocket(port, backlog, reusePort);
+  if (fd < 0)
     return false;
+
+  this->setfd(fd);
+
+  // Each additional reactor gets its own socket on the same port
+  for (int i=1; i<_reactorCount; ++i)
+  {
+    int rfd = listenSocket(port, backlog, reusePort);
+    if (rfd < 0)
+    {
+      this->close();
+      this->shutdown();
+      return false;
+    }
+    _reactors.push_back(new XmlRpcServerReactor(this, rfd));
   }
 
-  XmlRpcUtil::log(2, "XmlRpcServer::bindAndListen: server listening on port %d fd %d", port, fd);
+  XmlRpcUtil::log(2, "XmlRpcServer::bindAndListen: server listening on port %d fd %d (%d reactors)", port, fd, _reactorCount);
+
+  // Allow exit() to be called from other threads
+  _disp.enableWakeup();
 
   // Notify the dispatcher to listen on this source when we are in work()
   _disp.addSource(this, XmlRpcDispatch::ReadableEvent);
@@ -124,7 +256,22 @@ void
 XmlRpcServer::work(double msTime)
 {
   XmlRpcUtil::log(2, "XmlRpcServer::work: waiting for a connection");
+
+  // The worker threads are stopped by shutdown
+  if (_workerThreads > 0 && ! _workers)
+    _workers = new XmlRpcThreadPool(_workerThreads);
+
+  // Additional reactors run in their own threads until this one is done
+  std::vector<std::thread> threads;
+  for (size_t i=0; i<_reactors.size(); ++i)
+    threads.push_back(std::thread(&XmlRpcDispatch::work, &_reactors[i]->_disp, msTime));
+
   _disp.work(msTime);
+
+  for (size_t i=0; i<_reactors.size(); ++i)
+    _reactors[i]->_disp.exit();
+  for (size_t i=0; i<threads.size(); ++i)
+    threads[i].join();
 }
 
 
@@ -144,26 +291,61 @@ XmlRpcServer::handleEvent(unsigned mask)
 void
 XmlRpcServer::acceptConnection()
 {
-  int s = XmlRpcSocket::accept(this->getfd());
-  XmlRpcUtil::log(2, "XmlRpcServer::acceptConnection: socket %d", s);
-  if (s < 0)
-  {
-    //this->close();
-    XmlRpcUtil::error("XmlRpcServer::acceptConnection: Could not accept connection (%s).", XmlRpcSocket::getErrorMsg().c_str());
-  }
-  else if ( ! XmlRpcSocket::setNonBlocking(s))
-  {
-    XmlRpcSocket::close(s);
-    XmlRpcUtil::error("XmlRpcServer::acceptConnection: Could not set socket to non-blocking input mode (%s).", XmlRpcSocket::getErrorMsg().c_str());
-  }
-  else  // Notify the dispatcher to listen for input on this source when we are in work()
+  acceptConnection(this->getfd(), &_disp);
+}
+
+
+// Accept the connection requests pending on a listening socket and monitor
+// the new connections with the dispatcher of the reactor that owns the socket.
+void
+XmlRpcServer::acceptConnection(int listenFd, XmlRpcDispatch* disp)
+{
+  // Drain the queue so a burst of clients is not accepted one wakeup at a
+  // time, but leave the rest for the next pass if it is very long.
+  const int MAX_ACCEPTS = 128;
+  for (int i=0; i<MAX_ACCEPTS; ++i)
   {
+    int s = XmlRpcSocket::acceptNonBlocking(listenFd);
+    XmlRpcUtil::log(2, "XmlRpcServer::acceptConnection: socket %d", s);
+    if (s < 0)
+    {
+      if ( ! XmlRpcSocket::nonFatalError())
+        XmlRpcUtil::error("XmlRpcServer::acceptConnection: Could not accept connection (%s).", XmlRpcSocket::getErrorMsg().c_str());
+      break;
+    }
+
+    if (_maxConnections > 0 && _connectionCount.load() >= _maxConnections)
+    {
+      rejectConnection(s, disp);
+      continue;
+    }
+
+    // Notify the dispatcher to listen for input on this source when we are in work()
     XmlRpcUtil::log(2, "XmlRpcServer::acceptConnection: creating a connection");
-    _disp.addSource(this->createConnection(s), XmlRpcDispatch::ReadableEvent);
+    XmlRpcServerConnection* c = this->createConnection(s);
+    ++_connectionCount;
+    c->setDispatch(disp);
+    disp->addSource(c, XmlRpcDispatch::ReadableEvent);
   }
 }
 
 
+// Tell the client the server is busy and close the socket once the client
+// has gone, so that its unread request does not reset the connection.
+void
+XmlRpcServer::rejectConnection(int s, XmlRpcDispatch* disp)
+{
+  XmlRpcUtil::log(2, "XmlRpcServer::rejectConnection: too many connections, rejecting socket %d", s);
+  std::string response =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-length: 0\r\n"
+    "Connection: close\r\n\r\n";
+  int written = 0;
+  XmlRpcSocket::nbWrite(s, response, &written);   // Best effort, the socket buffer is empty
+  disp->addSource(new XmlRpcRejectedConnection(s, disp), XmlRpcDispatch::ReadableEvent);
+}
+
+
 // Create a new connection object for processing requests from a specific client.
 XmlRpcServerConnection*
 XmlRpcServer::createConnection(int s)
@@ -176,7 +358,42 @@ XmlRpcServer::createConnection(int s)
 void 
 XmlRpcServer::removeConnection(XmlRpcServerConnection* sc)
 {
-  _disp.removeSource(sc);
+  XmlRpcDispatch* disp = sc->getDispatch();
+  if (disp)
+    --_connectionCount;     // Accepted by acceptConnection
+  else
+    disp = &_disp;
+  disp->removeSource(sc);
+}
+
+
+void
+XmlRpcServer::addParkedConnection(XmlRpcServerConnection* sc)
+{
+  std::lock_guard<std::mutex> lock(_parkedMutex);
+  _parked.insert(sc);
+}
+
+
+void
+XmlRpcServer::removeParkedConnection(XmlRpcServerConnection* sc)
+{
+  std::lock_guard<std::mutex> lock(_parkedMutex);
+  _parked.erase(sc);
+}
+
+
+// Connections closed here remove themselves from the set, so it is swapped out
+void
+XmlRpcServer::closeParkedConnections()
+{
+  std::set<XmlRpcServerConnection*> parked;
+  {
+    std::lock_guard<std::mutex> lock(_parkedMutex);
+    parked.swap(_parked);
+  }
+  for (std::set<XmlRpcServerConnection*>::iterator it=parked.begin(); it!=parked.end(); ++it)
+    (*it)->closeParked();
 }
 
 
@@ -185,6 +402,8 @@ void
 XmlRpcServer::exit()
 {
   _disp.exit();
+  for (size_t i=0; i<_reactors.size(); ++i)
+    _reactors[i]->_disp.exit();
 }
 
 
@@ -192,8 +411,25 @@ XmlRpcServer::exit()
 void 
 XmlRpcServer::shutdown()
 {
-  // This closes and destroys all connections as well as closing this socket
+  // Let methods in progress finish so their connections are handed back.
+  // The threads are started again by the next work().
+  delete _workers;
+  _workers = 0;
+
+  // Connections waiting for asynchronous results are in no dispatcher. Those
+  // whose result is in are resumed and closed with the others.
+  closeParkedConnections();
+
+  // This closes and destroys all connections as well as closing the sockets
+  for (size_t i=0; i<_reactors.size(); ++i) {
+    _reactors[i]->_disp.clear();
+    delete _reactors[i];
+  }
+  _reactors.clear();
   _disp.clear();
+
+  // Resumed connections may have started waiting for another request's result
+  closeParkedConnections();
 }
 
 
@@ -0,0 +1,150 @@
+
+#include "XmlRpcServerCompletion.h"
+#include "XmlRpcServerConnection.h"
+#include "XmlRpcDispatch.h"
+#include "XmlRpcException.h"
+#include "XmlRpcUtil.h"
+
+using namespace XmlRpc;
+
+
+XmlRpcServerCompletion::XmlRpcServerCompletion(std::shared_ptr<Request> const& request) :
+  _request(request), _state(PENDING), _claimed(false), _isFault(false), _faultCode(0)
+{
+}
+
+
+XmlRpcServerCompletion::XmlRpcServerCompletion(XmlRpcServerConnection* conn, XmlRpcDispatch* disp,
+                                               std::shared_ptr<Request> const& request) :
+  _request(request), _target(new Target(conn, disp)), _state(PENDING), _claimed(false), _isFault(false), _faultCode(0)
+{
+}
+
+
+XmlRpcServerCompletion::~XmlRpcServerCompletion()
+{
+  if ( ! _claimed.load())
+    fail("XmlRpcServerCompletion: method did not return a result");
+}
+
+
+// Deliver the result of the method
+void
+XmlRpcServerCompletion::complete(XmlRpcValue const& result)
+{
+  if ( ! claim()) return;
+
+  std::unique_lock<std::mutex> lock;
+  XmlRpcServerConnection* conn = lockTarget(lock);
+  if (conn)
+    conn->generateResponse(result);
+  else
+    _result = result.valid() ? result : XmlRpcValue(std::string());
+  finish(conn);
+}
+
+void
+XmlRpcServerCompletion::complete(XmlRpcValue&& result)
+{
+  if ( ! claim()) return;
+
+  std::unique_lock<std::mutex> lock;
+  XmlRpcServerConnection* conn = lockTarget(lock);
+  if (conn)
+    conn->generateResponse(result);
+  else if (result.valid())
+    _result = std::move(result);
+  else
+    _result = std::string();
+  finish(conn);
+}
+
+
+// Deliver a fault
+void
+XmlRpcServerCompletion::fail(std::string const& message, int code)
+{
+  if ( ! claim()) return;
+
+  std::unique_lock<std::mutex> lock;
+  XmlRpcServerConnection* conn = lockTarget(lock);
+  if (conn)
+    conn->generateFaultResponse(message, code);
+  else {
+    _isFault = true;
+    _faultString = message;
+    _faultCode = code;
+  }
+  finish(conn);
+}
+
+
+// Block until the result is delivered
+void
+XmlRpcServerCompletion::wait(XmlRpcValue& result)
+{
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cond.wait(lock, [this]() { return _state.load() == DONE; });
+  }
+  if (_isFault)
+    throw XmlRpcException(_faultString, _faultCode);
+  result = std::move(_result);
+}
+
+
+// The connection stops monitoring its socket if the result is not in yet
+bool
+XmlRpcServerCompletion::park()
+{
+  // Without an event loop to resume in, the caller has to wait
+  if ( ! _target || ! _target->disp) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cond.wait(lock, [this]() { return _state.load() == DONE; });
+    return false;
+  }
+
+  int expected = PENDING;
+  return _state.compare_exchange_strong(expected, PARKED);
+}
+
+
+bool
+XmlRpcServerCompletion::claim()
+{
+  if (_claimed.exchange(true)) {
+    XmlRpcUtil::error("XmlRpcServerCompletion: result delivered more than once.");
+    return false;
+  }
+  return true;
+}
+
+
+// The connection stays locked until it is posted back to its event loop, so
+// that it is not closed in between
+XmlRpcServerConnection*
+XmlRpcServerCompletion::lockTarget(std::unique_lock<std::mutex>& lock)
+{
+  if ( ! _target)
+    return 0;
+  lock = std::unique_lock<std::mutex>(_target->mutex);
+  return _target->conn;
+}
+
+
+void
+XmlRpcServerCompletion::finish(XmlRpcServerConnection* conn)
+{
+  int prev;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    prev = _state.exchange(DONE);
+  }
+  _cond.notify_all();
+
+  // The connection went back to its event loop without a response
+  if (prev == PARKED && conn) {
+    _target->resumed = true;
+    _target->disp->post([conn]() { conn->resumeResponse(); });
+  }
+}
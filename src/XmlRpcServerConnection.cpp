@@ -1,10 +1,14 @@
 
 #include "XmlRpcServerConnection.h"
 
+#include "XmlRpcServerCompletion.h"
 #include "XmlRpcSocket.h"
+#include "XmlRpcThreadPool.h"
+#include "XmlRpcTokenizer.h"
 #include "XmlRpc.h"
 
 #ifndef MAKEDEPEND
+# include <memory_resource>
 # include <stdio.h>
 # include <stdlib.h>
 #include <strings.h>
@@ -32,36 +36,94 @@ const std::string XmlRpcServerConnection::FAULTSTRING = "faultString";
 
 // The server delegates handling client requests to a serverConnection object.
 XmlRpcServerConnection::XmlRpcServerConnection(int fd, XmlRpcServer* server, bool deleteOnClose /*= false*/) :
-  XmlRpcSource(fd, deleteOnClose)
+  XmlRpcSource(fd, deleteOnClose), _headerParser(server->getMaxHeaderSize()),
+  _deadline([this]() { deadlineExpired(); })
 {
   XmlRpcUtil::log(2,"XmlRpcServerConnection: new socket %d.", fd);
   _server = server;
+  _disp = 0;
   _connectionState = READ_HEADER;
   _keepAlive = true;
+  _responseStart = _responseEnd = "";
+  _responseLength = 0;
 }
 
 
 XmlRpcServerConnection::~XmlRpcServerConnection()
 {
   XmlRpcUtil::log(4,"XmlRpcServerConnection dtor.");
+  if (_parked) {
+    {
+      std::lock_guard<std::mutex> lock(_parked->mutex);
+      _parked->conn = 0;
+    }
+    _server->removeParkedConnection(this);
+  }
   _server->removeConnection(this);
 }
 
 
+void
+XmlRpcServerConnection::setDispatch(XmlRpcDispatch* disp)
+{
+  _disp = disp;
+  setDeadline(_server->getIdleTimeout());
+}
+
+
+// Timers run on the dispatcher's thread, like the event handlers
+void
+XmlRpcServerConnection::setDeadline(double seconds)
+{
+  if (seconds > 0.0 && _disp)
+    _disp->schedule(&_deadline, seconds);
+  else
+    _deadline.cancel();
+}
+
+
+void
+XmlRpcServerConnection::deadlineExpired()
+{
+  XmlRpcUtil::log(2, "XmlRpcServerConnection::deadlineExpired: %s timeout on socket %d.",
+                  (_connectionState == READ_REQUEST) ? "body" : (_headerParser.size() > 0) ? "header" : "idle",
+                  getfd());
+  _disp->removeSource(this);
+  if ( ! getKeepOpen())
+    close();
+}
+
+
 // Handle input on the server socket by accepting the connection
 // and reading the rpc request. Return true to continue to monitor
 // the socket for events, false to remove it from the dispatcher.
 unsigned
 XmlRpcServerConnection::handleEvent(unsigned /*eventType*/)
 {
-  if (_connectionState == READ_HEADER)
-    if ( ! readHeader()) return 0;
+  // Pipelined requests already read are processed without waiting for more input
+  do {
+    if (_connectionState == READ_HEADER)
+      if ( ! readHeader()) return 0;
+
+    if (_connectionState == READ_REQUEST)
+      if ( ! readRequest()) return 0;
+
+    // Methods run on the worker threads if the server has any
+    if (_connectionState == WRITE_RESPONSE && ! hasResponse() &&
+        _disp && _server->getWorkerPool()) {
+      executeOnWorker();
+      return XmlRpcDispatch::ReadableEvent;   // Ignored, the source was removed
+    }
 
-  if (_connectionState == READ_REQUEST)
-    if ( ! readRequest()) return 0;
+    if (_connectionState == WRITE_RESPONSE)
+      if ( ! writeResponse()) return 0;
 
-  if (_connectionState == WRITE_RESPONSE)
-    if ( ! writeResponse()) return 0;
+    // Waiting for an asynchronous method, the completion resumes the connection
+    if (_connectionState == EXECUTING) {
+      _disp->removeSource(this);
+      return XmlRpcDispatch::ReadableEvent;   // Ignored, the source was removed
+    }
+  } while (_connectionState == READ_HEADER && ! _pipelined.empty());
 
   return (_connectionState == WRITE_RESPONSE) 
         ? XmlRpcDispatch::WritableEvent : XmlRpcDispatch::ReadableEvent;
@@ -71,39 +133,45 @@ XmlRpcServerConnection::handleEvent(unsigned /*eventType*/)
 bool
 XmlRpcServerConnection::readHeader()
 {
-  // Read available data
-  bool eof;
-  if ( ! XmlRpcSocket::nbRead(this->getfd(), _header, &eof)) {
+  // Start with the data of pipelined requests, otherwise read available data
+  bool eof = false;
+  bool started = _headerParser.size() > 0;
+  if ( ! _pipelined.empty())
+    _header.swap(_pipelined);
+  else if ( ! XmlRpcSocket::nbRead(this->getfd(), _header, &eof)) {
     // Its only an error if we already have read some data
-    if (_header.length() > 0)
+    if (started || _header.length() > 0)
       XmlRpcUtil::error("XmlRpcServerConnection::readHeader: error while reading header (%s).",XmlRpcSocket::getErrorMsg().c_str());
     return false;
   }
 
   XmlRpcUtil::log(4, "XmlRpcServerConnection::readHeader: read %d bytes.", _header.length());
-  char *hp = (char*)_header.c_str();  // Start of header
-  char *ep = hp + _header.length();   // End of string
-  char *bp = 0;                       // Start of body
-  char *lp = 0;                       // Start of content-length value
-  char *kp = 0;                       // Start of connection value
-
-  for (char *cp = hp; (bp == 0) && (cp < ep); ++cp) {
-	if ((ep - cp > 16) && (strncasecmp(cp, "Content-length: ", 16) == 0))
-	  lp = cp + 16;
-	else if ((ep - cp > 12) && (strncasecmp(cp, "Connection: ", 12) == 0))
-	  kp = cp + 12;
-	else if ((ep - cp > 4) && (strncmp(cp, "\r\n\r\n", 4) == 0))
-	  bp = cp + 4;
-	else if ((ep - cp > 2) && (strncmp(cp, "\n\n", 2) == 0))
-	  bp = cp + 2;
+
+  // Only the new data is parsed, the parser remembers where it was
+  size_t consumed = 0;
+  XmlRpcHttpHeader::Status status = _headerParser.parse(_header.data(), _header.length(), &consumed);
+
+  // The idle timeout ends with the first bytes of a request
+  if ( ! started && _headerParser.size() > 0)
+    setDeadline(_server->getHeaderTimeout());
+
+  if (status == XmlRpcHttpHeader::TOO_LARGE) {
+    XmlRpcUtil::error("XmlRpcServerConnection::readHeader: header exceeds %d bytes.", int(_headerParser.getMaxSize()));
+    return false;
+  }
+  if (status == XmlRpcHttpHeader::INVALID) {
+    XmlRpcUtil::error("XmlRpcServerConnection::readHeader: invalid header field.");
+    return false;
   }
 
   // If we haven't gotten the entire header yet, return (keep reading)
-  if (bp == 0) {
+  if (status == XmlRpcHttpHeader::INCOMPLETE) {
+    _header.clear();
+
     // EOF in the middle of a request is an error, otherwise its ok
     if (eof) {
       XmlRpcUtil::log(4, "XmlRpcServerConnection::readHeader: EOF");
-      if (_header.length() > 0)
+      if (_headerParser.size() > 0)
         XmlRpcUtil::error("XmlRpcServerConnection::readHeader: EOF while reading header");
       return false;   // Either way we close the connection
     }
@@ -112,12 +180,12 @@ XmlRpcServerConnection::readHeader()
   }
 
   // Decode content length
-  if (lp == 0) {
+  if (_headerParser.contentLength() < 0) {
     XmlRpcUtil::error("XmlRpcServerConnection::readHeader: No Content-length specified");
     return false;   // We could try to figure it out by parsing as we read, but for now...
   }
 
-  _contentLength = atoi(lp);
+  _contentLength = int(_headerParser.contentLength());
   if (_contentLength <= 0) {
     XmlRpcUtil::error("XmlRpcServerConnection::readHeader: Invalid Content-length specified (%d).", _contentLength);
     return false;
@@ -126,22 +194,16 @@ XmlRpcServerConnection::readHeader()
   XmlRpcUtil::log(3, "XmlRpcServerConnection::readHeader: specified content length is %d.", _contentLength);
 
   // Otherwise copy non-header data to request buffer and set state to read request.
-  _request = bp;
+  _request.assign(_header, consumed, std::string::npos);
 
-  // Parse out any interesting bits from the header (HTTP version, connection)
-  _keepAlive = true;
-  if (_header.find("HTTP/1.0") != std::string::npos) {
-    if (kp == 0 || strncasecmp(kp, "keep-alive", 10) != 0)
-      _keepAlive = false;           // Default for HTTP 1.0 is to close the connection
-  } else {
-    if (kp != 0 && strncasecmp(kp, "close", 5) == 0)
-      _keepAlive = false;
-  }
+  // HTTP 1.0 closes the connection unless asked not to, 1.1 keeps it unless asked to close
+  _keepAlive = _headerParser.keepAlive();
   XmlRpcUtil::log(3, "KeepAlive: %d", _keepAlive);
 
-
-  _header = ""; 
+  _header.clear(); 
+  _headerParser.reset();
   _connectionState = READ_REQUEST;
+  setDeadline(_server->getBodyTimeout());
   return true;    // Continue monitoring this source
 }
 
@@ -166,11 +228,20 @@ XmlRpcServerConnection::readRequest()
     }
   }
 
+  // Data beyond the body belongs to the requests that follow, which are
+  // processed in order once this response has been written.
+  if (int(_request.length()) > _contentLength) {
+    _pipelined.assign(_request, _contentLength, std::string::npos);
+    _request.resize(_contentLength);
+    XmlRpcUtil::log(4, "XmlRpcServerConnection::readRequest: %d bytes of pipelined requests.", _pipelined.length());
+  }
+
   // Otherwise, parse and dispatch the request
   XmlRpcUtil::log(3, "XmlRpcServerConnection::readRequest read %d bytes.", _request.length());
   //XmlRpcUtil::log(5, "XmlRpcServerConnection::readRequest:\n%s\n", _request.c_str());
 
   _connectionState = WRITE_RESPONSE;
+  setDeadline(0.0);
 
   return true;    // Continue monitoring this source
 }
@@ -179,80 +250,243 @@ XmlRpcServerConnection::readRequest()
 bool
 XmlRpcServerConnection::writeResponse()
 {
-  if (_response.length() == 0) {
-    executeRequest();
+  if ( ! hasResponse()) {
+    if ( ! executeRequest()) {
+      _connectionState = EXECUTING;
+      return true;
+    }
     _bytesWritten = 0;
-    if (_response.length() == 0) {
+    if ( ! hasResponse()) {
       XmlRpcUtil::error("XmlRpcServerConnection::writeResponse: empty response.");
       return false;
     }
   }
 
   // Try to write the response
-  if ( ! XmlRpcSocket::nbWrite(this->getfd(), _response, &_bytesWritten)) {
+  XmlRpcSocket::Buffer bufs[4] = {
+    { _responseHeader.data(), _responseHeader.length() },
+    { _responseStart, strlen(_responseStart) },
+    { _responseValue.data(), _responseValue.length() },
+    { _responseEnd, strlen(_responseEnd) }
+  };
+  if ( ! XmlRpcSocket::nbWrite(this->getfd(), bufs, 4, &_bytesWritten)) {
     XmlRpcUtil::error("XmlRpcServerConnection::writeResponse: write error (%s).",XmlRpcSocket::getErrorMsg().c_str());
     return false;
   }
-  XmlRpcUtil::log(3, "XmlRpcServerConnection::writeResponse: wrote %d of %d bytes.", _bytesWritten, _response.length());
+  XmlRpcUtil::log(3, "XmlRpcServerConnection::writeResponse: wrote %d of %d bytes.", _bytesWritten, _responseLength);
 
   // Prepare to read the next request
-  if (_bytesWritten == int(_response.length())) {
+  if (_bytesWritten == _responseLength) {
     _header = "";
     _request = "";
-    _response = "";
+    clearResponse();
     _connectionState = READ_HEADER;
+    setDeadline(_server->getIdleTimeout());
   }
 
   return _keepAlive;    // Continue monitoring this source if true
 }
 
-// Run the method, generate _response string
+// Stop monitoring the connection and run the method on a worker thread.
+// The response is written from the event loop when the worker is done.
+void
+XmlRpcServerConnection::executeOnWorker()
+{
+  _connectionState = EXECUTING;
+  XmlRpcDispatch* disp = _disp;
+  disp->removeSource(this);
+
+  _server->getWorkerPool()->submit([this, disp]() {
+    bool ready = true;
+    try {
+      ready = executeRequest();
+    } catch (const std::exception& e) {
+      generateFaultResponse(std::string("XmlRpcServerConnection: ") + e.what());
+    }
+    if (ready)
+      disp->post([this]() { resumeResponse(); });
+  });
+}
+
+
+// Start writing the response generated by a worker thread
 void
+XmlRpcServerConnection::resumeResponse()
+{
+  if (_parked) {
+    _server->removeParkedConnection(this);
+    _parked.reset();
+  }
+
+  _connectionState = WRITE_RESPONSE;
+  _bytesWritten = 0;
+  if ( ! hasResponse()) {
+    XmlRpcUtil::error("XmlRpcServerConnection::resumeResponse: empty response.");
+    if ( ! getKeepOpen())
+      close();
+    return;
+  }
+
+  unsigned newMask = handleEvent(XmlRpcDispatch::WritableEvent);
+  if (newMask == 0) {
+    if ( ! getKeepOpen())
+      close();
+  }
+  // A pipelined request may have gone to a worker or be waiting for its
+  // result, in which case the connection is resumed again when it is done
+  else if (_connectionState == READ_HEADER || _connectionState == WRITE_RESPONSE)
+    _disp->addSource(this, newMask);
+}
+
+
+// Run the method, generate the response
+bool
 XmlRpcServerConnection::executeRequest()
 {
-  XmlRpcValue params, resultValue;
-  std::string methodName = parseRequest(params);
+  int offset = 0;   // Number of chars parsed from the request
+  std::string methodName = parseMethodName(&offset);
   XmlRpcUtil::log(2, "XmlRpcServerConnection::executeRequest: server calling method '%s'", 
                     methodName.c_str());
 
+  XmlRpcServerMethod* method = _server->findMethod(methodName);
+  if (method && executeStreamed(method, offset))
+    return true;
+
+  // The parameters are allocated from an arena released in one go with them,
+  // and refer to the request text. Both are kept by the completions of the
+  // methods, so methods may keep the parameters.
+  std::shared_ptr<XmlRpcServerCompletion::Request> request =
+    std::make_shared<XmlRpcServerCompletion::Request>(std::move(_request));
+  _request.clear();
+  XmlRpcValue::ValueArray args(&request->arena);
+  XmlRpcValue params(std::move(args)), resultValue;
+  if ( ! parseParams(request->xml, offset, params, &request->arena)) {
+    generateFaultResponse(methodName + ": invalid parameters");
+    return true;
+  }
+
+  if (method)
+    return executeAsync(method, params, request);
+
+  _executing = request;
   try {
 
     if ( ! executeMethod(methodName, params, resultValue) &&
          ! executeMulticall(methodName, params, resultValue))
       generateFaultResponse(methodName + ": unknown method name");
     else
-      generateResponse(resultValue.toXml());
+      generateResponse(resultValue);
 
   } catch (const XmlRpcException& fault) {
     XmlRpcUtil::log(2, "XmlRpcServerConnection::executeRequest: fault %s.",
                     fault.getMessage().c_str()); 
     generateFaultResponse(fault.getMessage(), fault.getCode());
   }
+  _executing.reset();
+  return true;
 }
 
-// Parse the method name and the argument values from the request.
-std::string
-XmlRpcServerConnection::parseRequest(XmlRpcValue& params)
+// Let a method read its parameters straight from the request.
+bool
+XmlRpcServerConnection::executeStreamed(XmlRpcServerMethod* method, int offset)
 {
-  int offset = 0;   // Number of chars parsed from the request
+  XmlRpcParser parser(_request, offset, XmlRpcParser::ParamsXml);
+  XmlRpcValue resultValue;
+  try {
+    if ( ! method->executeStreamed(parser, resultValue))
+      return false;
+    generateResponse(resultValue);
+  } catch (const XmlRpcException& fault) {
+    XmlRpcUtil::log(2, "XmlRpcServerConnection::executeStreamed: fault %s.",
+                    fault.getMessage().c_str()); 
+    generateFaultResponse(fault.getMessage(), fault.getCode());
+  }
+  return true;
+}
+
+// Start a method that may deliver its result from another thread.
+bool
+XmlRpcServerConnection::executeAsync(XmlRpcServerMethod* method, XmlRpcValue& params,
+                                     std::shared_ptr<XmlRpcServerCompletion::Request> const& request)
+{
+  std::shared_ptr<XmlRpcServerCompletion> done(new XmlRpcServerCompletion(this, _disp, request));
+  try {
+    method->executeAsync(params, done);
+  } catch (const XmlRpcException& fault) {
+    XmlRpcUtil::log(2, "XmlRpcServerConnection::executeAsync: fault %s.",
+                    fault.getMessage().c_str()); 
+    done->fail(fault.getMessage(), fault.getCode());
+  }
+  if (done->isDone())
+    return true;
+
+  // The connection is in no dispatcher while it waits, the server keeps track
+  // of it so that it can be closed on shutdown
+  _parked = done->getTarget();
+  _server->addParkedConnection(this);
+  if (done->park())
+    return false;
+
+  _server->removeParkedConnection(this);
+  _parked.reset();
+  return true;
+}
 
-  std::string methodName = XmlRpcUtil::parseTag(METHODNAME_TAG, _request, &offset);
 
-  if (methodName.size() > 0 && XmlRpcUtil::findTag(PARAMS_TAG, _request, &offset))
+// The result can no longer be delivered once the connection is detached from it
+void
+XmlRpcServerConnection::closeParked()
+{
+  if ( ! _parked)
+    return;
   {
-    int nArgs = 0;
-    while (XmlRpcUtil::nextTagIs(PARAM_TAG, _request, &offset)) {
-      params[nArgs++] = XmlRpcValue(_request, &offset);
-      (void) XmlRpcUtil::nextTagIs(PARAM_ETAG, _request, &offset);
-    }
+    std::lock_guard<std::mutex> lock(_parked->mutex);
+    if (_parked->resumed)
+      return;     // The connection is posted back to its dispatcher
+    _parked->conn = 0;
+  }
+  _parked.reset();
+  close();
+}
 
-    (void) XmlRpcUtil::nextTagIs(PARAMS_ETAG, _request, &offset);
+// The method name is the text of the <methodName> element.
+std::string
+XmlRpcServerConnection::parseMethodName(int* offset)
+{
+  XmlRpcTokenizer tokens(_request.data(), _request.length());
+  XmlRpcTokenizer::Token token;
+  while ((token = tokens.next()) != XmlRpcTokenizer::End && token != XmlRpcTokenizer::Error) {
+    if (token != XmlRpcTokenizer::StartTag || tokens.getName() != METHODNAME)
+      continue;
+
+    std::string_view name;
+    bool encoded = false;
+    if (tokens.next() == XmlRpcTokenizer::Text) {
+      name = tokens.getText();
+      encoded = tokens.isEncoded();
+      tokens.next();
+    }
+    if (tokens.getToken() != XmlRpcTokenizer::EndTag || tokens.getName() != METHODNAME)
+      break;
+    *offset = int(tokens.getOffset());
+    return encoded ? XmlRpcUtil::xmlDecode(name) : std::string(name);
   }
+  return std::string();
+}
 
-  return methodName;
+// Parse the argument values following the method name, into an array.
+// String arguments refer to the request text, and arrays, structs and binary data
+// are only parsed if the method uses them.
+bool
+XmlRpcServerConnection::parseParams(std::string const& xml, int offset, XmlRpcValue& params,
+                                    std::pmr::memory_resource* arena)
+{
+  XmlRpcParser parser(xml, offset, XmlRpcParser::ParamsXml);
+  return params.fromXml(parser, arena, XmlRpcValue::BorrowStrings | XmlRpcValue::DeferContainers);
 }
 
-// Execute a named method with the specified params.
+// Execute a named method with the specified params. Waiting for a result
+// that is still to come would hold up the event loop, so those calls fail.
 bool
 XmlRpcServerConnection::executeMethod(const std::string& methodName, 
                                       XmlRpcValue& params, XmlRpcValue& result)
@@ -261,7 +495,11 @@ XmlRpcServerConnection::executeMethod(const std::string& methodName,
 
   if ( ! method) return false;
 
-  method->execute(params, result);
+  std::shared_ptr<XmlRpcServerCompletion> done(new XmlRpcServerCompletion(_executing));
+  method->executeAsync(params, done);
+  if ( ! done->isDone())
+    throw XmlRpcException(methodName + ": asynchronous method not supported in " + SYSTEM_MULTICALL);
+  done->wait(result);
 
   // Ensure a valid result value
   if ( ! result.valid())
@@ -307,7 +545,7 @@ XmlRpcServerConnection::executeMulticall(const std::string& methodName,
         result[i][FAULTSTRING] = methodName + ": unknown method name";
       }
       else
-        result[i] = resultValue;
+        result[i].swap(resultValue);
 
     } catch (const XmlRpcException& fault) {
         result[i][FAULTCODE] = fault.getCode();
@@ -319,57 +557,78 @@ XmlRpcServerConnection::executeMulticall(const std::string& methodName,
 }
 
 
-// Create a response from results xml
-void
-XmlRpcServerConnection::generateResponse(std::string const& resultXml)
-{
-  const char RESPONSE_1[] = 
-    "<?xml version=\"1.0\"?>\r\n"
-    "<methodResponse><params><param>\r\n\t";
-  const char RESPONSE_2[] =
-    "\r\n</param></params></methodResponse>\r\n";
+// Envelopes of responses, around the xml of the value
+static const char RESPONSE_1[] = 
+  "<?xml version=\"1.0\"?>\r\n"
+  "<methodResponse><params><param>\r\n\t";
+static const char RESPONSE_2[] =
+  "\r\n</param></params></methodResponse>\r\n";
+static const char FAULT_RESPONSE_1[] = 
+  "<?xml version=\"1.0\"?>\r\n"
+  "<methodResponse><fault>\r\n\t";
+static const char FAULT_RESPONSE_2[] =
+  "\r\n</fault></methodResponse>\r\n";
 
-  std::string body = RESPONSE_1 + resultXml + RESPONSE_2;
-  std::string header = generateHeader(body);
+// HTTP header up to the value of the content length
+static const std::string HEADER_PREFIX = std::string(
+  "HTTP/1.1 200 OK\r\n"
+  "Server: ") + XMLRPC_VERSION + "\r\n"
+  "Content-Type: text/xml\r\n"
+  "Content-length: ";
 
-  _response = header + body;
-  XmlRpcUtil::log(5, "XmlRpcServerConnection::generateResponse:\n%s\n", _response.c_str()); 
-}
 
-// Prepend http headers
-std::string
-XmlRpcServerConnection::generateHeader(std::string const& body)
+// Create a response from the result
+void
+XmlRpcServerConnection::generateResponse(XmlRpcValue const& result)
 {
-  std::string header = 
-    "HTTP/1.1 200 OK\r\n"
-    "Server: ";
-  header += XMLRPC_VERSION;
-  header += "\r\n"
-    "Content-Type: text/xml\r\n"
-    "Content-length: ";
+  _responseStart = RESPONSE_1;
+  _responseValue.clear();
+  if (result.valid()) {
+    _responseValue.reserve(result.estimateXmlSize());
+    result.toXml(_responseValue);
+  } else
+    XmlRpcValue(std::string()).toXml(_responseValue);
+  _responseEnd = RESPONSE_2;
+  generateHeader(sizeof(RESPONSE_1)-1 + _responseValue.length() + sizeof(RESPONSE_2)-1);
+
+  XmlRpcUtil::log(5, "XmlRpcServerConnection::generateResponse:\n%s%s%s%s\n",
+                  _responseHeader.c_str(), _responseStart, _responseValue.c_str(), _responseEnd); 
+}
 
+// Generate the http header for a body of the given length
+void
+XmlRpcServerConnection::generateHeader(size_t contentLength)
+{
   char buffLen[40];
-  sprintf(buffLen,"%lu\r\n\r\n", body.size());
+  sprintf(buffLen,"%lu\r\n\r\n", (unsigned long) contentLength);
 
-  return header + buffLen;
+  _responseHeader = HEADER_PREFIX;
+  _responseHeader += buffLen;
+  _responseLength = int(_responseHeader.length() + contentLength);
 }
 
 
 void
 XmlRpcServerConnection::generateFaultResponse(std::string const& errorMsg, int errorCode)
 {
-  const char RESPONSE_1[] = 
-    "<?xml version=\"1.0\"?>\r\n"
-    "<methodResponse><fault>\r\n\t";
-  const char RESPONSE_2[] =
-    "\r\n</fault></methodResponse>\r\n";
-
   XmlRpcValue faultStruct;
   faultStruct[FAULTCODE] = errorCode;
   faultStruct[FAULTSTRING] = errorMsg;
-  std::string body = RESPONSE_1 + faultStruct.toXml() + RESPONSE_2;
-  std::string header = generateHeader(body);
 
-  _response = header + body;
+  _responseStart = FAULT_RESPONSE_1;
+  _responseValue.clear();
+  faultStruct.toXml(_responseValue);
+  _responseEnd = FAULT_RESPONSE_2;
+  generateHeader(sizeof(FAULT_RESPONSE_1)-1 + _responseValue.length() + sizeof(FAULT_RESPONSE_2)-1);
+}
+
+
+void
+XmlRpcServerConnection::clearResponse()
+{
+  _responseHeader.clear();
+  std::string().swap(_responseValue);   // Do not hold on to a large result
+  _responseStart = _responseEnd = "";
+  _responseLength = 0;
 }
 
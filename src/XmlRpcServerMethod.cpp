@@ -1,11 +1,15 @@
 
 #include "XmlRpcServerMethod.h"
 #include "XmlRpcServer.h"
+#include "XmlRpcServerCompletion.h"
+#include "XmlRpcParser.h"
+#include "XmlRpcException.h"
 
 namespace XmlRpc {
 
 
-  XmlRpcServerMethod::XmlRpcServerMethod(std::string const& name, XmlRpcServer* server)
+  XmlRpcServerMethod::XmlRpcServerMethod(std::string const& name, XmlRpcServer* server) :
+    _asyncNotOverridden(false)
   {
     _name = name;
     _server = server;
@@ -18,4 +22,34 @@ namespace XmlRpc {
   }
 
 
+  void
+  XmlRpcServerMethod::execute(XmlRpcValue& params, XmlRpcValue& result)
+  {
+    // Neither execute nor executeAsync is overridden
+    if (_asyncNotOverridden.load())
+      throw XmlRpcException(_name + ": method not implemented");
+
+    std::shared_ptr<XmlRpcServerCompletion> done(new XmlRpcServerCompletion());
+    executeAsync(params, done);
+    done->wait(result);
+  }
+
+
+  void
+  XmlRpcServerMethod::executeAsync(XmlRpcValue& params, std::shared_ptr<XmlRpcServerCompletion> done)
+  {
+    _asyncNotOverridden = true;
+    XmlRpcValue result;
+    execute(params, result);
+    done->complete(std::move(result));
+  }
+
+
+  bool
+  XmlRpcServerMethod::executeStreamed(XmlRpcParser&, XmlRpcValue&)
+  {
+    return false;
+  }
+
+
 } // namespace XmlRpc
@@ -22,7 +22,9 @@ extern "C" {
 # include <stdio.h>
 # include <sys/types.h>
 # include <sys/socket.h>
+# include <sys/uio.h>
 # include <netinet/in.h>
+# include <netinet/tcp.h>
 # include <netdb.h>
 # include <errno.h>
 # include <fcntl.h>
@@ -59,9 +61,9 @@ static void initWinSock()
 
 // These errors are not considered fatal for an IO operation; the operation will be re-tried.
 
-static inline bool
+bool
 
-nonFatalError()
+XmlRpcSocket::nonFatalError()
 
 {
 
@@ -119,6 +121,29 @@ XmlRpcSocket::setReuseAddr(int fd)
 }
 
 
+bool
+XmlRpcSocket::setReusePort(int fd)
+{
+#if defined(SO_REUSEPORT)
+  int sflag = 1;
+  return (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (const char *)&sflag, sizeof(sflag)) == 0);
+#else
+  return false;
+#endif
+}
+
+
+bool
+XmlRpcSocket::setDeferAccept(int fd, int seconds)
+{
+#if defined(TCP_DEFER_ACCEPT)
+  return (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, (const char *)&seconds, sizeof(seconds)) == 0);
+#else
+  return false;
+#endif
+}
+
+
 // Bind to a specified port
 bool 
 XmlRpcSocket::bind(int fd, int port)
@@ -155,6 +180,29 @@ XmlRpcSocket::accept(int fd)
 }
 
 
+int
+XmlRpcSocket::acceptNonBlocking(int fd)
+{
+#if defined(__linux__)
+  // One system call instead of accept + fcntl
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  return ::accept4(fd, (struct sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  int s = accept(fd);
+  if (s >= 0 && ! setNonBlocking(s)) {
+    close(s);
+    return -1;
+  }
+# if !defined(_WINDOWS)
+  if (s >= 0)
+    fcntl(s, F_SETFD, FD_CLOEXEC);
+# endif
+  return s;
+#endif
+}
+
+
     
 // Connect a socket to a server (from a client)
 bool
@@ -243,6 +291,57 @@ XmlRpcSocket::nbWrite(int fd, std::string& s, int *bytesSoFar)
 }
 
 
+// Write several buffers to the specified socket. Returns false on error.
+bool
+XmlRpcSocket::nbWrite(int fd, const Buffer* bufs, int nBufs, int *bytesSoFar)
+{
+  const int MAX_BUFS = 16;
+
+  while (true) {
+    // Skip what has already been written
+#if defined(_WINDOWS)
+    WSABUF iov[MAX_BUFS];
+#else
+    struct iovec iov[MAX_BUFS];
+#endif
+    int nIov = 0;
+    size_t skip = size_t(*bytesSoFar);
+    for (int i=0; i<nBufs && nIov<MAX_BUFS; ++i) {
+      if (skip >= bufs[i].length) {
+        skip -= bufs[i].length;
+        continue;
+      }
+#if defined(_WINDOWS)
+      iov[nIov].buf = const_cast<char*>(bufs[i].data) + skip;
+      iov[nIov].len = ULONG(bufs[i].length - skip);
+#else
+      iov[nIov].iov_base = const_cast<char*>(bufs[i].data) + skip;
+      iov[nIov].iov_len = bufs[i].length - skip;
+#endif
+      skip = 0;
+      ++nIov;
+    }
+    if (nIov == 0)
+      return true;    // All written
+
+#if defined(_WINDOWS)
+    DWORD sent = 0;
+    int n = (WSASend(fd, iov, nIov, &sent, 0, NULL, NULL) == 0) ? int(sent) : -1;
+#else
+    int n = int(::writev(fd, iov, nIov));
+#endif
+    XmlRpcUtil::log(5, "XmlRpcSocket::nbWrite: writev returned %d.", n);
+
+    if (n > 0)
+      *bytesSoFar += n;
+    else if (nonFatalError())
+      return true;    // Would block
+    else
+      return false;   // Error
+  }
+}
+
+
 // Returns last errno
 int 
 XmlRpcSocket::getError()
@@ -0,0 +1,67 @@
+
+#include "XmlRpcThreadPool.h"
+#include "XmlRpcUtil.h"
+
+using namespace XmlRpc;
+
+
+XmlRpcThreadPool::XmlRpcThreadPool(int nThreads) : _stopping(false)
+{
+  for (int i=0; i<nThreads; ++i)
+    _threads.push_back(std::thread(&XmlRpcThreadPool::run, this));
+  XmlRpcUtil::log(2, "XmlRpcThreadPool: started %d threads.", nThreads);
+}
+
+
+XmlRpcThreadPool::~XmlRpcThreadPool()
+{
+  shutdown();
+}
+
+
+// Queue a task for the worker threads
+void
+XmlRpcThreadPool::submit(std::function<void()> const& task)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tasks.push_back(task);
+  }
+  _cond.notify_one();
+}
+
+
+// Let the workers finish the queued tasks, then wait for them to exit
+void
+XmlRpcThreadPool::shutdown()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _cond.notify_all();
+
+  for (size_t i=0; i<_threads.size(); ++i)
+    if (_threads[i].joinable())
+      _threads[i].join();
+  _threads.clear();
+}
+
+
+void
+XmlRpcThreadPool::run()
+{
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while ( ! _stopping && _tasks.empty())
+        _cond.wait(lock);
+      if (_tasks.empty())
+        return;       // Stopping and nothing left to do
+      task.swap(_tasks.front());
+      _tasks.pop_front();
+    }
+    task();
+  }
+}
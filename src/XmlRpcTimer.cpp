@@ -0,0 +1,25 @@
+
+#include "XmlRpcTimer.h"
+#include "XmlRpcDispatch.h"
+
+using namespace XmlRpc;
+
+
+XmlRpcTimer::XmlRpcTimer(std::function<void()> const& callback) :
+  _callback(callback), _disp(0), _expires(0), _interval(0), _prev(0), _next(0)
+{
+}
+
+
+XmlRpcTimer::~XmlRpcTimer()
+{
+  cancel();
+}
+
+
+void
+XmlRpcTimer::cancel()
+{
+  if (_disp)
+    _disp->cancel(this);
+}
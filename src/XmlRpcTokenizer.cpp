@@ -0,0 +1,137 @@
+
+#include "XmlRpcTokenizer.h"
+
+#ifndef MAKEDEPEND
+# include <string.h>
+#endif
+
+namespace XmlRpc {
+
+
+  static inline bool isXmlSpace(char c)
+  {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+  }
+
+
+  XmlRpcTokenizer::XmlRpcTokenizer(const char* data, size_t length, size_t offset) :
+    _data(data), _length(length), _offset(offset < length ? offset : length), _tokenOffset(_offset),
+    _token(End), _emptyElement(false)
+  {
+  }
+
+
+  bool XmlRpcTokenizer::isEncoded() const
+  {
+    return memchr(_text.data(), '&', _text.size()) != 0;
+  }
+
+  bool XmlRpcTokenizer::isBlank() const
+  {
+    for (char c : _text)
+      if ( ! isXmlSpace(c))
+        return false;
+    return true;
+  }
+
+
+  // Text runs up to the next '<'
+  XmlRpcTokenizer::Token XmlRpcTokenizer::next()
+  {
+    if (_token == Error)
+      return Error;
+
+    if (_emptyElement) {
+      _emptyElement = false;
+      return _token = EndTag;
+    }
+
+    for (;;) {
+      _tokenOffset = _offset;
+      if (_offset >= _length)
+        return _token = End;
+
+      if (_data[_offset] == '<') {
+        if (_offset + 1 < _length && (_data[_offset+1] == '?' || _data[_offset+1] == '!')) {
+          if ( ! skipMarkup())
+            return _token = Error;
+          continue;
+        }
+        return readTag();
+      }
+
+      const char* text = _data + _offset;
+      const char* end = (const char*) memchr(text, '<', _length - _offset);
+      if ( ! end)
+        end = _data + _length;
+      _text = std::string_view(text, end - text);
+      _offset = end - _data;
+      return _token = Text;
+    }
+  }
+
+
+  // The chars at _offset are "<" followed by a name, or "</" followed by a name
+  XmlRpcTokenizer::Token XmlRpcTokenizer::readTag()
+  {
+    const char* cp = _data + _offset + 1;
+    const char* end = _data + _length;
+
+    Token token = StartTag;
+    if (cp < end && *cp == '/') {
+      token = EndTag;
+      ++cp;
+    }
+
+    const char* name = cp;
+    while (cp < end && *cp != '>' && *cp != '/' && ! isXmlSpace(*cp))
+      ++cp;
+    if (cp == name)
+      return _token = Error;
+    _name = std::string_view(name, cp - name);
+
+    // Skip attributes, which may contain '>' or '/' in quotes
+    char quote = 0;
+    for ( ; cp < end; ++cp) {
+      if (quote) {
+        if (*cp == quote) quote = 0;
+      }
+      else if (*cp == '"' || *cp == '\'')
+        quote = *cp;
+      else if (*cp == '>')
+        break;
+    }
+    if (cp == end)
+      return _token = Error;     // Not terminated
+
+    _emptyElement = (token == StartTag && cp[-1] == '/');
+    _offset = cp + 1 - _data;
+    return _token = token;
+  }
+
+
+  // Comments end with "-->", other markup with '>'. CDATA sections are not supported.
+  bool XmlRpcTokenizer::skipMarkup()
+  {
+    static const char CDATA[] = "<![CDATA[";
+    static const char COMMENT[] = "<!--";
+
+    const char* cp = _data + _offset;
+    size_t left = _length - _offset;
+    const char* stop = ">";
+    if (left >= sizeof(CDATA) - 1 && memcmp(cp, CDATA, sizeof(CDATA) - 1) == 0)
+      return false;
+    if (left >= sizeof(COMMENT) - 1 && memcmp(cp, COMMENT, sizeof(COMMENT) - 1) == 0) {
+      stop = "-->";
+      cp += sizeof(COMMENT) - 1;
+    }
+
+    std::string_view rest(cp, _data + _length - cp);
+    size_t pos = rest.find(stop);
+    if (pos == std::string_view::npos)
+      return false;
+    _offset = (cp - _data) + pos + strlen(stop);
+    return true;
+  }
+
+} // namespace XmlRpc
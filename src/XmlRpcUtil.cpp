@@ -6,9 +6,20 @@
 # include <iostream>
 # include <stdarg.h>
 # include <stdio.h>
+# include <stdlib.h>
 # include <string.h>
 #endif
 
+// SSE2 is always there on x86-64, AVX2 is used if the cpu has it
+#if defined(__GNUC__) && defined(__x86_64__)
+# define XMLRPC_SIMD_X86 1
+# ifndef MAKEDEPEND
+#  include <immintrin.h>
+# endif
+#else
+# define XMLRPC_SIMD_X86 0
+#endif
+
 #include "XmlRpc.h"
 
 using namespace XmlRpc;
@@ -181,39 +192,211 @@ static const char* xmlEntity[] = { "lt;", "gt;", "amp;", "apos;", "quot;", 0 };
 static const int   xmlEntLen[] = { 3,     3,     4,      5,       5 };
 
 
+// Chars to encode are looked for 16 bytes at a time with SSE2, or 32 with
+// AVX2 when the cpu has it, and one at a time elsewhere.
+
+// Number of chars an encoded char adds (0 if it is not encoded)
+static inline size_t
+entityExtra(char c)
+{
+  switch (c) {
+    case '<': case '>':   return 3;
+    case '&':             return 4;
+    case '\'': case '\"': return 5;
+    default:              return 0;
+  }
+}
+
+static size_t
+findEntityScalar(const char* cp, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    if (entityExtra(cp[i]))
+      return i;
+  return n;
+}
+
+static size_t
+encodedExtraScalar(const char* cp, size_t n)
+{
+  size_t extra = 0;
+  for (size_t i = 0; i < n; ++i)
+    extra += entityExtra(cp[i]);
+  return extra;
+}
+
+#if XMLRPC_SIMD_X86
+
+// Each byte of c3, c4 and c5 is set where the block has a char that encoding
+// lengthens by 3, 4 and 5 chars.
+static inline void
+entityCharsSse2(const char* cp, __m128i& c3, __m128i& c4, __m128i& c5)
+{
+  __m128i block = _mm_loadu_si128((const __m128i*) cp);
+  c3 = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('<')), _mm_cmpeq_epi8(block, _mm_set1_epi8('>')));
+  c4 = _mm_cmpeq_epi8(block, _mm_set1_epi8('&'));
+  c5 = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\'')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\"')));
+}
+
+static size_t
+findEntitySse2(const char* cp, size_t n)
+{
+  size_t i = 0;
+  for ( ; i + 16 <= n; i += 16) {
+    __m128i c3, c4, c5;
+    entityCharsSse2(cp + i, c3, c4, c5);
+    if (unsigned m = _mm_movemask_epi8(_mm_or_si128(c3, _mm_or_si128(c4, c5))))
+      return i + __builtin_ctz(m);
+  }
+  return i + findEntityScalar(cp + i, n - i);
+}
+
+// The extra length of each char is summed in bytes, which can take 51
+// blocks of at most 5 before they are added up.
+static size_t
+encodedExtraSse2(const char* cp, size_t n)
+{
+  size_t extra = 0, i = 0;
+  while (i + 16 <= n) {
+    __m128i sum = _mm_setzero_si128();
+    for (int k = 0; k < 51 && i + 16 <= n; ++k, i += 16) {
+      __m128i c3, c4, c5;
+      entityCharsSse2(cp + i, c3, c4, c5);
+      sum = _mm_add_epi8(sum, _mm_or_si128(_mm_and_si128(c3, _mm_set1_epi8(3)),
+                              _mm_or_si128(_mm_and_si128(c4, _mm_set1_epi8(4)),
+                                           _mm_and_si128(c5, _mm_set1_epi8(5)))));
+    }
+    __m128i sums = _mm_sad_epu8(sum, _mm_setzero_si128());
+    extra += _mm_cvtsi128_si64(sums) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+  }
+  return extra + encodedExtraScalar(cp + i, n - i);
+}
+
+__attribute__((target("avx2"))) static inline void
+entityCharsAvx2(const char* cp, __m256i& c3, __m256i& c4, __m256i& c5)
+{
+  __m256i block = _mm256_loadu_si256((const __m256i*) cp);
+  c3 = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('<')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('>')));
+  c4 = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('&'));
+  c5 = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\'')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\"')));
+}
+
+// The rest is left to the SSE2 scan, after clearing the upper halves of the
+// registers so that mixing the instruction sets costs nothing.
+__attribute__((target("avx2"))) static size_t
+findEntityAvx2(const char* cp, size_t n)
+{
+  size_t i = 0;
+  for ( ; i + 32 <= n; i += 32) {
+    __m256i c3, c4, c5;
+    entityCharsAvx2(cp + i, c3, c4, c5);
+    if (unsigned m = _mm256_movemask_epi8(_mm256_or_si256(c3, _mm256_or_si256(c4, c5))))
+      return i + __builtin_ctz(m);
+  }
+  _mm256_zeroupper();
+  return i + findEntitySse2(cp + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+encodedExtraAvx2(const char* cp, size_t n)
+{
+  size_t extra = 0, i = 0;
+  while (i + 32 <= n) {
+    __m256i sum = _mm256_setzero_si256();
+    for (int k = 0; k < 51 && i + 32 <= n; ++k, i += 32) {
+      __m256i c3, c4, c5;
+      entityCharsAvx2(cp + i, c3, c4, c5);
+      sum = _mm256_add_epi8(sum, _mm256_or_si256(_mm256_and_si256(c3, _mm256_set1_epi8(3)),
+                                 _mm256_or_si256(_mm256_and_si256(c4, _mm256_set1_epi8(4)),
+                                                 _mm256_and_si256(c5, _mm256_set1_epi8(5)))));
+    }
+    __m256i sums = _mm256_sad_epu8(sum, _mm256_setzero_si256());
+    extra += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+             _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+  }
+  _mm256_zeroupper();
+  return extra + encodedExtraSse2(cp + i, n - i);
+}
+
+#endif // XMLRPC_SIMD_X86
+
+
+// The scans for the cpu we are running on, chosen on first use. The
+// XMLRPC_SIMD environment variable (scalar, sse2, ssse3 or avx2) limits the
+// instructions used, so that tests can compare the scans.
+struct EntityScans {
+  size_t (*findEntity)(const char* cp, size_t n);
+  size_t (*encodedExtra)(const char* cp, size_t n);
+};
+
+static EntityScans
+chooseEntityScans()
+{
+  const char* simd = getenv("XMLRPC_SIMD");
+  std::string_view limit = simd ? simd : "";
+  if (limit == "scalar")
+    return EntityScans{ findEntityScalar, encodedExtraScalar };
+#if XMLRPC_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && limit != "sse2" && limit != "ssse3")
+    return EntityScans{ findEntityAvx2, encodedExtraAvx2 };
+  return EntityScans{ findEntitySse2, encodedExtraSse2 };
+#else
+  return EntityScans{ findEntityScalar, encodedExtraScalar };
+#endif
+}
+
+static EntityScans const&
+entityScans()
+{
+  static const EntityScans scans = chooseEntityScans();
+  return scans;
+}
+
+
 // Replace xml-encoded entities with the raw text equivalents.
+// Text between entities is copied in one go.
 
-std::string 
-XmlRpcUtil::xmlDecode(const std::string& encoded)
-{
-  std::string::size_type iAmp = encoded.find(AMP);
-  if (iAmp == std::string::npos)
-    return encoded;
-
-  std::string decoded(encoded, 0, iAmp);
-  std::string::size_type iSize = encoded.size();
-  decoded.reserve(iSize);
-
-  const char* ens = encoded.c_str();
-  while (iAmp != iSize) {
-    if (encoded[iAmp] == AMP && iAmp+1 < iSize) {
-      int iEntity;
-      for (iEntity=0; xmlEntity[iEntity] != 0; ++iEntity)
-	//if (encoded.compare(iAmp+1, xmlEntLen[iEntity], xmlEntity[iEntity]) == 0)
-	if (strncmp(ens+iAmp+1, xmlEntity[iEntity], xmlEntLen[iEntity]) == 0)
-        {
-          decoded += rawEntity[iEntity];
-          iAmp += xmlEntLen[iEntity]+1;
-          break;
-        }
-      if (xmlEntity[iEntity] == 0)    // unrecognized sequence
-        decoded += encoded[iAmp++];
-
-    } else {
-      decoded += encoded[iAmp++];
+std::string
+XmlRpcUtil::xmlDecode(std::string_view encoded)
+{
+  const char* cp = encoded.data();
+  const char* end = cp + encoded.size();
+  const char* amp = (const char*) memchr(cp, AMP, encoded.size());
+  if ( ! amp)
+    return std::string(encoded);
+
+  std::string decoded(encoded.size(), '\0');   // Never longer than the encoded text
+  char* out = &decoded[0];
+
+  for (;;) {
+    memcpy(out, cp, amp - cp);
+    out += amp - cp;
+    cp = amp + 1;
+
+    int iEntity = -1;
+    switch (cp < end ? *cp : 0) {
+      case 'l': iEntity = 0; break;
+      case 'g': iEntity = 1; break;
+      case 'a': iEntity = (end - cp > 1 && cp[1] == 'm') ? 2 : 3; break;
+      case 'q': iEntity = 4; break;
+      default:  break;
     }
+    if (iEntity >= 0 && size_t(end - cp) >= size_t(xmlEntLen[iEntity]) &&
+        memcmp(cp, xmlEntity[iEntity], xmlEntLen[iEntity]) == 0) {
+      *out++ = rawEntity[iEntity];
+      cp += xmlEntLen[iEntity];
+    } else        // unrecognized sequence
+      *out++ = AMP;
+
+    amp = (const char*) memchr(cp, AMP, end - cp);
+    if ( ! amp)
+      break;
   }
-    
+
+  memcpy(out, cp, end - cp);
+  out += end - cp;
+  decoded.resize(out - decoded.data());
   return decoded;
 }
 
@@ -221,30 +404,51 @@ XmlRpcUtil::xmlDecode(const std::string& encoded)
 // Replace raw text with xml-encoded entities.
 
 std::string 
-XmlRpcUtil::xmlEncode(const std::string& raw)
-{
-  std::string::size_type iRep = raw.find_first_of(rawEntity);
-  if (iRep == std::string::npos)
-    return raw;
-
-  std::string encoded(raw, 0, iRep);
-  std::string::size_type iSize = raw.size();
-
-  while (iRep != iSize) {
-    int iEntity;
-    for (iEntity=0; rawEntity[iEntity] != 0; ++iEntity)
-      if (raw[iRep] == rawEntity[iEntity])
-      {
-        encoded += AMP;
-        encoded += xmlEntity[iEntity];
-        break;
-      }
-    if (rawEntity[iEntity] == 0)
-      encoded += raw[iRep];
-    ++iRep;
-  }
+XmlRpcUtil::xmlEncode(std::string_view raw)
+{
+  std::string encoded;
+  xmlEncode(raw, encoded);
   return encoded;
 }
 
+// The size of the encoded text is counted first, so that clean runs
+// of text can be copied straight into place.
+void
+XmlRpcUtil::xmlEncode(std::string_view raw, std::string& encoded)
+{
+  EntityScans const& scans = entityScans();
+  const char* cp = raw.data();
+  size_t n = raw.size();
+  size_t iRep = scans.findEntity(cp, n);
+  if (iRep == n) {
+    encoded.append(raw);
+    return;
+  }
+
+  size_t start = encoded.size();
+  encoded.resize(start + n + scans.encodedExtra(cp + iRep, n - iRep));
+  char* out = &encoded[start];
+
+  for (;;) {
+    memcpy(out, cp, iRep);
+    out += iRep;
+    cp += iRep;
+    n -= iRep;
+    if (n == 0)
+      break;
+
+    int iEntity = 0;
+    while (rawEntity[iEntity] != *cp)
+      ++iEntity;
+    *out++ = AMP;
+    memcpy(out, xmlEntity[iEntity], xmlEntLen[iEntity]);
+    out += xmlEntLen[iEntity];
+    ++cp;
+    --n;
+
+    iRep = scans.findEntity(cp, n);
+  }
+}
+
 
 
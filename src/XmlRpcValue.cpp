@@ -1,13 +1,21 @@
 #include "XmlRpcValue.h"
+#include "XmlRpcBase64.h"
 #include "XmlRpcException.h"
+#include "XmlRpcParser.h"
 #include "XmlRpcUtil.h"
-#include "base64.h"
 
 #ifndef MAKEDEPEND
+# include <algorithm>
 # include <iostream>
+# include <memory>
+# include <mutex>
 # include <ostream>
+# include <shared_mutex>
+# include <unordered_map>
 # include <stdlib.h>
 # include <stdio.h>
+# include <string.h>
+# include <charconv>
 #endif
 
 namespace XmlRpc {
@@ -20,9 +28,10 @@ namespace XmlRpc {
   static const char BOOLEAN_ETAG[]  = "</boolean>";
   static const char DOUBLE_TAG[]    = "<double>";
   static const char DOUBLE_ETAG[]   = "</double>";
-  static const char INT_TAG[]       = "<int>";
   static const char I4_TAG[]        = "<i4>";
   static const char I4_ETAG[]       = "</i4>";
+  static const char I8_TAG[]        = "<i8>";
+  static const char I8_ETAG[]       = "</i8>";
   static const char STRING_TAG[]    = "<string>";
   static const char DATETIME_TAG[]  = "<dateTime.iso8601>";
   static const char DATETIME_ETAG[] = "</dateTime.iso8601>";
@@ -44,7 +53,126 @@ namespace XmlRpc {
 
       
   // Format strings
-  std::string XmlRpcValue::_doubleFormat("%f");
+  std::string XmlRpcValue::_doubleFormat;
+
+
+
+  // Process wide table of member names. Names are never removed, so the
+  // table is limited in size to keep peers sending arbitrary names from
+  // growing it without bound. Later names are simply not interned.
+  static const size_t MAX_INTERNED_NAMES = 4096;
+  static const size_t MAX_INTERNED_LENGTH = 64;
+
+  struct NameTable {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string_view, std::unique_ptr<std::string> > names;
+  };
+
+  // Never destroyed, names may be used by static values during exit
+  static NameTable& nameTable()
+  {
+    static NameTable* table = new NameTable;
+    return *table;
+  }
+
+  static const std::string* internName(std::string_view name)
+  {
+    if (name.size() > MAX_INTERNED_LENGTH)
+      return 0;
+
+    NameTable& table = nameTable();
+    {
+      std::shared_lock<std::shared_mutex> lock(table.mutex);
+      auto it = table.names.find(name);
+      if (it != table.names.end())
+        return it->second.get();
+      if (table.names.size() >= MAX_INTERNED_NAMES)
+        return 0;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(table.mutex);
+    auto it = table.names.find(name);
+    if (it != table.names.end())
+      return it->second.get();
+    if (table.names.size() >= MAX_INTERNED_NAMES)
+      return 0;
+    std::unique_ptr<std::string> entry(new std::string(name));
+    const std::string* interned = entry.get();
+    table.names.emplace(std::string_view(*interned), std::move(entry));
+    return interned;
+  }
+
+
+  XmlRpcValue::Name::Name(std::string_view name) : _interned(internName(name))
+  {
+    if ( ! _interned)
+      _owned.assign(name.data(), name.size());
+  }
+
+
+  // Struct members
+  XmlRpcValue::ValueStruct::iterator XmlRpcValue::ValueStruct::lowerBound(std::string_view name)
+  {
+    return std::lower_bound(_members.begin(), _members.end(), name,
+                            [](value_type const& m, std::string_view n) { return std::string_view(m.first) < n; });
+  }
+
+  XmlRpcValue::ValueStruct::iterator XmlRpcValue::ValueStruct::find(std::string_view name)
+  {
+    iterator it = lowerBound(name);
+    return (it != _members.end() && std::string_view(it->first) == name) ? it : _members.end();
+  }
+
+  XmlRpcValue::ValueStruct::const_iterator XmlRpcValue::ValueStruct::find(std::string_view name) const
+  {
+    return const_cast<ValueStruct*>(this)->find(name);
+  }
+
+  // Most structs are small, so room for a few members is made at once
+  static const size_t INITIAL_MEMBERS = 4;
+
+  XmlRpcValue& XmlRpcValue::ValueStruct::operator[](std::string_view name)
+  {
+    iterator it = lowerBound(name);
+    if (it == _members.end() || std::string_view(it->first) != name) {
+      if (_members.capacity() == 0) {
+        _members.reserve(INITIAL_MEMBERS);
+        it = _members.end();
+      }
+      it = _members.emplace(it, Name(name), XmlRpcValue());
+    }
+    return it->second;
+  }
+
+  // Members usually arrive in order (this is how they are written), so
+  // they are appended without searching when possible.
+  std::pair<XmlRpcValue::ValueStruct::iterator, bool>
+  XmlRpcValue::ValueStruct::emplace(std::string_view name, XmlRpcValue&& value)
+  {
+    iterator it = _members.end();
+    if ( ! _members.empty() && ! (name > std::string_view(_members.back().first))) {
+      it = lowerBound(name);
+      if (it != _members.end() && std::string_view(it->first) == name)
+        return std::make_pair(it, false);
+    }
+    if (_members.capacity() == 0) {
+      _members.reserve(INITIAL_MEMBERS);
+      it = _members.end();
+    }
+    it = _members.emplace(it, Name(name), std::move(value));
+    return std::make_pair(it, true);
+  }
+
+  bool XmlRpcValue::ValueStruct::operator==(ValueStruct const& other) const
+  {
+    if (_members.size() != other._members.size())
+      return false;
+    for (size_t i=0; i<_members.size(); ++i)
+      if (_members[i].first != other._members[i].first ||
+          ! (_members[i].second == other._members[i].second))
+        return false;
+    return true;
+  }
 
 
 
@@ -52,14 +180,18 @@ namespace XmlRpc {
   void XmlRpcValue::invalidate()
   {
     switch (_type) {
-      case TypeString:    delete _value.asString; break;
-      case TypeDateTime:  delete _value.asTime;   break;
-      case TypeBase64:    delete _value.asBinary; break;
-      case TypeArray:     delete _value.asArray;  break;
-      case TypeStruct:    delete _value.asStruct; break;
+      case TypeString:
+        if (_storage == INLINE)     shortString().~basic_string();
+        else if (_storage == BLOCK) release(_value.asString);
+        break;
+      case TypeDateTime:  if (_storage == BLOCK) release(_value.asTime);   break;
+      case TypeBase64:    if (_storage == BLOCK) release(_value.asBinary); break;
+      case TypeArray:     if (_storage == BLOCK) release(_value.asArray);  break;
+      case TypeStruct:    if (_storage == BLOCK) release(_value.asStruct); break;
       default: break;
     }
     _type = TypeInvalid;
+    _storage = BLOCK;
     _value.asBinary = 0;
   }
 
@@ -71,11 +203,11 @@ namespace XmlRpc {
     {
       _type = t;
       switch (_type) {    // Ensure there is a valid value for the type
-        case TypeString:   _value.asString = new std::string(); break;
-        case TypeDateTime: _value.asTime = new struct tm();     break;
-        case TypeBase64:   _value.asBinary = new BinaryData();  break;
-        case TypeArray:    _value.asArray = new ValueArray();   break;
-        case TypeStruct:   _value.asStruct = new ValueStruct(); break;
+        case TypeString:   initString(std::string(), 0); break;
+        case TypeDateTime: _value.asTime = create<struct tm>(0);     break;
+        case TypeBase64:   _value.asBinary = create<BinaryData>(0);  break;
+        case TypeArray:    _value.asArray = create<ValueArray>(0);   break;
+        case TypeStruct:   _value.asStruct = create<ValueStruct>(0); break;
         default:           _value.asBinary = 0; break;
       }
     }
@@ -87,7 +219,8 @@ namespace XmlRpc {
   {
     if (_type != TypeArray)
       throw XmlRpcException("type error: expected an array");
-    else if (int(_value.asArray->size()) < size)
+    resolve();
+    if (int(_value.asArray->data.size()) < size)
       throw XmlRpcException("range error: array index too large");
   }
 
@@ -96,10 +229,11 @@ namespace XmlRpc {
   {
     if (_type == TypeInvalid) {
       _type = TypeArray;
-      _value.asArray = new ValueArray(size);
+      _value.asArray = create<ValueArray>(0, size);
     } else if (_type == TypeArray) {
-      if (int(_value.asArray->size()) < size)
-        _value.asArray->resize(size);
+      resolve();
+      if (int(_value.asArray->data.size()) < size)
+        unshare(_value.asArray).resize(size);
     } else
       throw XmlRpcException("type error: expected an array");
   }
@@ -108,75 +242,101 @@ namespace XmlRpc {
   {
     if (_type == TypeInvalid) {
       _type = TypeStruct;
-      _value.asStruct = new ValueStruct();
+      _value.asStruct = create<ValueStruct>(0);
     } else if (_type != TypeStruct)
       throw XmlRpcException("type error: expected a struct");
+    else
+      resolve();
   }
 
 
   // Operators
+  // Data on the heap is shared rather than copied, borrowed strings and
+  // deferred values are parsed and copied since the copy may outlive the xml
+  // they refer to. The copy is made before the current value is destroyed,
+  // since rhs may be part of it.
   XmlRpcValue& XmlRpcValue::operator=(XmlRpcValue const& rhs)
   {
     if (this != &rhs)
     {
-      invalidate();
-      _type = rhs._type;
-      switch (_type) {
-        case TypeBoolean:  _value.asBool = rhs._value.asBool; break;
-        case TypeInt:      _value.asInt = rhs._value.asInt; break;
-        case TypeDouble:   _value.asDouble = rhs._value.asDouble; break;
-        case TypeDateTime: _value.asTime = new struct tm(*rhs._value.asTime); break;
-        case TypeString:   _value.asString = new std::string(*rhs._value.asString); break;
-        case TypeBase64:   _value.asBinary = new BinaryData(*rhs._value.asBinary); break;
-        case TypeArray:    _value.asArray = new ValueArray(*rhs._value.asArray); break;
-        case TypeStruct:   _value.asStruct = new ValueStruct(*rhs._value.asStruct); break;
-        default:           _value.asBinary = 0; break;
+      rhs.resolve();
+      if (rhs._type == TypeString && rhs._storage == BORROWED) {
+        std::string buf;
+        return operator=(XmlRpcValue(std::string(rhs.stringData(buf))));
+      }
+
+      XmlRpcValue copy;
+      copy._type = rhs._type;
+      switch (rhs._type) {
+        case TypeBoolean:  copy._value.asBool = rhs._value.asBool; break;
+        case TypeInt:      copy._value.asInt = rhs._value.asInt; break;
+        case TypeInt64:    copy._value.asInt64 = rhs._value.asInt64; break;
+        case TypeDouble:   copy._value.asDouble = rhs._value.asDouble; break;
+        case TypeDateTime:
+          copy._storage = rhs._storage;
+          if (rhs._storage == INLINE) copy._value.asCompactTime = rhs._value.asCompactTime;
+          else                        copy._value.asTime = share(rhs._value.asTime);
+          break;
+        case TypeString:
+          copy._storage = rhs._storage;
+          if (rhs._storage == INLINE) new (copy._value.asShortString) std::string(rhs.shortString());
+          else                        copy._value.asString = share(rhs._value.asString);
+          break;
+        case TypeBase64:   copy._value.asBinary = share(rhs._value.asBinary); break;
+        case TypeArray:    copy._value.asArray = share(rhs._value.asArray); break;
+        case TypeStruct:   copy._value.asStruct = share(rhs._value.asStruct); break;
+        default:           copy._value.asBinary = 0; break;
       }
+      swap(copy);
     }
     return *this;
   }
 
-
-  // Predicate for tm equality
-  static bool tmEq(struct tm const& t1, struct tm const& t2) {
-    return (t1.tm_sec == t2.tm_sec && t1.tm_min == t2.tm_min &&
-            t1.tm_hour == t2.tm_hour && t1.tm_mday == t2.tm_mday &&
-            t1.tm_mon == t2.tm_mon && t1.tm_year == t2.tm_year);
+  // Likewise rhs is taken over before the current value is destroyed.
+  XmlRpcValue& XmlRpcValue::operator=(XmlRpcValue&& rhs) noexcept
+  {
+    if (this != &rhs)
+    {
+      XmlRpcValue taken(std::move(rhs));
+      swap(taken);
+    }
+    return *this;
   }
 
+
   bool XmlRpcValue::operator==(XmlRpcValue const& other) const
   {
     if (_type != other._type)
       return false;
 
+    resolve();
+    other.resolve();
     switch (_type) {
       case TypeBoolean:  return ( !_value.asBool && !other._value.asBool) ||
                                 ( _value.asBool && other._value.asBool);
       case TypeInt:      return _value.asInt == other._value.asInt;
+      case TypeInt64:    return _value.asInt64 == other._value.asInt64;
       case TypeDouble:   return _value.asDouble == other._value.asDouble;
-      case TypeDateTime: return tmEq(*_value.asTime, *other._value.asTime);
-      case TypeString:   return *_value.asString == *other._value.asString;
-      case TypeBase64:   return *_value.asBinary == *other._value.asBinary;
-      case TypeArray:    return *_value.asArray == *other._value.asArray;
-
-      // The map<>::operator== requires the definition of value< for kcc
-      case TypeStruct:   //return *_value.asStruct == *other._value.asStruct;
+      case TypeDateTime:
         {
-          if (_value.asStruct->size() != other._value.asStruct->size())
-            return false;
-          
-          ValueStruct::const_iterator it1=_value.asStruct->begin();
-          ValueStruct::const_iterator it2=other._value.asStruct->begin();
-          while (it1 != _value.asStruct->end()) {
-            const XmlRpcValue& v1 = it1->second;
-            const XmlRpcValue& v2 = it2->second;
-            if ( ! (v1 == v2))
-              return false;
-            it1++;
-            it2++;
-          }
-          return true;
+          CompactTime t1 = timeData(), t2 = other.timeData();
+          return (t1.sec == t2.sec && t1.min == t2.min &&
+                  t1.hour == t2.hour && t1.mday == t2.mday &&
+                  t1.mon == t2.mon && t1.year == t2.year);
+        }
+      case TypeString:
+        {
+          std::string buf1, buf2;
+          return stringData(buf1) == other.stringData(buf2);
         }
+      case TypeBase64:   return _value.asBinary == other._value.asBinary ||
+                                _value.asBinary->data == other._value.asBinary->data;
+      case TypeArray:    return _value.asArray == other._value.asArray ||
+                                _value.asArray->data == other._value.asArray->data;
+
+      // The map<>::operator== requires the definition of value< for kcc
+      case TypeStruct:   return _value.asStruct == other._value.asStruct ||
+                                _value.asStruct->data == other._value.asStruct->data;
       default: break;
     }
     return true;    // Both invalid values ...
@@ -191,11 +351,16 @@ namespace XmlRpc {
   // Works for strings, binary data, arrays, and structs.
   int XmlRpcValue::size() const
   {
+    resolve();
     switch (_type) {
-      case TypeString: return int(_value.asString->size());
-      case TypeBase64: return int(_value.asBinary->size());
-      case TypeArray:  return int(_value.asArray->size());
-      case TypeStruct: return int(_value.asStruct->size());
+      case TypeString:
+        {
+          std::string buf;
+          return int(stringData(buf).size());
+        }
+      case TypeBase64: return int(_value.asBinary->data.size());
+      case TypeArray:  return int(_value.asArray->data.size());
+      case TypeStruct: return int(_value.asStruct->data.size());
       default: break;
     }
 
@@ -203,376 +368,491 @@ namespace XmlRpc {
   }
 
   // Checks for existence of struct member
-  bool XmlRpcValue::hasMember(const std::string& name) const
+  bool XmlRpcValue::hasMember(std::string_view name) const
   {
-    return _type == TypeStruct && _value.asStruct->find(name) != _value.asStruct->end();
+    if (_type != TypeStruct)
+      return false;
+    resolve();
+    return _value.asStruct->data.find(name) != _value.asStruct->data.end();
   }
 
   // Set the value from xml. The chars at *offset into valueXml 
   // should be the start of a <value> tag. Destroys any existing value.
-  bool XmlRpcValue::fromXml(std::string const& valueXml, int* offset)
+  bool XmlRpcValue::fromXml(std::string const& valueXml, int* offset, std::pmr::memory_resource* resource,
+                            unsigned options)
   {
-    int savedOffset = *offset;
+    // Blocks holding borrowed strings or deferred values must not be shared by copies
+    if (options && ! resource)
+      resource = std::pmr::new_delete_resource();
 
     invalidate();
-    if ( ! XmlRpcUtil::nextTagIs(VALUE_TAG, valueXml, offset))
-      return false;       // Not a value, offset not updated
-
-	int afterValueOffset = *offset;
-    std::string typeTag = XmlRpcUtil::getNextTag(valueXml, offset);
-    bool result = false;
-    if (typeTag == BOOLEAN_TAG)
-      result = boolFromXml(valueXml, offset);
-    else if (typeTag == I4_TAG || typeTag == INT_TAG)
-      result = intFromXml(valueXml, offset);
-    else if (typeTag == DOUBLE_TAG)
-      result = doubleFromXml(valueXml, offset);
-    else if (typeTag.empty() || typeTag == STRING_TAG)
-      result = stringFromXml(valueXml, offset);
-    else if (typeTag == DATETIME_TAG)
-      result = timeFromXml(valueXml, offset);
-    else if (typeTag == BASE64_TAG)
-      result = binaryFromXml(valueXml, offset);
-    else if (typeTag == ARRAY_TAG)
-      result = arrayFromXml(valueXml, offset);
-    else if (typeTag == STRUCT_TAG)
-      result = structFromXml(valueXml, offset);
-    // Watch for empty/blank strings with no <string>tag
-    else if (typeTag == VALUE_ETAG)
-    {
-      *offset = afterValueOffset;   // back up & try again
-      result = stringFromXml(valueXml, offset);
+    XmlRpcParser parser(valueXml, *offset);
+    if ( ! fromEvent(parser, parser.next(), resource, options, (options & DeferContainers) != 0)) {
+      invalidate();
+      return false;       // Offset not updated
+    }
+    *offset = parser.getOffset();
+    return true;
+  }
+
+  bool XmlRpcValue::fromXml(XmlRpcParser& parser, std::pmr::memory_resource* resource, unsigned options)
+  {
+    if (options && ! resource)
+      resource = std::pmr::new_delete_resource();
+
+    invalidate();
+    if ( ! fromEvent(parser, parser.next(), resource, options, false)) {
+      invalidate();
+      return false;
+    }
+    return true;
+  }
+
+  // Build the value starting with event. Arrays, structs and binary data
+  // are only delimited if defer is set; their elements are deferred if
+  // options asks for it.
+  bool XmlRpcValue::fromEvent(XmlRpcParser& parser, XmlRpcParser::Event event,
+                              std::pmr::memory_resource* resource, unsigned options, bool defer)
+  {
+    bool deferElements = (options & DeferContainers) != 0;
+
+    switch (event) {
+      case XmlRpcParser::Boolean:
+        _type = TypeBoolean;
+        _value.asBool = parser.getBool();
+        return true;
+
+      case XmlRpcParser::Int:
+        _type = TypeInt;
+        _value.asInt = parser.getInt();
+        return true;
+
+      case XmlRpcParser::Int64:
+        _type = TypeInt64;
+        _value.asInt64 = parser.getInt64();
+        return true;
+
+      case XmlRpcParser::Double:
+        _type = TypeDouble;
+        _value.asDouble = parser.getDouble();
+        return true;
+
+      // A borrowed string only records where the text is and whether it has entities.
+      case XmlRpcParser::String:
+        if (options & BorrowStrings) {
+          std::string_view text = parser.getText();
+          _storage = BORROWED;
+          _value.asSlice.data = text.data();
+          _value.asSlice.length = text.size();
+          _value.asSlice.encoded = parser.isEncoded();
+        } else if (parser.isEncoded())
+          initString(parser.getString(), resource);
+        else
+          initString(std::string(parser.getText()), resource);
+        _type = TypeString;
+        return true;
+
+      case XmlRpcParser::DateTime:
+        {
+          struct tm t;
+          parser.getTime(t);
+          CompactTime ct = { t.tm_year, t.tm_mon, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec };
+          _type = TypeDateTime;
+          _storage = INLINE;
+          _value.asCompactTime = ct;
+          return true;
+        }
+
+      case XmlRpcParser::Base64:
+        if (defer)
+          return deferValue(TypeBase64, parser, resource, options);
+        _value.asBinary = create<BinaryData>(resource);
+        _type = TypeBase64;
+        return parser.getBinary(_value.asBinary->data);
+
+      case XmlRpcParser::StartArray:
+        if (defer)
+          return deferValue(TypeArray, parser, resource, options) && parser.skip();
+        {
+          _value.asArray = create<ValueArray>(resource);
+          _type = TypeArray;
+          ValueArray& elements = _value.asArray->data;
+          // Each element is parsed in place at the end of the array
+          while ((event = parser.next()) != XmlRpcParser::EndArray) {
+            elements.emplace_back();
+            if ( ! elements.back().fromEvent(parser, event, resource, options, deferElements))
+              return false;
+          }
+          return true;
+        }
+
+      case XmlRpcParser::StartStruct:
+        if (defer)
+          return deferValue(TypeStruct, parser, resource, options) && parser.skip();
+        {
+          _value.asStruct = create<ValueStruct>(resource);
+          _type = TypeStruct;
+          while ((event = parser.next()) == XmlRpcParser::Member) {
+            std::string decoded;
+            std::string_view name = parser.getText();
+            if (parser.isEncoded()) {
+              decoded = parser.getString();
+              name = decoded;
+            }
+            XmlRpcValue val;
+            if ( ! val.fromEvent(parser, parser.next(), resource, options, deferElements))
+              return false;
+            _value.asStruct->data.emplace(name, std::move(val));
+          }
+          return event == XmlRpcParser::EndStruct;
+        }
+
+      default:    // Not the start of a value
+        break;
     }
+    return false;
+  }
 
-    if (result)  // Skip over the </value> tag
-      XmlRpcUtil::findTag(VALUE_ETAG, valueXml, offset);
-    else        // Unrecognized tag after <value>
-      *offset = savedOffset;
+  // Remember where the value is, to parse it when it is accessed
+  bool XmlRpcValue::deferValue(Type type, XmlRpcParser& parser,
+                               std::pmr::memory_resource* resource, unsigned options)
+  {
+    _type = type;
+    _storage = DEFERRED;
+    _value.asDeferred.xml = &parser.getXml();
+    _value.asDeferred.offset = parser.getValueOffset();
+    _value.asDeferred.options = options;
+    _value.asDeferred.resource = resource;
+    return true;
+  }
+
+  // The elements of a deferred container are deferred in turn
+  void XmlRpcValue::parseDeferred()
+  {
+    Deferred d = _value.asDeferred;
+    _type = TypeInvalid;
+    _storage = BLOCK;
+    _value.asBinary = 0;
 
-    return result;
+    XmlRpcParser parser(*d.xml, d.offset);
+    if ( ! fromEvent(parser, parser.next(), d.resource, d.options, false)) {
+      invalidate();
+      throw XmlRpcException("parse error: invalid value");
+    }
   }
 
   // Encode the Value in xml
   std::string XmlRpcValue::toXml() const
   {
+    std::string xml;
+    xml.reserve(estimateXmlSize());
+    toXml(xml);
+    return xml;
+  }
+
+  void XmlRpcValue::toXml(std::string& xml) const
+  {
+    resolve();
     switch (_type) {
-      case TypeBoolean:  return boolToXml();
-      case TypeInt:      return intToXml();
-      case TypeDouble:   return doubleToXml();
-      case TypeString:   return stringToXml();
-      case TypeDateTime: return timeToXml();
-      case TypeBase64:   return binaryToXml();
-      case TypeArray:    return arrayToXml();
-      case TypeStruct:   return structToXml();
-      default: break;
+      case TypeBoolean:  boolToXml(xml);   break;
+      case TypeInt:      intToXml(xml);    break;
+      case TypeInt64:    int64ToXml(xml);  break;
+      case TypeDouble:   doubleToXml(xml); break;
+      case TypeString:   stringToXml(xml); break;
+      case TypeDateTime: timeToXml(xml);   break;
+      case TypeBase64:   binaryToXml(xml); break;
+      case TypeArray:    arrayToXml(xml);  break;
+      case TypeStruct:   structToXml(xml); break;
+      default: break;     // Invalid value
     }
-    return std::string();   // Invalid value
   }
 
-
-  // Boolean
-  bool XmlRpcValue::boolFromXml(std::string const& valueXml, int* offset)
+  // Tags and base64 are counted exactly, numbers roughly, and
+  // strings without the entities they may need.
+  size_t XmlRpcValue::estimateXmlSize() const
   {
-    const char* valueStart = valueXml.c_str() + *offset;
-    char* valueEnd;
-    long ivalue = strtol(valueStart, &valueEnd, 10);
-    if (valueEnd == valueStart || (ivalue != 0 && ivalue != 1))
-      return false;
+    static const size_t VALUE_TAGS_LEN = sizeof(VALUE_TAG) + sizeof(VALUE_ETAG) - 2;
 
-    _type = TypeBoolean;
-    _value.asBool = (ivalue == 1);
-    *offset += int(valueEnd - valueStart);
-    return true;
+    resolve();
+    switch (_type) {
+      case TypeBoolean:  return VALUE_TAGS_LEN + sizeof(BOOLEAN_TAG) + sizeof(BOOLEAN_ETAG) - 1;
+      case TypeInt:      return VALUE_TAGS_LEN + sizeof(I4_TAG) + sizeof(I4_ETAG) + 9;
+      case TypeInt64:    return VALUE_TAGS_LEN + sizeof(I8_TAG) + sizeof(I8_ETAG) + 18;
+      case TypeDouble:   return VALUE_TAGS_LEN + sizeof(DOUBLE_TAG) + sizeof(DOUBLE_ETAG) + 22;
+      case TypeDateTime: return VALUE_TAGS_LEN + sizeof(DATETIME_TAG) + sizeof(DATETIME_ETAG) + 15;
+      case TypeString:   return VALUE_TAGS_LEN + (_storage == BORROWED ? _value.asSlice.length : size_t(size()));
+      case TypeBase64:
+        {
+          size_t n = XmlRpcBase64::encodedSize(_value.asBinary->data.size());
+          return VALUE_TAGS_LEN + sizeof(BASE64_TAG) + sizeof(BASE64_ETAG) - 2 + n;
+        }
+      case TypeArray:
+        {
+          size_t n = VALUE_TAGS_LEN + sizeof(ARRAY_TAG) + sizeof(ARRAY_ETAG) +
+                     sizeof(DATA_TAG) + sizeof(DATA_ETAG) - 4;
+          for (XmlRpcValue const& element : _value.asArray->data)
+            n += element.estimateXmlSize();
+          return n;
+        }
+      case TypeStruct:
+        {
+          static const size_t MEMBER_TAGS_LEN = sizeof(MEMBER_TAG) + sizeof(MEMBER_ETAG) +
+                                                sizeof(NAME_TAG) + sizeof(NAME_ETAG) - 4;
+          size_t n = VALUE_TAGS_LEN + sizeof(STRUCT_TAG) + sizeof(STRUCT_ETAG) - 2;
+          for (ValueStruct::value_type const& member : _value.asStruct->data)
+            n += MEMBER_TAGS_LEN + member.first.str().size() + member.second.estimateXmlSize();
+          return n;
+        }
+      default: break;
+    }
+    return 0;   // Invalid value
   }
 
-  std::string XmlRpcValue::boolToXml() const
+
+  
+  // Boolean
+  void XmlRpcValue::boolToXml(std::string& xml) const
   {
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += BOOLEAN_TAG;
     xml += (_value.asBool ? "1" : "0");
     xml += BOOLEAN_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
+  
   // Int
-  bool XmlRpcValue::intFromXml(std::string const& valueXml, int* offset)
-  {
-    const char* valueStart = valueXml.c_str() + *offset;
-    char* valueEnd;
-    long ivalue = strtol(valueStart, &valueEnd, 10);
-    if (valueEnd == valueStart)
-      return false;
-
-    _type = TypeInt;
-    _value.asInt = int(ivalue);
-    *offset += int(valueEnd - valueStart);
-    return true;
-  }
-
-  std::string XmlRpcValue::intToXml() const
+  void XmlRpcValue::intToXml(std::string& xml) const
   {
-    char buf[256];
-    snprintf(buf, sizeof(buf)-1, "%d", _value.asInt);
-    buf[sizeof(buf)-1] = 0;
-    std::string xml = VALUE_TAG;
+    char buf[16];
+    char* end = std::to_chars(buf, buf + sizeof(buf), _value.asInt).ptr;
+    xml += VALUE_TAG;
     xml += I4_TAG;
-    xml += buf;
+    xml.append(buf, end);
     xml += I4_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
-  // Double
-  bool XmlRpcValue::doubleFromXml(std::string const& valueXml, int* offset)
+  void XmlRpcValue::int64ToXml(std::string& xml) const
   {
-    const char* valueStart = valueXml.c_str() + *offset;
-    char* valueEnd;
-    double dvalue = strtod(valueStart, &valueEnd);
-    if (valueEnd == valueStart)
-      return false;
-
-    _type = TypeDouble;
-    _value.asDouble = dvalue;
-    *offset += int(valueEnd - valueStart);
-    return true;
+    char buf[24];
+    char* end = std::to_chars(buf, buf + sizeof(buf), _value.asInt64).ptr;
+    xml += VALUE_TAG;
+    xml += I8_TAG;
+    xml.append(buf, end);
+    xml += I8_ETAG;
+    xml += VALUE_ETAG;
   }
 
-  std::string XmlRpcValue::doubleToXml() const
+  
+  // Double. The spec has no exponent notation, so the shortest digits are
+  // written in fixed notation, which takes up to 330 chars for extreme values.
+  void XmlRpcValue::doubleToXml(std::string& xml) const
   {
-    char buf[256];
-    snprintf(buf, sizeof(buf)-1, getDoubleFormat().c_str(), _value.asDouble);
-    buf[sizeof(buf)-1] = 0;
+    char buf[400];
+    char* end;
+    if (getDoubleFormat().empty())
+      end = std::to_chars(buf, buf + sizeof(buf), _value.asDouble, std::chars_format::fixed).ptr;
+    else {
+      snprintf(buf, sizeof(buf)-1, getDoubleFormat().c_str(), _value.asDouble);
+      buf[sizeof(buf)-1] = 0;
+      end = buf + strlen(buf);
+    }
 
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += DOUBLE_TAG;
-    xml += buf;
+    xml.append(buf, end);
     xml += DOUBLE_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
+  
   // String
-  bool XmlRpcValue::stringFromXml(std::string const& valueXml, int* offset)
+  std::string_view XmlRpcValue::stringData(std::string& buf) const
   {
-    size_t valueEnd = valueXml.find('<', *offset);
-    if (valueEnd == std::string::npos)
-      return false;     // No end tag;
+    switch (_storage) {
+      case INLINE:   return shortString();
+      case BLOCK:    return _value.asString->data;
+      default:       break;
+    }
 
-    _type = TypeString;
-    _value.asString = new std::string(XmlRpcUtil::xmlDecode(valueXml.substr(*offset, valueEnd-*offset)));
-    *offset += int(_value.asString->length());
-    return true;
+    std::string_view text(_value.asSlice.data, _value.asSlice.length);
+    if ( ! _value.asSlice.encoded)
+      return text;
+    buf = XmlRpcUtil::xmlDecode(text);
+    return buf;
   }
 
-  std::string XmlRpcValue::stringToXml() const
+  // The caller may modify the string, so it cannot stay in the xml
+  void XmlRpcValue::ownString()
   {
-    std::string xml = VALUE_TAG;
+    if (_storage != BORROWED)
+      return;
+
+    std::string buf;
+    XmlRpcValue owned(std::string(stringData(buf)));
+    swap(owned);
+  }
+
+  void XmlRpcValue::stringToXml(std::string& xml) const
+  {
+    std::string buf;
+    xml += VALUE_TAG;
     //xml += STRING_TAG; optional
-    xml += XmlRpcUtil::xmlEncode(*_value.asString);
+    XmlRpcUtil::xmlEncode(stringData(buf), xml);
     //xml += STRING_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
-  // DateTime (stored as a struct tm)
-  bool XmlRpcValue::timeFromXml(std::string const& valueXml, int* offset)
+  
+  // DateTime (stored in the value until a struct tm is asked for)
+  XmlRpcValue::CompactTime XmlRpcValue::timeData() const
   {
-    size_t valueEnd = valueXml.find('<', *offset);
-    if (valueEnd == std::string::npos)
-      return false;     // No end tag;
+    if (_storage == INLINE)
+      return _value.asCompactTime;
 
-    std::string stime = valueXml.substr(*offset, valueEnd-*offset);
-
-    struct tm t;
-    if (sscanf(stime.c_str(),"%4d%2d%2dT%2d:%2d:%2d",&t.tm_year,&t.tm_mon,&t.tm_mday,&t.tm_hour,&t.tm_min,&t.tm_sec) != 6)
-      return false;
+    const struct tm& tm = _value.asTime->data;
+    CompactTime t = { tm.tm_year, tm.tm_mon, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec };
+    return t;
+  }
 
-    t.tm_isdst = -1;
-    _type = TypeDateTime;
-    _value.asTime = new struct tm(t);
-    *offset += int(stime.length());
-    return true;
+  // The caller may modify the struct tm, so the date cannot stay in the value
+  void XmlRpcValue::expandTime()
+  {
+    if (_storage != INLINE)
+      return;
+
+    CompactTime t = _value.asCompactTime;
+    _value.asTime = create<struct tm>(0);
+    struct tm& tm = _value.asTime->data;
+    tm.tm_year = t.year;
+    tm.tm_mon = t.mon;
+    tm.tm_mday = t.mday;
+    tm.tm_hour = t.hour;
+    tm.tm_min = t.min;
+    tm.tm_sec = t.sec;
+    tm.tm_isdst = -1;
+    _storage = BLOCK;
   }
 
-  std::string XmlRpcValue::timeToXml() const
+  void XmlRpcValue::timeToXml(std::string& xml) const
   {
-    struct tm* t = _value.asTime;
+    CompactTime t = timeData();
     char buf[20];
     snprintf(buf, sizeof(buf)-1, "%4d%02d%02dT%02d:%02d:%02d", 
-      t->tm_year,t->tm_mon,t->tm_mday,t->tm_hour,t->tm_min,t->tm_sec);
+      t.year,t.mon,t.mday,t.hour,t.min,t.sec);
     buf[sizeof(buf)-1] = 0;
 
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += DATETIME_TAG;
     xml += buf;
     xml += DATETIME_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
 
+  
+
   // Base64
-  bool XmlRpcValue::binaryFromXml(std::string const& valueXml, int* offset)
+  void XmlRpcValue::binaryToXml(std::string& xml) const
   {
-    size_t valueEnd = valueXml.find('<', *offset);
-    if (valueEnd == std::string::npos)
-      return false;     // No end tag;
-
-    _type = TypeBase64;
-    std::string asString = valueXml.substr(*offset, valueEnd-*offset);
-    _value.asBinary = new BinaryData();
-    // check whether base64 encodings can contain chars xml encodes...
-
-    // convert from base64 to binary
-    int iostatus = 0;
-	  base64<char> decoder;
-    std::back_insert_iterator<BinaryData> ins = std::back_inserter(*(_value.asBinary));
-		decoder.get(asString.begin(), asString.end(), ins, iostatus);
-
-    *offset += int(asString.length());
-    return true;
-  }
-
+    xml += VALUE_TAG;
+    xml += BASE64_TAG;
 
-  std::string XmlRpcValue::binaryToXml() const
-  {
-    // convert to base64
-    std::vector<char> base64data;
-    int iostatus = 0;
-	  base64<char> encoder;
-    std::back_insert_iterator<std::vector<char> > ins = std::back_inserter(base64data);
-		encoder.put(_value.asBinary->begin(), _value.asBinary->end(), ins, iostatus, base64<>::crlf());
+    // convert to base64 in place
+    BinaryData const& data = _value.asBinary->data;
+    XmlRpcBase64::encode(data.data(), data.size(), xml);
 
-    // Wrap with xml
-    std::string xml = VALUE_TAG;
-    xml += BASE64_TAG;
-    xml.append(base64data.begin(), base64data.end());
     xml += BASE64_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
 
-  // Array
-  bool XmlRpcValue::arrayFromXml(std::string const& valueXml, int* offset)
-  {
-    if ( ! XmlRpcUtil::nextTagIs(DATA_TAG, valueXml, offset))
-      return false;
-
-    _type = TypeArray;
-    _value.asArray = new ValueArray;
-    XmlRpcValue v;
-    while (v.fromXml(valueXml, offset))
-      _value.asArray->push_back(v);       // copy...
-
-    // Skip the trailing </data>
-    (void) XmlRpcUtil::nextTagIs(DATA_ETAG, valueXml, offset);
-    return true;
-  }
-
+  
 
-  // In general, its preferable to generate the xml of each element of the
-  // array as it is needed rather than glomming up one big string.
-  std::string XmlRpcValue::arrayToXml() const
+  // Array
+  // Each element is appended in place, so nested values are not copied.
+  void XmlRpcValue::arrayToXml(std::string& xml) const
   {
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += ARRAY_TAG;
     xml += DATA_TAG;
 
-    int s = int(_value.asArray->size());
+    int s = int(_value.asArray->data.size());
     for (int i=0; i<s; ++i)
-       xml += _value.asArray->at(i).toXml();
+       _value.asArray->data[i].toXml(xml);
 
     xml += DATA_ETAG;
     xml += ARRAY_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
 
-  // Struct
-  bool XmlRpcValue::structFromXml(std::string const& valueXml, int* offset)
-  {
-    _type = TypeStruct;
-    _value.asStruct = new ValueStruct;
-
-    while (XmlRpcUtil::nextTagIs(MEMBER_TAG, valueXml, offset)) {
-      // name
-      const std::string name = XmlRpcUtil::parseTag(NAME_TAG, valueXml, offset);
-      // value
-      XmlRpcValue val(valueXml, offset);
-      if ( ! val.valid()) {
-        invalidate();
-        return false;
-      }
-      const std::pair<const std::string, XmlRpcValue> p(name, val);
-      _value.asStruct->insert(p);
-
-      (void) XmlRpcUtil::nextTagIs(MEMBER_ETAG, valueXml, offset);
-    }
-    return true;
-  }
-
+  
 
-  // In general, its preferable to generate the xml of each element
-  // as it is needed rather than glomming up one big string.
-  std::string XmlRpcValue::structToXml() const
+  // Struct
+  // Members are appended in place like array elements.
+  void XmlRpcValue::structToXml(std::string& xml) const
   {
-    std::string xml = VALUE_TAG;
+    xml += VALUE_TAG;
     xml += STRUCT_TAG;
 
     ValueStruct::const_iterator it;
-    for (it=_value.asStruct->begin(); it!=_value.asStruct->end(); ++it) {
+    for (it=_value.asStruct->data.begin(); it!=_value.asStruct->data.end(); ++it) {
       xml += MEMBER_TAG;
       xml += NAME_TAG;
-      xml += XmlRpcUtil::xmlEncode(it->first);
+      XmlRpcUtil::xmlEncode(it->first.str(), xml);
       xml += NAME_ETAG;
-      xml += it->second.toXml();
+      it->second.toXml(xml);
       xml += MEMBER_ETAG;
     }
 
     xml += STRUCT_ETAG;
     xml += VALUE_ETAG;
-    return xml;
   }
 
 
 
   // Write the value without xml encoding it
   std::ostream& XmlRpcValue::write(std::ostream& os) const {
+    resolve();
     switch (_type) {
       default:           break;
       case TypeBoolean:  os << _value.asBool; break;
       case TypeInt:      os << _value.asInt; break;
+      case TypeInt64:    os << _value.asInt64; break;
       case TypeDouble:   os << _value.asDouble; break;
-      case TypeString:   os << *_value.asString; break;
+      case TypeString:
+        {
+          std::string buf;
+          os << stringData(buf);
+        }
+        break;
       case TypeDateTime:
         {
-          struct tm* t = _value.asTime;
+          CompactTime t = timeData();
           char buf[20];
           snprintf(buf, sizeof(buf)-1, "%4d%02d%02dT%02d:%02d:%02d", 
-            t->tm_year,t->tm_mon,t->tm_mday,t->tm_hour,t->tm_min,t->tm_sec);
+            t.year,t.mon,t.mday,t.hour,t.min,t.sec);
           buf[sizeof(buf)-1] = 0;
           os << buf;
           break;
         }
       case TypeBase64:
         {
-          int iostatus = 0;
-          std::ostreambuf_iterator<char> out(os);
-          base64<char> encoder;
-          encoder.put(_value.asBinary->begin(), _value.asBinary->end(), out, iostatus, base64<>::crlf());
+          std::string encoded;
+          XmlRpcBase64::encode(_value.asBinary->data.data(), _value.asBinary->data.size(), encoded);
+          os << encoded;
           break;
         }
       case TypeArray:
         {
-          int s = int(_value.asArray->size());
+          int s = int(_value.asArray->data.size());
           os << '{';
           for (int i=0; i<s; ++i)
           {
             if (i > 0) os << ',';
-            _value.asArray->at(i).write(os);
+            _value.asArray->data.at(i).write(os);
           }
           os << '}';
           break;
@@ -581,10 +861,10 @@ namespace XmlRpc {
         {
           os << '[';
           ValueStruct::const_iterator it;
-          for (it=_value.asStruct->begin(); it!=_value.asStruct->end(); ++it)
+          for (it=_value.asStruct->data.begin(); it!=_value.asStruct->data.end(); ++it)
           {
-            if (it!=_value.asStruct->begin()) os << ',';
-            os << it->first << ':';
+            if (it!=_value.asStruct->data.begin()) os << ',';
+            os << it->first.str() << ':';
             it->second.write(os);
           }
           os << ']';
@@ -0,0 +1,2209 @@
+// Tests for the XmlRpc++ library. Run with "make test".
+
+#include "XmlRpc.h"
+#include "XmlRpcDispatch.h"
+#include "XmlRpcHttpHeader.h"
+#include "XmlRpcPoller.h"
+#include "XmlRpcSocket.h"
+#include "XmlRpcSource.h"
+#include "XmlRpcTimer.h"
+#include "XmlRpcTokenizer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace XmlRpc;
+
+
+static int nChecks = 0;
+static int nFailures = 0;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+static void
+check(bool ok, const char* what, const char* file, int line)
+{
+  ++nChecks;
+  if ( ! ok) {
+    ++nFailures;
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+  }
+}
+
+
+// Allocations made through operator new, counted for the benchmarks
+static std::atomic<size_t> nAllocations(0);
+
+void*
+operator new(size_t size)
+{
+  nAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void*
+operator new(size_t size, std::align_val_t align)
+{
+  nAllocations.fetch_add(1, std::memory_order_relaxed);
+  size_t a = size_t(align);
+  if (void* p = aligned_alloc(a, (size + a - 1) / a * a))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+
+static std::mt19937 rng(12345);
+
+static size_t
+randomSize(size_t n)
+{
+  return std::uniform_int_distribution<size_t>(0, n)(rng);
+}
+
+// Random text drawing a fraction of its chars from special
+static std::string
+randomText(size_t length, std::string const& special, double fraction)
+{
+  static const char plain[] = "abcdefghijklmnopqrstuvwxyz0123456789 \n\t;=/\xc3\xa9";
+  std::bernoulli_distribution isSpecial(fraction);
+  std::string s(length, ' ');
+  for (size_t i=0; i<length; ++i)
+    s[i] = isSpecial(rng) ? special[randomSize(special.size() - 1)]
+                          : plain[randomSize(sizeof(plain) - 2)];
+  return s;
+}
+
+static std::string
+randomBytes(size_t length)
+{
+  std::string s(length, '\0');
+  for (size_t i=0; i<length; ++i)
+    s[i] = char(rng());
+  return s;
+}
+
+
+// A server run by its own thread on the first free port from BASE_PORT
+class TestServer : public XmlRpcServer {
+public:
+  enum { BASE_PORT = 18700 };
+
+  TestServer() : _port(0) {}
+
+  ~TestServer() { stop(); }
+
+  bool start()
+  {
+    for (int port = BASE_PORT; port < BASE_PORT + 100; ++port)
+      if (bindAndListen(port)) {
+        _port = port;
+        _thread = std::thread([this]() { work(-1.0); });
+        return true;
+      }
+    return false;
+  }
+
+  void stop()
+  {
+    if (_thread.joinable()) {
+      exit();
+      _thread.join();
+    }
+  }
+
+  // Run f in the event loop and return its result
+  size_t inLoop(std::function<size_t()> const& f)
+  {
+    std::promise<size_t> result;
+    _disp.post([&]() { result.set_value(f()); });
+    return result.get_future().get();
+  }
+
+  size_t sourceCount() { return inLoop([this]() { return _disp.getSourceCount(); }); }
+
+  int port() const { return _port; }
+
+private:
+  int _port;
+  std::thread _thread;
+};
+
+
+// A blocking client socket
+static int
+connectTo(int port)
+{
+  int fd = XmlRpcSocket::socket();
+  std::string host("localhost");
+  if (fd >= 0 && ! XmlRpcSocket::connect(fd, host, port)) {
+    XmlRpcSocket::close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+static bool
+sendAll(int fd, std::string const& data)
+{
+  for (size_t sent = 0; sent < data.size(); ) {
+    ssize_t n = ::write(fd, data.data() + sent, data.size() - sent);
+    if (n <= 0) return false;
+    sent += size_t(n);
+  }
+  return true;
+}
+
+// Read until count responses have arrived
+static std::string
+readResponses(int fd, int count)
+{
+  std::string data;
+  char buf[4096];
+  while (true) {
+    int n = 0;
+    for (size_t pos = 0; (pos = data.find("</methodResponse>", pos)) != std::string::npos; ++pos)
+      ++n;
+    if (n >= count) break;
+    ssize_t got = ::read(fd, buf, sizeof(buf));
+    if (got <= 0) break;
+    data.append(buf, size_t(got));
+  }
+  return data;
+}
+
+static std::string
+httpRequest(std::string const& body)
+{
+  char header[128];
+  snprintf(header, sizeof(header), "POST /RPC2 HTTP/1.1\r\nHost: localhost\r\nContent-length: %d\r\n\r\n", int(body.size()));
+  return header + body;
+}
+
+static std::string
+callBody(std::string const& method, std::string const& params = std::string())
+{
+  return "<?xml version=\"1.0\"?>\r\n<methodCall><methodName>" + method +
+         "</methodName>\r\n<params>" + params + "</params></methodCall>\r\n";
+}
+
+
+// Sleeps for a while before answering
+class Slow : public XmlRpcServerMethod {
+public:
+  Slow(XmlRpcServer* s) : XmlRpcServerMethod("slow", s) {}
+
+  void execute(XmlRpcValue& params, XmlRpcValue& result)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    result = 1;
+  }
+};
+
+
+// Pipelined requests run on the workers one after the other, and the
+// connection is monitored once in between
+static void
+testPipelinedWorkers()
+{
+  TestServer server;
+  Slow slow(&server);
+  server.setWorkerThreads(2);
+  CHECK(server.start());
+
+  int fd = connectTo(server.port());
+  CHECK(fd >= 0);
+  std::string requests;
+  for (int i=0; i<4; ++i)
+    requests += httpRequest(callBody("slow"));
+  CHECK(sendAll(fd, requests));
+
+  std::string responses = readResponses(fd, 4);
+  CHECK(responses.find("HTTP/1.1 200 OK") == 0);
+
+  // The listening socket and the connection
+  CHECK(server.sourceCount() == 2);
+
+  // The connection still works
+  CHECK(sendAll(fd, httpRequest(callBody("slow"))));
+  CHECK(readResponses(fd, 1).find("<i4>1</i4>") != std::string::npos);
+  CHECK(server.sourceCount() == 2);
+
+  XmlRpcSocket::close(fd);
+}
+
+
+// The worker threads stop on shutdown and start again with the next work()
+static void
+testWorkersRestart()
+{
+  TestServer server;
+  Slow slow(&server);
+  server.setWorkerThreads(2);
+  for (int round=0; round<2; ++round) {
+    CHECK(server.start());
+    int fd = connectTo(server.port());
+    CHECK(fd >= 0);
+    CHECK(sendAll(fd, httpRequest(callBody("slow"))));
+    CHECK(readResponses(fd, 1).find("<i4>1</i4>") != std::string::npos);
+    CHECK(server.getWorkerPool() != 0);
+    XmlRpcSocket::close(fd);
+
+    server.stop();
+    server.shutdown();
+    CHECK(server.getWorkerPool() == 0);
+  }
+}
+
+
+// Overrides neither execute nor executeAsync
+class Unimplemented : public XmlRpcServerMethod {
+public:
+  Unimplemented(XmlRpcServer* s) : XmlRpcServerMethod("unimplemented", s) {}
+};
+
+// Keeps the completion of each call until it is answered by the test
+class Later : public XmlRpcServerMethod {
+public:
+  Later(XmlRpcServer* s) : XmlRpcServerMethod("later", s) {}
+
+  void executeAsync(XmlRpcValue& params, std::shared_ptr<XmlRpcServerCompletion> done)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pending.push_back(done);
+    _started.notify_all();
+  }
+
+  // Wait for n calls to have started
+  void waitStarted(size_t n)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _started.wait(lock, [&]() { return _pending.size() >= n; });
+  }
+
+  void completeAll()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (size_t i=0; i<_pending.size(); ++i)
+      _pending[i]->complete(XmlRpcValue(2));
+    _pending.clear();
+  }
+
+private:
+  std::mutex _mutex;
+  std::condition_variable _started;
+  std::vector< std::shared_ptr<XmlRpcServerCompletion> > _pending;
+};
+
+
+static std::string
+multicallBody(std::string const& method)
+{
+  return callBody("system.multicall",
+    "<param><value><array><data><value><struct>"
+    "<member><name>methodName</name><value>" + method + "</value></member>"
+    "<member><name>params</name><value><array><data></data></array></value></member>"
+    "</struct></value></data></array></value></param>");
+}
+
+// A method overriding neither execute nor executeAsync fails rather than
+// recursing, and system.multicall does not wait for asynchronous results
+static void
+testAsyncMethods()
+{
+  TestServer server;
+  Unimplemented unimplemented(&server);
+  Later later(&server);
+  CHECK(server.start());
+
+  XmlRpcValue params, result;
+  bool thrown = false;
+  try {
+    unimplemented.execute(params, result);
+  } catch (const XmlRpcException& e) {
+    thrown = e.getMessage().find("not implemented") != std::string::npos;
+  }
+  CHECK(thrown);
+
+  int fd = connectTo(server.port());
+  CHECK(fd >= 0);
+  CHECK(sendAll(fd, httpRequest(callBody("unimplemented"))));
+  CHECK(readResponses(fd, 1).find("not implemented") != std::string::npos);
+
+  CHECK(sendAll(fd, httpRequest(multicallBody("later"))));
+  CHECK(readResponses(fd, 1).find("not supported in system.multicall") != std::string::npos);
+
+  // The result arrives after the server answered
+  later.completeAll();
+
+  // A single call waits for its result without holding up the server
+  CHECK(sendAll(fd, httpRequest(callBody("later"))));
+  later.waitStarted(1);
+  int fd2 = connectTo(server.port());
+  CHECK(sendAll(fd2, httpRequest(callBody("unimplemented"))));
+  CHECK(readResponses(fd2, 1).find("not implemented") != std::string::npos);
+  later.completeAll();
+  CHECK(readResponses(fd, 1).find("<i4>2</i4>") != std::string::npos);
+
+  XmlRpcSocket::close(fd2);
+  XmlRpcSocket::close(fd);
+}
+
+// Connections waiting for asynchronous results are closed on shutdown, and
+// results delivered later are dropped
+static void
+testShutdownParked()
+{
+  Later later(0);
+  {
+    TestServer server;
+    server.addMethod(&later);
+    CHECK(server.start());
+
+    int fd = connectTo(server.port());
+    CHECK(fd >= 0);
+    CHECK(sendAll(fd, httpRequest(callBody("later"))));
+    later.waitStarted(1);
+
+    server.stop();
+    CHECK(server.getConnectionCount() == 1);
+    server.shutdown();
+    CHECK(server.getConnectionCount() == 0);
+    CHECK(readResponses(fd, 1).empty());
+    XmlRpcSocket::close(fd);
+  }
+  later.completeAll();
+}
+
+
+// The contents of the parameters of a kept call
+static std::string
+describe(XmlRpcValue& params)
+{
+  std::string text = std::string(params[0]) + " " + std::string(params[1]["name"]) + " " +
+                     std::to_string(int(params[2][1]));
+  XmlRpcValue::BinaryData& data = params[3];
+  return text + " " + std::string(data.begin(), data.end());
+}
+
+static std::string
+keptParams(std::string const& name)
+{
+  return "<param><value><string>" + name + " with a string longer than a short one</string></value></param>"
+         "<param><value><struct><member><name>name</name><value>" + name + "</value></member></struct></value></param>"
+         "<param><value><array><data><value><i4>1</i4></value><value><i4>2</i4></value></data></array></value></param>"
+         "<param><value><base64>YmluYXJ5</base64></value></param>";
+}
+
+// Moves the parameters of each call out, and keeps them with its completion
+class Keep : public XmlRpcServerMethod {
+public:
+  Keep(XmlRpcServer* s) : XmlRpcServerMethod("keep", s) {}
+
+  // The completion is released after the parameters
+  struct Call {
+    std::shared_ptr<XmlRpcServerCompletion> done;
+    XmlRpcValue params;
+  };
+
+  void executeAsync(XmlRpcValue& params, std::shared_ptr<XmlRpcServerCompletion> done)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    calls.push_back(Call{ done, std::move(params) });
+    _started.notify_all();
+  }
+
+  void waitStarted(size_t n)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _started.wait(lock, [&]() { return calls.size() >= n; });
+  }
+
+  std::vector<Call> calls;
+
+private:
+  std::mutex _mutex;
+  std::condition_variable _started;
+};
+
+// Answers with a member of its first parameter
+class Member : public XmlRpcServerMethod {
+public:
+  Member(XmlRpcServer* s) : XmlRpcServerMethod("member", s) {}
+
+  void execute(XmlRpcValue& params, XmlRpcValue& result)
+  {
+    result = params[0]["a"];
+  }
+};
+
+// Parameters moved out by asynchronous methods stay valid after the request
+// is done with, while the completion is kept, even once the server is shut
+// down. Copies of values parsed into an arena outlive it. Containers that
+// turn out to be malformed when accessed raise faults.
+static void
+testParamsLifetime()
+{
+  const char* XML =
+    "<value><struct><member><name>s</name><value>a string longer than a short one</value></member>"
+    "<member><name>a</name><value><array><data><value><i4>7</i4></value></data></array></value></member>"
+    "</struct></value>";
+  XmlRpcValue copy, element;
+  {
+    std::string xml(XML);
+    std::pmr::monotonic_buffer_resource arena(xml.size());
+    int offset = 0;
+    XmlRpcValue value(xml, &offset, &arena, XmlRpcValue::BorrowStrings | XmlRpcValue::DeferContainers);
+    CHECK(value.valid());
+    copy = value;
+    element = value["a"];
+    xml.assign(xml.size(), 'x');
+  }
+  CHECK(std::string(copy["s"]) == "a string longer than a short one");
+  CHECK(int(copy["a"][0]) == 7);
+  CHECK(int(element[0]) == 7);
+
+  Keep keep(0);
+  {
+    TestServer server;
+    Member member(&server);
+    server.addMethod(&keep);
+    server.setWorkerThreads(2);
+    CHECK(server.start());
+
+    std::vector<int> fds;
+    for (int i=0; i<3; ++i) {
+      fds.push_back(connectTo(server.port()));
+      CHECK(sendAll(fds[i], httpRequest(callBody("keep", keptParams("call" + std::to_string(i))))));
+    }
+    keep.waitStarted(3);
+
+    // Other requests reuse the connections' buffers in the meantime
+    int fd = connectTo(server.port());
+    CHECK(sendAll(fd, httpRequest(callBody("member", "<param><value><struct><member><name>a</name>"
+                                                     "<value><i4>x</i4></value></member></struct></value></param>"))));
+    CHECK(readResponses(fd, 1).find("faultCode") != std::string::npos);
+    CHECK(sendAll(fd, httpRequest(callBody("member", "<param><value><struct><member><name>a</name>"
+                                                     "<value><i4>3</i4></value></member></struct></value></param>"))));
+    CHECK(readResponses(fd, 1).find("<i4>3</i4>") != std::string::npos);
+    XmlRpcSocket::close(fd);
+
+    for (int i=0; i<3; ++i) {
+      std::string expected = "call" + std::to_string(i) + " with a string longer than a short one call" +
+                             std::to_string(i) + " 2 binary";
+      CHECK(describe(keep.calls[i].params) == expected);
+      keep.calls[i].done->complete(describe(keep.calls[i].params));
+      CHECK(readResponses(fds[i], 1).find(expected) != std::string::npos);
+      XmlRpcSocket::close(fds[i]);
+    }
+    keep.calls.clear();
+
+    fd = connectTo(server.port());
+    CHECK(sendAll(fd, httpRequest(callBody("keep", keptParams("late")))));
+    keep.waitStarted(1);
+    server.stop();
+    server.shutdown();
+    XmlRpcSocket::close(fd);
+  }
+  CHECK(describe(keep.calls[0].params) == "late with a string longer than a short one late 2 binary");
+  keep.calls[0].done->complete(XmlRpcValue(1));
+  keep.calls.clear();
+
+  // Accessing a malformed container throws
+  std::string xml = "<value><struct><member><name>a</name><value><i4>x</i4></value></member></struct></value>";
+  int offset = 0;
+  XmlRpcValue deferred(xml, &offset, 0, XmlRpcValue::DeferContainers);
+  bool thrown = false;
+  try {
+    deferred["a"];
+  } catch (const XmlRpcException& e) {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+
+// Adds up its integer parameters as they are parsed, skipping arrays and
+// structs, unless streaming is cleared
+class Streamed : public XmlRpcServerMethod {
+public:
+  Streamed(XmlRpcServer* s) : XmlRpcServerMethod("streamed", s), streaming(true) {}
+
+  void execute(XmlRpcValue& params, XmlRpcValue& result)
+  {
+    result = "execute " + std::to_string(params.size());
+  }
+
+  bool executeStreamed(XmlRpcParser& params, XmlRpcValue& result)
+  {
+    if ( ! streaming)
+      return false;
+
+    int sum = 0, skipped = 0;
+    if (params.next() != XmlRpcParser::StartArray)
+      throw XmlRpcException("bad params");
+    for (XmlRpcParser::Event event; (event = params.next()) != XmlRpcParser::EndArray; ) {
+      if (event == XmlRpcParser::Int)
+        sum += params.getInt();
+      else if ((event == XmlRpcParser::StartArray || event == XmlRpcParser::StartStruct) && params.skip())
+        ++skipped;
+      else
+        throw XmlRpcException("bad params");
+    }
+    if (params.next() != XmlRpcParser::End)
+      throw XmlRpcException("bad params");
+    result = "streamed " + std::to_string(sum) + " " + std::to_string(skipped);
+    return true;
+  }
+
+  std::atomic<bool> streaming;
+};
+
+// Methods may read their parameters as events, or decline and be called
+// through execute. system.multicall always goes through execute.
+static void
+testStreamedMethods()
+{
+  TestServer server;
+  Streamed streamed(&server);
+  server.setWorkerThreads(2);
+  CHECK(server.start());
+
+  int fd = connectTo(server.port());
+  CHECK(fd >= 0);
+  std::string params =
+    "<param><value><i4>1</i4></value></param>"
+    "<param><value><array><data><value><i4>100</i4></value>"
+      "<value><array><data><value><i4>200</i4></value></data></array></value></data></array></value></param>"
+    "<param><value><struct><member><name>a</name><value><i4>300</i4></value></member></struct></value></param>"
+    "<param><value><int>2</int></value></param>";
+  CHECK(sendAll(fd, httpRequest(callBody("streamed", params))));
+  CHECK(readResponses(fd, 1).find("streamed 3 2") != std::string::npos);
+
+  // Faults thrown while reading the events are sent back
+  CHECK(sendAll(fd, httpRequest(callBody("streamed", "<param><value><string>1</string></value></param>"))));
+  CHECK(readResponses(fd, 1).find("bad params") != std::string::npos);
+  CHECK(sendAll(fd, httpRequest(callBody("streamed", "<param><value><i4>1</i4></param>"))));
+  CHECK(readResponses(fd, 1).find("bad params") != std::string::npos);
+
+  CHECK(sendAll(fd, httpRequest(multicallBody("streamed"))));
+  CHECK(readResponses(fd, 1).find("execute 0") != std::string::npos);
+
+  streamed.streaming = false;
+  CHECK(sendAll(fd, httpRequest(callBody("streamed", params))));
+  CHECK(readResponses(fd, 1).find("execute 4") != std::string::npos);
+  CHECK(sendAll(fd, httpRequest(callBody("streamed", "<param><value><i4>1</i4></param>"))));
+  CHECK(readResponses(fd, 1).find("invalid parameters") != std::string::npos);
+
+  XmlRpcSocket::close(fd);
+}
+
+
+// Counts the threads that executed it and have since exited
+class ThreadCounter : public XmlRpcServerMethod {
+public:
+  ThreadCounter(XmlRpcServer* s) : XmlRpcServerMethod("thread", s), exited(0) {}
+
+  void execute(XmlRpcValue& params, XmlRpcValue& result)
+  {
+    thread_local Sentinel sentinel(this);
+    std::lock_guard<std::mutex> lock(_mutex);
+    threads.insert(std::this_thread::get_id());
+    result = 1;
+  }
+
+  std::set<std::thread::id> threads;
+  std::atomic<int> exited;
+
+private:
+  struct Sentinel {
+    Sentinel(ThreadCounter* c) : counter(c) {}
+    ~Sentinel() { ++counter->exited; }
+    ThreadCounter* counter;
+  };
+
+  std::mutex _mutex;
+};
+
+// Connections are spread over the reactors by SO_REUSEPORT. Every reactor
+// thread has exited once work() returns, and shutdown() closes the
+// connections of all the reactors.
+static void
+testReactors()
+{
+  const int N = 4;
+  ThreadCounter counter(0);
+  TestServer server;
+  server.addMethod(&counter);
+  server.setReactorCount(N);
+  for (int round=0; round<2; ++round) {
+    CHECK(server.start());
+    counter.threads.clear();
+
+    std::vector<int> fds;
+    for (int i=0; i<64; ++i) {
+      int fd = connectTo(server.port());
+      CHECK(fd >= 0);
+      CHECK(sendAll(fd, httpRequest(callBody("thread"))));
+      CHECK(readResponses(fd, 1).find("<i4>1</i4>") != std::string::npos);
+      fds.push_back(fd);
+    }
+    CHECK(counter.threads.size() == size_t(N));
+    CHECK(server.getConnectionCount() == 64);
+
+    server.stop();
+    CHECK(counter.exited == N * (round + 1));
+    server.shutdown();
+    CHECK(server.getConnectionCount() == 0);
+    for (size_t i=0; i<fds.size(); ++i) {
+      CHECK(readResponses(fds[i], 1).empty());
+      XmlRpcSocket::close(fds[i]);
+    }
+  }
+}
+
+
+// Write the buffers through a socket with a small send buffer, reading at
+// most chunk bytes each time the writer would block. Returns what was read,
+// and the offsets where the writes stopped in resumed.
+static std::string
+writeBuffers(std::vector<XmlRpcSocket::Buffer> const& bufs, size_t chunk, std::vector<int>& resumed)
+{
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  int size = 4096;
+  setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  CHECK(XmlRpcSocket::setNonBlocking(fds[0]));
+
+  size_t total = 0;
+  for (size_t i=0; i<bufs.size(); ++i)
+    total += bufs[i].length;
+
+  std::string received;
+  std::vector<char> buf(chunk);
+  int bytesSoFar = 0;
+  while (true) {
+    CHECK(XmlRpcSocket::nbWrite(fds[0], bufs.data(), int(bufs.size()), &bytesSoFar));
+    if (size_t(bytesSoFar) >= total) break;
+    resumed.push_back(bytesSoFar);
+    ssize_t n = ::read(fds[1], buf.data(), chunk);
+    CHECK(n > 0);
+    if (n <= 0) break;
+    received.append(buf.data(), size_t(n));
+  }
+  CHECK(size_t(bytesSoFar) == total);
+
+  XmlRpcSocket::close(fds[0]);
+  for (ssize_t n; (n = ::read(fds[1], buf.data(), chunk)) > 0; )
+    received.append(buf.data(), size_t(n));
+  XmlRpcSocket::close(fds[1]);
+  return received;
+}
+
+// Writes of several buffers that stop partway through are resumed where
+// they stopped, in the middle of a buffer or at a boundary
+static void
+testWriteBuffers()
+{
+  std::string header = randomText(10000, "", 0.0);
+  std::string body = randomBytes(300000);
+  std::string tail = "</methodResponse>\r\n";
+  std::vector<XmlRpcSocket::Buffer> bufs = {
+    { header.data(), header.size() }, { "", 0 }, { body.data(), body.size() }, { tail.data(), tail.size() } };
+
+  std::vector<int> resumed;
+  CHECK(writeBuffers(bufs, 1000, resumed) == header + body + tail);
+  bool inHeader = false, inBody = false;
+  for (size_t i=0; i<resumed.size(); ++i) {
+    inHeader |= resumed[i] > 0 && resumed[i] < int(header.size());
+    inBody |= resumed[i] > int(header.size()) && resumed[i] < int(header.size() + body.size());
+  }
+  CHECK(inHeader);
+  CHECK(inBody);
+
+  // More buffers than are written at once, some of them empty
+  std::string data = randomBytes(200000);
+  for (int round=0; round<10; ++round) {
+    bufs.clear();
+    for (size_t pos = 0; pos < data.size(); ) {
+      size_t length = std::min(randomSize(randomSize(1) ? 4000 : 3), data.size() - pos);
+      bufs.push_back({ data.data() + pos, length });
+      pos += length;
+    }
+    resumed.clear();
+    CHECK(writeBuffers(bufs, 1 + randomSize(3000), resumed) == data);
+    CHECK(bufs.size() > 16);
+  }
+}
+
+
+// Fails to set TCP_DEFER_ACCEPT on each listening socket
+class NoDeferAccept : public TestServer {
+public:
+  NoDeferAccept() : calls(0) {}
+
+  bool deferAccept(int fd)
+  {
+    ++calls;
+    return false;
+  }
+
+  int calls;
+};
+
+// Listening sockets are still bound and listening when TCP_DEFER_ACCEPT
+// can not be set
+static void
+testDeferAcceptFailure()
+{
+  NoDeferAccept server;
+  Slow slow(&server);
+  server.setReactorCount(2);
+  server.setDeferAccept(5);
+  CHECK(server.start());
+  CHECK(server.calls == 2);
+
+  for (int i=0; i<4; ++i) {
+    int fd = connectTo(server.port());
+    CHECK(fd >= 0);
+    CHECK(sendAll(fd, httpRequest(callBody("slow"))));
+    CHECK(readResponses(fd, 1).find("<i4>1</i4>") != std::string::npos);
+    XmlRpcSocket::close(fd);
+  }
+}
+
+
+// Accepts any descriptor without watching it
+class NullPoller : public XmlRpcPoller {
+public:
+  bool add(int fd, unsigned mask, void* cookie) { return true; }
+  bool modify(int fd, unsigned mask, void* cookie) { return true; }
+  void remove(int fd) {}
+  int wait(double timeout, std::vector<Event>& events) { return 0; }
+  bool enableInterrupt() { return false; }
+  void interrupt() {}
+  const char* name() const { return "null"; }
+};
+
+class IdleSource : public XmlRpcSource {
+public:
+  IdleSource(int fd = -1) : XmlRpcSource(fd) {}
+  unsigned handleEvent(unsigned eventType) { return 0; }
+};
+
+// Seconds taken to remove the sources from a dispatcher monitoring them
+// all, after they have set their fds to -1 as close() does if closed is true
+static double
+removalTime(std::vector<IdleSource>& sources, bool closed)
+{
+  XmlRpcDispatch disp(new NullPoller);
+  for (size_t i=0; i<sources.size(); ++i) {
+    sources[i].setfd(int(i) + 1000);
+    disp.addSource(&sources[i], XmlRpcDispatch::ReadableEvent);
+  }
+  if (closed)
+    for (size_t i=0; i<sources.size(); ++i)
+      sources[i].setfd(-1);
+
+  // Latest first, so a search from the oldest would visit every source
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i=sources.size(); i-- > 0; )
+    disp.removeSource(&sources[i]);
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  CHECK(disp.getSourceCount() == 0);
+  return s;
+}
+
+// Closed connections are removed from their dispatcher by their destructor.
+// Removing a source that no longer has its fd must not search all the others.
+static void
+testRemoveClosedSources()
+{
+  std::vector<IdleSource> sources(20000);
+  double open = removalTime(sources, false);
+  double closed = removalTime(sources, true);
+  CHECK(closed < 10 * open + 0.05);
+
+  // Connections closed by the client are all removed
+  TestServer server;
+  Slow slow(&server);
+  CHECK(server.start());
+  std::vector<int> fds;
+  for (int i=0; i<50; ++i) {
+    int fd = connectTo(server.port());
+    CHECK(fd >= 0);
+    CHECK(sendAll(fd, httpRequest(callBody("slow"))));
+    fds.push_back(fd);
+  }
+  for (size_t i=0; i<fds.size(); ++i) {
+    CHECK(readResponses(fds[i], 1).find("<i4>1</i4>") != std::string::npos);
+    XmlRpcSocket::close(fds[i]);
+  }
+  for (int i=0; i<500 && server.getConnectionCount() > 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  CHECK(server.getConnectionCount() == 0);
+  CHECK(server.sourceCount() == 1);
+}
+
+
+static XmlRpcPoller* (*const POLLERS[])() = { &XmlRpcPoller::createSelect, &XmlRpcPoller::createEpoll };
+
+// The read end of a pipe. Each event reads a byte and calls onReadable.
+class PipeSource : public XmlRpcSource {
+public:
+  PipeSource() : calls(0)
+  {
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    setfd(fds[0]);
+    writeFd = fds[1];
+  }
+
+  ~PipeSource()
+  {
+    close();
+    if (writeFd >= 0) ::close(writeFd);
+  }
+
+  void poke() { CHECK(::write(writeFd, "x", 1) == 1); }
+
+  unsigned handleEvent(unsigned eventType)
+  {
+    char c;
+    CHECK(::read(getfd(), &c, 1) == 1);
+    ++calls;
+    if (onReadable) onReadable(this);
+    return XmlRpcDispatch::ReadableEvent;
+  }
+
+  int writeFd;
+  int calls;
+  std::function<void(PipeSource*)> onReadable;
+};
+
+// Run a single pass of the dispatcher's event loop
+static void
+workOnce(XmlRpcDispatch& disp)
+{
+  disp.exit();
+  disp.work(-1.0);
+}
+
+// Sources removed by a handler while a batch of events is processed are not
+// called, even when their fd is reused by a source added in the same batch.
+static void
+testRemoveDuringBatch(XmlRpcPoller* poller)
+{
+  XmlRpcDispatch disp(poller);
+  CHECK(disp.enableWakeup());
+
+  const int N = 8;
+  std::vector< std::unique_ptr<PipeSource> > sources;
+  std::unique_ptr<PipeSource> added;
+  for (int i=0; i<N; ++i)
+    sources.emplace_back(new PipeSource);
+
+  // Whichever source is handled first removes and closes all the others,
+  // then monitors a new pipe which gets one of the freed fds
+  auto removeOthers = [&](PipeSource* self) {
+    int freed = -1;
+    for (int i=0; i<N; ++i)
+      if (sources[i].get() != self && sources[i]->getfd() >= 0) {
+        disp.removeSource(sources[i].get());
+        if (freed < 0 || sources[i]->getfd() < freed)
+          freed = sources[i]->getfd();
+        sources[i]->close();
+      }
+    added.reset(new PipeSource);
+    CHECK(added->getfd() == freed);
+    added->poke();
+    disp.addSource(added.get(), XmlRpcDispatch::ReadableEvent);
+  };
+  for (int i=0; i<N; ++i) {
+    sources[i]->onReadable = removeOthers;
+    sources[i]->poke();
+    disp.addSource(sources[i].get(), XmlRpcDispatch::ReadableEvent);
+  }
+
+  workOnce(disp);
+  int calls = 0;
+  for (int i=0; i<N; ++i)
+    calls += sources[i]->calls;
+  CHECK(calls == 1);
+  CHECK(added && added->calls == 0);
+  CHECK(disp.getSourceCount() == 2);
+
+  // The new source is reported by the next pass
+  workOnce(disp);
+  CHECK(added && added->calls == 1);
+
+  for (int i=0; i<N; ++i)
+    disp.removeSource(sources[i].get());
+  disp.removeSource(added.get());
+}
+
+// interrupt() wakes a wait in progress or the next one, without reporting
+// an event, and several interrupts wake a single wait
+static void
+testInterrupt(XmlRpcPoller* poller)
+{
+  std::vector<XmlRpcPoller::Event> events;
+  CHECK(poller->enableInterrupt());
+
+  std::thread waker([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    poller->interrupt();
+  });
+  CHECK(poller->wait(-1.0, events) == 0);
+  waker.join();
+
+  for (int i=0; i<3; ++i)
+    poller->interrupt();
+  CHECK(poller->wait(-1.0, events) == 0);
+  auto start = std::chrono::steady_clock::now();
+  CHECK(poller->wait(0.05, events) == 0);
+  CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(40));
+  delete poller;
+
+  // exit() from another thread stops a dispatcher waiting forever
+  PipeSource source;
+  XmlRpcDispatch disp;
+  CHECK(disp.enableWakeup());
+  disp.addSource(&source, XmlRpcDispatch::ReadableEvent);
+  std::thread exiter([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    disp.exit();
+  });
+  disp.work(-1.0);
+  exiter.join();
+  CHECK(source.calls == 0);
+  disp.removeSource(&source);
+}
+
+// select() can not watch descriptors from FD_SETSIZE and rejects them, while
+// epoll watches them like any other
+static void
+testLargeFds()
+{
+  XmlRpcPoller* select = XmlRpcPoller::createSelect();
+  CHECK( ! select->add(FD_SETSIZE, XmlRpcDispatch::ReadableEvent, 0));
+  CHECK( ! select->add(-1, XmlRpcDispatch::ReadableEvent, 0));
+
+  struct rlimit limit;
+  CHECK(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+  rlim_t want = FD_SETSIZE + 16;
+  if (limit.rlim_cur < want && limit.rlim_max >= want) {
+    struct rlimit raised = limit;
+    raised.rlim_cur = want;
+    setrlimit(RLIMIT_NOFILE, &raised);
+  }
+
+  PipeSource source;
+  int high = dup2(source.getfd(), FD_SETSIZE + 8);
+  if (high >= 0) {
+    ::close(source.getfd());
+    source.setfd(high);
+    CHECK( ! select->add(high, XmlRpcDispatch::ReadableEvent, 0));
+
+    XmlRpcDispatch disp(XmlRpcPoller::createEpoll());
+    CHECK(disp.enableWakeup());
+    disp.addSource(&source, XmlRpcDispatch::ReadableEvent);
+    source.poke();
+    workOnce(disp);
+    CHECK(source.calls == 1);
+    disp.removeSource(&source);
+  } else
+    printf("testLargeFds: could not raise RLIMIT_NOFILE, skipping epoll check\n");
+
+  delete select;
+  setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+static void
+testPollers()
+{
+  for (size_t i=0; i<sizeof(POLLERS)/sizeof(POLLERS[0]); ++i) {
+    testRemoveDuringBatch(POLLERS[i]());
+    testInterrupt(POLLERS[i]());
+  }
+  testLargeFds();
+}
+
+
+// A dispatcher whose clock only moves when told to
+class FakeClock : public XmlRpcDispatch {
+public:
+  FakeClock() : now(1000.0)
+  {
+    CHECK(enableWakeup());
+    addSource(&_source, ReadableEvent);
+  }
+
+  ~FakeClock() { removeSource(&_source); }
+
+  // Move the clock forward and run the timers that expired
+  void advance(double seconds)
+  {
+    now += seconds;
+    workOnce(*this);
+  }
+
+  // Time taken by a turn of the timer wheel
+  static double turn() { return WHEEL_SIZE * TIMER_TICK; }
+
+  double now;
+
+protected:
+  double getTime() { return now; }
+
+private:
+  PipeSource _source;
+};
+
+// Timers due more than a turn of the wheel away share their slot with
+// earlier ticks, and only run once their own tick has passed
+static void
+testTimerWheelWrap()
+{
+  const double TURN = FakeClock::turn();
+  FakeClock disp;
+  int once = 0, periodic = 0;
+  XmlRpcTimer timer([&]() { ++once; });
+  XmlRpcTimer repeat([&]() { ++periodic; });
+  disp.schedule(&timer, TURN + 0.88);
+  disp.schedule(&repeat, 2.5 * TURN, 2.5 * TURN);
+
+  // Each slot is visited several times before the timers are due
+  for (int i=0; i<100; ++i)
+    disp.advance(0.05);
+  CHECK(once == 0);
+  CHECK(timer.isScheduled());
+  disp.advance(TURN + 0.90 - 5.0);
+  CHECK(once == 1);
+  CHECK( ! timer.isScheduled());
+  CHECK(periodic == 0);
+
+  // A jump of several turns runs a timer once
+  disp.advance(2.5 * TURN);
+  CHECK(periodic == 1);
+  disp.advance(0.5 * TURN);
+  CHECK(periodic == 1);
+  disp.advance(2.5 * TURN);
+  CHECK(periodic == 2);
+
+  disp.schedule(&timer, 3 * TURN);
+  disp.advance(10 * TURN);
+  CHECK(once == 2);
+  CHECK(repeat.isScheduled());
+}
+
+// A callback may cancel or destroy timers due at the same tick, in the same
+// slot or another one
+static void
+testTimerCancelInCallback()
+{
+  FakeClock disp;
+  int calls = 0;
+  XmlRpcTimer a, b;
+  std::unique_ptr<XmlRpcTimer> c(new XmlRpcTimer([&]() { ++calls; }));
+  a.setCallback([&]() { ++calls; b.cancel(); c.reset(); });
+  b.setCallback([&]() { ++calls; a.cancel(); c.reset(); });
+  disp.schedule(&a, 0.1);
+  disp.schedule(&b, 0.1);
+  disp.schedule(c.get(), 0.12);
+
+  disp.advance(0.5);
+  CHECK(calls == 1);
+  CHECK( ! a.isScheduled() && ! b.isScheduled());
+  CHECK( ! c);
+
+  // A periodic timer cancelling itself stops
+  XmlRpcTimer self;
+  self.setCallback([&]() { ++calls; self.cancel(); });
+  disp.schedule(&self, 0.1, 0.1);
+  disp.advance(0.2);
+  disp.advance(0.2);
+  CHECK(calls == 2);
+  CHECK( ! self.isScheduled());
+}
+
+// Seconds until the server closes the connection, after reading what it sent
+static double
+secondsUntilClosed(int fd)
+{
+  auto start = std::chrono::steady_clock::now();
+  char buf[4096];
+  while (::read(fd, buf, sizeof(buf)) > 0)
+    ;
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Connections idle between requests, or slow to send a header or body, are
+// closed once their deadline has passed
+static void
+testConnectionDeadlines()
+{
+  TestServer server;
+  Slow slow(&server);
+  server.setIdleTimeout(0.2);
+  server.setHeaderTimeout(0.3);
+  server.setBodyTimeout(0.4);
+  CHECK(server.start());
+
+  // Idle once connected, and after a request
+  int fd = connectTo(server.port());
+  double s = secondsUntilClosed(fd);
+  CHECK(s > 0.15 && s < 2.0);
+  XmlRpcSocket::close(fd);
+
+  fd = connectTo(server.port());
+  CHECK(sendAll(fd, httpRequest(callBody("slow"))));
+  CHECK(readResponses(fd, 1).find("<i4>1</i4>") != std::string::npos);
+  s = secondsUntilClosed(fd);
+  CHECK(s > 0.15 && s < 2.0);
+  XmlRpcSocket::close(fd);
+
+  // Part of a header
+  fd = connectTo(server.port());
+  CHECK(sendAll(fd, "POST /RPC2 HTTP/1.1\r\n"));
+  s = secondsUntilClosed(fd);
+  CHECK(s > 0.25 && s < 2.0);
+  XmlRpcSocket::close(fd);
+
+  // Part of a body
+  fd = connectTo(server.port());
+  std::string request = httpRequest(callBody("slow"));
+  CHECK(sendAll(fd, request.substr(0, request.size() - 10)));
+  s = secondsUntilClosed(fd);
+  CHECK(s > 0.35 && s < 2.0);
+  XmlRpcSocket::close(fd);
+
+  for (int i=0; i<100 && server.getConnectionCount() > 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  CHECK(server.getConnectionCount() == 0);
+}
+
+static void
+testTimers()
+{
+  testTimerWheelWrap();
+  testTimerCancelInCallback();
+  testConnectionDeadlines();
+}
+
+
+static XmlRpcHttpHeader::Status
+parseHeader(XmlRpcHttpHeader& header, std::string const& text)
+{
+  size_t consumed = 0;
+  return header.parse(text.data(), text.size(), &consumed);
+}
+
+// Content lengths that do not fit in an int are refused, not truncated
+static void
+testContentLength()
+{
+  XmlRpcHttpHeader header;
+  CHECK(parseHeader(header, "POST / HTTP/1.1\r\nContent-length: 2147483647\r\n\r\n") == XmlRpcHttpHeader::COMPLETE);
+  CHECK(header.contentLength() == 2147483647L);
+
+  const char* invalid[] = { "2147483648", "4294967396", "99999999999999999999999", "-1", "12x", "" };
+  for (size_t i=0; i<sizeof(invalid)/sizeof(invalid[0]); ++i) {
+    header.reset();
+    std::string text = std::string("POST / HTTP/1.1\r\nContent-length: ") + invalid[i] + "\r\n\r\n";
+    CHECK(parseHeader(header, text) == XmlRpcHttpHeader::INVALID);
+  }
+
+  // A request whose length wraps around to 100 is not executed
+  TestServer server;
+  Slow slow(&server);
+  CHECK(server.start());
+  int fd = connectTo(server.port());
+  CHECK(fd >= 0);
+  std::string body = callBody("slow");
+  body.resize(100, ' ');
+  CHECK(sendAll(fd, "POST /RPC2 HTTP/1.1\r\nContent-length: 4294967396\r\n\r\n" + body));
+  CHECK(readResponses(fd, 1).empty());
+  XmlRpcSocket::close(fd);
+}
+
+
+static XmlRpcValue
+parseValue(std::string const& xml, bool* ok = 0)
+{
+  int offset = 0;
+  XmlRpcValue value;
+  bool parsed = value.fromXml(xml, &offset);
+  if (ok) *ok = parsed;
+  return value;
+}
+
+static std::string
+valueXml(const char* tag, std::string const& text)
+{
+  return std::string("<value><") + tag + ">" + text + "</" + tag + "></value>";
+}
+
+// Numbers are written as printf would and read back exactly. Those that do
+// not fit their type are refused.
+static void
+testNumbers()
+{
+  std::mt19937_64 rng64(1);
+  char buf[64];
+  for (int i=0; i<100000; ++i) {
+    int n = int(rng64());
+    snprintf(buf, sizeof(buf), "%d", n);
+    CHECK(XmlRpcValue(n).toXml() == valueXml("i4", buf));
+    CHECK(int(parseValue(valueXml("i4", buf))) == n);
+
+    std::int64_t n64 = std::int64_t(rng64());
+    snprintf(buf, sizeof(buf), "%lld", (long long) n64);
+    CHECK(XmlRpcValue(n64).toXml() == valueXml("i8", buf));
+    XmlRpcValue v64 = parseValue(valueXml("i8", buf));
+    CHECK(v64.getType() == XmlRpcValue::TypeInt64 && std::int64_t(v64) == n64);
+
+    std::uint64_t bits = rng64();
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    if (d != d)
+      continue;
+    std::string xml = XmlRpcValue(d).toXml();
+    std::string text = xml.substr(15, xml.find('<', 15) - 15);    // No exponent
+    CHECK(text.find_first_not_of("-0123456789.") == std::string::npos);
+    CHECK(parseValue(xml) == XmlRpcValue(d));
+    CHECK(strtod(text.c_str(), 0) == d);
+  }
+
+  CHECK(XmlRpcValue(0.1).toXml() == valueXml("double", "0.1"));
+  CHECK(XmlRpcValue(-2.5).toXml() == valueXml("double", "-2.5"));
+  CHECK(XmlRpcValue(1e20).toXml() == valueXml("double", "100000000000000000000"));
+  double dmax = std::numeric_limits<double>::max(), dmin = std::numeric_limits<double>::denorm_min();
+  CHECK(parseValue(XmlRpcValue(dmax).toXml()) == XmlRpcValue(dmax));
+  CHECK(parseValue(XmlRpcValue(-dmin).toXml()) == XmlRpcValue(-dmin));
+  CHECK(XmlRpcValue(std::numeric_limits<std::int64_t>::min()).toXml() == valueXml("i8", "-9223372036854775808"));
+  CHECK(XmlRpcValue(std::numeric_limits<int>::min()).toXml() == valueXml("i4", "-2147483648"));
+
+  bool ok;
+  CHECK(int(parseValue(valueXml("i4", " +42 "), &ok)) == 42 && ok);
+  CHECK(int(parseValue(valueXml("int", "-7"), &ok)) == -7 && ok);
+  CHECK(double(parseValue(valueXml("double", "1.5e3"), &ok)) == 1500 && ok);
+  const char* invalid[][2] = { { "i4", "2147483648" }, { "i4", "-2147483649" }, { "i8", "9223372036854775808" },
+                               { "i4", "--1" }, { "i4", "1x" }, { "i4", "" }, { "double", "1e999" },
+                               { "double", "x" }, { "boolean", "2" } };
+  for (size_t i=0; i<sizeof(invalid)/sizeof(invalid[0]); ++i) {
+    parseValue(valueXml(invalid[i][0], invalid[i][1]), &ok);
+    CHECK( ! ok);
+  }
+
+  XmlRpcValue::setDoubleFormat("%.2f");
+  CHECK(XmlRpcValue(2.5).toXml() == valueXml("double", "2.50"));
+  XmlRpcValue::setDoubleFormat("");
+}
+
+
+// The tokens of xml, one char or name each: < start tag, / end tag,
+// [text] (_ if blank, & if encoded), $ end and ! error
+static std::string
+tokens(std::string const& xml)
+{
+  XmlRpcTokenizer tokenizer(xml.data(), xml.size());
+  std::string out;
+  for (;;)
+    switch (tokenizer.next()) {
+      case XmlRpcTokenizer::End:      return out + "$";
+      case XmlRpcTokenizer::Error:    return out + "!";
+      case XmlRpcTokenizer::StartTag: out += "<" + std::string(tokenizer.getName()) + ">"; break;
+      case XmlRpcTokenizer::EndTag:   out += "</" + std::string(tokenizer.getName()) + ">"; break;
+      case XmlRpcTokenizer::Text:
+        out += std::string(tokenizer.isBlank() ? "_" : "") + (tokenizer.isEncoded() ? "&" : "") +
+               "[" + std::string(tokenizer.getText()) + "]";
+        break;
+    }
+}
+
+static void
+testTokenizer()
+{
+  CHECK(tokens("<?xml version=\"1.0\"?>\n<a x='1>2' y=\"/\">t&amp;</a>") == "_[\n]<a>&[t&amp;]</a>$");
+  CHECK(tokens("<!-- c > d --><b/><c />") == "<b></b><c></c>$");
+  CHECK(tokens("<!DOCTYPE x><d>  </d>") == "<d>_[  ]</d>$");
+  CHECK(tokens("<a><![CDATA[x]]></a>") == "<a>!");
+  CHECK(tokens("<a") == "!");
+  CHECK(tokens("<>") == "!");
+  CHECK(tokens("</") == "!");
+  CHECK(tokens("") == "$");
+  CHECK(tokens("text") == "[text]$");
+
+  bool ok;
+  CHECK(std::string(parseValue("<value/>", &ok)) == "" && ok);
+  CHECK(std::string(parseValue("<value><string/></value>", &ok)) == "" && ok);
+  CHECK(std::string(parseValue("<value>  </value>", &ok)) == "  " && ok);
+  CHECK(std::string(parseValue("<value> <string> a </string> </value>", &ok)) == " a " && ok);
+  CHECK(int(parseValue("<value>\n <i4> 7 </i4>\n</value>", &ok)) == 7 && ok);
+  CHECK(std::string(parseValue("<value><!-- c --><string>x</string></value>", &ok)) == "x" && ok);
+  const char* invalid[] = { "<value>x<i4>1</i4></value>", "<value><i4>1</int></value>",
+                            "<value><i4>1 2</i4></value>", "<value><array><data></array></value>" };
+  for (size_t i=0; i<sizeof(invalid)/sizeof(invalid[0]); ++i) {
+    parseValue(invalid[i], &ok);
+    CHECK( ! ok);
+  }
+  XmlRpcValue empty = parseValue("<value><array><data/></array></value>", &ok);
+  CHECK(ok && empty.getType() == XmlRpcValue::TypeArray && empty.size() == 0);
+  XmlRpcValue members = parseValue("<value><struct><member><name/><value/></member>"
+                                   "<member><name>a&lt;</name><value><i4>1</i4></value></member></struct></value>", &ok);
+  CHECK(ok && members.size() == 2 && members.hasMember("") && int(members["a<"]) == 1);
+
+  std::string request = "<?xml version=\"1.0\"?>\n<methodCall>\n<methodName>m</methodName>\n<params/>\n</methodCall>";
+  XmlRpcParser noParams(request, 0, XmlRpcParser::ParamsXml);
+  XmlRpcValue params;
+  CHECK(params.fromXml(noParams) && params.size() == 0);
+
+  request = "<methodCall><methodName>m</methodName><params><param><value>1</value></param><junk/></params></methodCall>";
+  XmlRpcParser junk(request, 0, XmlRpcParser::ParamsXml);
+  CHECK( ! params.fromXml(junk));
+}
+
+// Mutations of a valid value must not crash, and values parsed on demand
+// must agree with values parsed at once
+static void
+testTokenizerMutations()
+{
+  XmlRpcValue v;
+  v[0] = "s&amp;";
+  v[1][0] = 1;
+  v[1][1]["k"] = 2.5;
+  v[2] = XmlRpcValue((void*) "abcdef", 6);
+  v[3]["x"][0] = true;
+  std::string base = v.toXml();
+
+    for (int i=0; i<50000; ++i) {
+    std::string s = base;
+    for (int k = 1 + rng() % 3; k > 0 && ! s.empty(); --k) {
+      size_t p = rng() % s.size();
+      switch (rng() % 3) {
+        case 0:  s[p] = "<>/ a&"[rng() % 6]; break;
+        case 1:  s.erase(p, 1 + rng() % 8); break;
+        default: s.insert(p, 1, "<>/ v"[rng() % 5]); break;
+      }
+    }
+
+    int offset = 0;
+    XmlRpcValue eager;
+    bool eagerOk = eager.fromXml(s, &offset);
+    offset = 0;
+    XmlRpcValue deferred;
+    bool deferredOk = deferred.fromXml(s, &offset, 0, XmlRpcValue::BorrowStrings | XmlRpcValue::DeferContainers);
+    try {
+      if (eagerOk)
+        CHECK(deferredOk && deferred == eager);
+      else if (deferredOk) {
+        std::string xml;
+        deferred.toXml(xml);    // May throw on reaching the error
+      }
+    } catch (const XmlRpcException&) {
+      CHECK( ! eagerOk);
+    }
+  }
+}
+
+
+// The SIMD kernels are chosen once per process, limited by XMLRPC_SIMD. The
+// tests comparing them with reference implementations run in a child
+// process for each limit.
+static const char* SIMD_LIMITS[] = { "scalar", "sse2", "ssse3", "avx2" };
+
+// Lengths around the block sizes of the kernels, and some long ones
+static std::vector<size_t>
+testLengths()
+{
+  std::vector<size_t> lengths;
+  for (size_t n=0; n<=130; ++n)
+    lengths.push_back(n);
+  for (int i=0; i<50; ++i)
+    lengths.push_back(130 + randomSize(4000));
+  lengths.push_back(51 * 32 * 3 + 17);
+  lengths.push_back(100000);
+  return lengths;
+}
+
+
+static const char* RAW_ENTITIES = "<>&'\"";
+static const char* XML_ENTITIES[] = { "&lt;", "&gt;", "&amp;", "&apos;", "&quot;" };
+
+static std::string
+referenceXmlEncode(std::string_view raw)
+{
+  std::string encoded;
+  for (size_t i=0; i<raw.size(); ++i) {
+    const char* e = strchr(RAW_ENTITIES, raw[i]);
+    if (raw[i] && e)
+      encoded += XML_ENTITIES[e - RAW_ENTITIES];
+    else
+      encoded += raw[i];
+  }
+  return encoded;
+}
+
+static std::string
+referenceXmlDecode(std::string_view encoded)
+{
+  std::string raw;
+  for (size_t i=0; i<encoded.size(); ) {
+    int k = 0;
+    while (k < 5 && encoded.substr(i, strlen(XML_ENTITIES[k])) != XML_ENTITIES[k])
+      ++k;
+    if (k < 5) {
+      raw += RAW_ENTITIES[k];
+      i += strlen(XML_ENTITIES[k]);
+    } else
+      raw += encoded[i++];
+  }
+  return raw;
+}
+
+// Text at every alignment, with no, few, many and only chars to encode
+static void
+testXmlEncode()
+{
+  std::vector<size_t> lengths = testLengths();
+  const double fractions[] = { 0.0, 0.01, 0.3, 1.0 };
+  for (size_t i=0; i<lengths.size(); ++i)
+    for (size_t f=0; f<4; ++f) {
+      size_t offset = i % 32;
+      std::string buffer = randomText(offset + lengths[i], RAW_ENTITIES, fractions[f]);
+      std::string_view raw(buffer.data() + offset, lengths[i]);
+
+      std::string encoded = XmlRpcUtil::xmlEncode(raw);
+      CHECK(encoded == referenceXmlEncode(raw));
+      std::string appended("prefix");
+      XmlRpcUtil::xmlEncode(raw, appended);
+      CHECK(appended == "prefix" + encoded);
+      CHECK(XmlRpcUtil::xmlDecode(encoded) == raw);
+    }
+}
+
+// Entities, broken entities and stray ampersands
+static void
+testXmlDecode()
+{
+  const std::string pieces[] = { "&lt;", "&gt;", "&amp;", "&apos;", "&quot;", "&", "&am", "&ap;",
+                                 "&quo", "&l", "&#60;", "&amp", "&&lt;", "lt;" };
+  const size_t nPieces = sizeof(pieces) / sizeof(pieces[0]);
+  std::vector<size_t> lengths = testLengths();
+  for (size_t i=0; i<lengths.size(); ++i) {
+    std::string encoded = randomText(lengths[i], "&", 0.05);
+    for (size_t k=0; k<lengths[i] / 8; ++k)
+      encoded.insert(randomSize(encoded.size()), pieces[randomSize(nPieces - 1)]);
+    CHECK(XmlRpcUtil::xmlDecode(encoded) == referenceXmlDecode(encoded));
+    if (encoded.size() > 1)     // Ends in the middle of an entity
+      CHECK(XmlRpcUtil::xmlDecode(std::string_view(encoded).substr(0, encoded.size() - 1)) ==
+            referenceXmlDecode(std::string_view(encoded).substr(0, encoded.size() - 1)));
+  }
+}
+
+static std::string
+referenceBase64(std::string_view data, XmlRpcBase64::LineBreaks breaks)
+{
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string encoded;
+  for (size_t i=0; i<data.size(); i += 3) {
+    unsigned v = (unsigned char) data[i] << 16;
+    if (i + 1 < data.size()) v |= (unsigned char) data[i+1] << 8;
+    if (i + 2 < data.size()) v |= (unsigned char) data[i+2];
+    encoded += alphabet[v >> 18];
+    encoded += alphabet[(v >> 12) & 0x3F];
+    encoded += (i + 1 < data.size()) ? alphabet[(v >> 6) & 0x3F] : '=';
+    encoded += (i + 2 < data.size()) ? alphabet[v & 0x3F] : '=';
+    if (breaks != XmlRpcBase64::NoBreaks && (i + 3) % 54 == 0 && i + 3 <= data.size())
+      encoded += (breaks == XmlRpcBase64::CRLF) ? "\r\n" : "\n";
+  }
+  return encoded;
+}
+
+// Whitespace anywhere and no padding
+static std::string
+reformatBase64(std::string const& encoded)
+{
+  static const char* spaces[] = { " ", "\t", "\r\n", "\n", "   " };
+  std::string text;
+  for (size_t i=0; i<encoded.size(); ++i) {
+    if (encoded[i] == '=')
+      continue;
+    if (randomSize(7) == 0)
+      text += spaces[randomSize(4)];
+    text += encoded[i];
+  }
+  return text;
+}
+
+// Data at every alignment, encoded with each kind of line break
+static void
+testBase64Encode()
+{
+  const XmlRpcBase64::LineBreaks breaks[] = { XmlRpcBase64::NoBreaks, XmlRpcBase64::LF, XmlRpcBase64::CRLF };
+  std::vector<size_t> lengths = testLengths();
+  for (size_t i=0; i<lengths.size(); ++i)
+    for (size_t b=0; b<3; ++b) {
+      size_t offset = i % 32;
+      std::string buffer = randomBytes(offset + lengths[i]);
+      std::string_view data(buffer.data() + offset, lengths[i]);
+
+      std::string encoded("prefix");
+      XmlRpcBase64::encode(data.data(), data.size(), encoded, breaks[b]);
+      CHECK(encoded == "prefix" + referenceBase64(data, breaks[b]));
+      CHECK(encoded.size() == 6 + XmlRpcBase64::encodedSize(data.size(), breaks[b]));
+
+      std::string decoded("prefix");
+      CHECK(XmlRpcBase64::decode(std::string_view(encoded).substr(6), decoded));
+      CHECK(decoded == "prefix" + std::string(data));
+      std::vector<char> vdecoded;
+      CHECK(XmlRpcBase64::decode(std::string_view(encoded).substr(6), vdecoded));
+      CHECK(std::string(vdecoded.begin(), vdecoded.end()) == data);
+    }
+}
+
+// Text with whitespace, without padding, given in pieces, and invalid text
+static void
+testBase64Decode()
+{
+  std::vector<size_t> lengths = testLengths();
+  for (size_t i=0; i<lengths.size(); ++i) {
+    std::string data = randomBytes(lengths[i]);
+    std::string text = reformatBase64(referenceBase64(data, XmlRpcBase64::LF));
+
+    std::string decoded;
+    CHECK(XmlRpcBase64::decode(text, decoded));
+    CHECK(decoded == data);
+
+    // Each piece is decoded into a buffer of exactly the size it may need
+    XmlRpcBase64::Decoder decoder;
+    std::string pieces;
+    bool ok = true;
+    for (size_t pos = 0; pos < text.size(); ) {
+      size_t n = std::min(text.size() - pos, randomSize(pos % 3 ? 9 : 200));
+      std::vector<char> buffer(XmlRpcBase64::decodedSize(n));
+      size_t length = 0;
+      ok = ok && decoder.decode(std::string_view(text).substr(pos, n), buffer.data(), &length);
+      pieces.append(buffer.data(), length);
+      pos += n;
+    }
+    char tail[2];
+    size_t tailLength = 0;
+    CHECK(ok && decoder.finish(tail, &tailLength));
+    pieces.append(tail, tailLength);
+    CHECK(pieces == data);
+
+    // A char that is not in the alphabet leaves the output as it was
+    if (text.size() > 0) {
+      std::string bad = text;
+      bad[randomSize(bad.size() - 1)] = "*-.\x80"[randomSize(3)];
+      std::string out("prefix");
+      CHECK( ! XmlRpcBase64::decode(bad, out));
+      CHECK(out == "prefix");
+    }
+  }
+
+  std::string out;
+  CHECK( ! XmlRpcBase64::decode("QUJD" "R", out));          // Part of a byte
+  CHECK( ! XmlRpcBase64::decode("QQ==QUJD", out));          // Data after the padding
+  CHECK( ! XmlRpcBase64::decode("Q===", out));              // Padding too early
+  CHECK(XmlRpcBase64::decode("QQ== \r\n", out) && out == "A");
+  CHECK(XmlRpcBase64::decode("", out) && out == "A");
+}
+
+static void
+testKernels()
+{
+  testXmlEncode();
+  testXmlDecode();
+  testBase64Encode();
+  testBase64Decode();
+}
+
+static void
+runKernelTests(const char* self)
+{
+  for (size_t i=0; i<sizeof(SIMD_LIMITS)/sizeof(SIMD_LIMITS[0]); ++i) {
+    printf("XMLRPC_SIMD=%s: ", SIMD_LIMITS[i]);
+    fflush(stdout);
+    std::string command = std::string("XMLRPC_SIMD=") + SIMD_LIMITS[i] + " " + self + " kernels";
+    CHECK(system(command.c_str()) == 0);
+  }
+}
+
+
+// A value to build as an XmlRpcValue, and to serialize as the first versions
+// of the library did
+struct Model {
+  XmlRpcValue::Type type;
+  bool b;
+  int i;
+  double d;
+  std::string text;          // String or binary data
+  struct tm t;
+  std::vector<Model> elements;
+  std::map<std::string, Model> members;
+};
+
+static Model
+randomModel(int depth)
+{
+  Model m;
+  int kind = int(randomSize(depth > 0 ? 7 : 5));
+  static const XmlRpcValue::Type TYPES[] = {
+    XmlRpcValue::TypeBoolean, XmlRpcValue::TypeInt, XmlRpcValue::TypeDouble, XmlRpcValue::TypeString,
+    XmlRpcValue::TypeDateTime, XmlRpcValue::TypeBase64, XmlRpcValue::TypeArray, XmlRpcValue::TypeStruct };
+  m.type = TYPES[kind];
+  m.b = randomSize(1) != 0;
+  m.i = int(rng());
+  m.d = std::uniform_real_distribution<double>(-1e6, 1e6)(rng);
+  m.text = (m.type == XmlRpcValue::TypeBase64) ? randomBytes(randomSize(200))
+                                                : randomText(randomSize(40), RAW_ENTITIES, 0.1);
+  memset(&m.t, 0, sizeof(m.t));
+  m.t.tm_year = 1900 + int(randomSize(200));
+  m.t.tm_mon = int(randomSize(11)) + 1;
+  m.t.tm_mday = int(randomSize(27)) + 1;
+  m.t.tm_hour = int(randomSize(23));
+  m.t.tm_min = int(randomSize(59));
+  m.t.tm_sec = int(randomSize(59));
+  for (size_t n = randomSize(6); m.type == XmlRpcValue::TypeArray && n > 0; --n)
+    m.elements.push_back(randomModel(depth - 1));
+  for (size_t n = randomSize(6); m.type == XmlRpcValue::TypeStruct && n > 0; --n)
+    m.members[randomText(randomSize(8), RAW_ENTITIES, 0.1)] = randomModel(depth - 1);
+  return m;
+}
+
+static XmlRpcValue
+buildValue(Model& m)
+{
+  XmlRpcValue v;
+  switch (m.type) {
+    case XmlRpcValue::TypeBoolean:  v = XmlRpcValue(m.b); break;
+    case XmlRpcValue::TypeInt:      v = m.i; break;
+    case XmlRpcValue::TypeDouble:   v = m.d; break;
+    case XmlRpcValue::TypeString:   v = m.text; break;
+    case XmlRpcValue::TypeDateTime: v = XmlRpcValue(&m.t); break;
+    case XmlRpcValue::TypeBase64:   v = XmlRpcValue((void*) m.text.data(), int(m.text.size())); break;
+    case XmlRpcValue::TypeArray:
+      v.setSize(int(m.elements.size()));
+      for (size_t i=0; i<m.elements.size(); ++i)
+        v[int(i)] = buildValue(m.elements[i]);
+      break;
+    default: {
+      XmlRpcValue::ValueStruct members;
+      for (std::map<std::string, Model>::iterator it = m.members.begin(); it != m.members.end(); ++it)
+        members[it->first] = buildValue(it->second);
+      v = XmlRpcValue(std::move(members));
+    }
+  }
+  return v;
+}
+
+// The serializer of the first versions of the library, which wrote doubles
+// with "%f"
+static std::string
+referenceXml(Model const& m)
+{
+  char buf[256];
+  std::string xml = "<value>";
+  switch (m.type) {
+    case XmlRpcValue::TypeBoolean:
+      xml += std::string("<boolean>") + (m.b ? "1" : "0") + "</boolean>";
+      break;
+    case XmlRpcValue::TypeInt:
+      snprintf(buf, sizeof(buf), "%d", m.i);
+      xml += std::string("<i4>") + buf + "</i4>";
+      break;
+    case XmlRpcValue::TypeDouble:
+      snprintf(buf, sizeof(buf), "%f", m.d);
+      xml += std::string("<double>") + buf + "</double>";
+      break;
+    case XmlRpcValue::TypeString:
+      xml += referenceXmlEncode(m.text);
+      break;
+    case XmlRpcValue::TypeDateTime:
+      snprintf(buf, sizeof(buf), "%4d%02d%02dT%02d:%02d:%02d",
+               m.t.tm_year, m.t.tm_mon, m.t.tm_mday, m.t.tm_hour, m.t.tm_min, m.t.tm_sec);
+      xml += std::string("<dateTime.iso8601>") + buf + "</dateTime.iso8601>";
+      break;
+    case XmlRpcValue::TypeBase64:
+      xml += "<base64>" + referenceBase64(m.text, XmlRpcBase64::LF) + "</base64>";
+      break;
+    case XmlRpcValue::TypeArray:
+      xml += "<array><data>";
+      for (size_t i=0; i<m.elements.size(); ++i)
+        xml += referenceXml(m.elements[i]);
+      xml += "</data></array>";
+      break;
+    default:
+      xml += "<struct>";
+      for (std::map<std::string, Model>::const_iterator it = m.members.begin(); it != m.members.end(); ++it)
+        xml += "<member><name>" + referenceXmlEncode(it->first) + "</name>" + referenceXml(it->second) + "</member>";
+      xml += "</struct>";
+  }
+  return xml + "</value>";
+}
+
+// Values are serialized byte for byte as they were by the first versions,
+// whether the xml is returned or appended
+static void
+testSerializer()
+{
+  std::string saved = XmlRpcValue::getDoubleFormat();
+  XmlRpcValue::setDoubleFormat("%f");
+  for (int i=0; i<2000; ++i) {
+    Model m = randomModel(3);
+    XmlRpcValue v = buildValue(m);
+    std::string expected = referenceXml(m);
+    CHECK(v.toXml() == expected);
+    std::string xml = "prefix";
+    v.toXml(xml);
+    CHECK(xml == "prefix" + expected);
+  }
+  XmlRpcValue::setDoubleFormat(saved.c_str());
+}
+
+// Exposes where strings are stored
+class ValueProbe : public XmlRpcValue {
+public:
+  ValueProbe(XmlRpcValue const& v) : XmlRpcValue(v) {}
+  bool isShort() const { return isShortString(); }
+};
+
+// Copies share their data until one of them is modified. Moved values are
+// left invalid.
+static void
+testCopyOnWrite()
+{
+  XmlRpcValue a;
+  a["text"] = std::string(100, 'a');
+  a["list"].setSize(3);
+  a["list"][0] = 1;
+  a["data"] = XmlRpcValue((void*) "binary", 6);
+
+  XmlRpcValue b = a;
+  std::string& text = b["text"];
+  text += "b";
+  b["list"][0] = 2;
+  b["list"][1]["nested"] = 3;
+  XmlRpcValue::BinaryData& data = b["data"];
+  data[0] = 'B';
+  b["added"] = true;
+
+  CHECK(std::string(a["text"]) == std::string(100, 'a'));
+  CHECK(int(a["list"][0]) == 1);
+  CHECK( ! a["list"][1].valid());
+  XmlRpcValue::BinaryData& original = a["data"];
+  CHECK(original[0] == 'b');
+  CHECK( ! a.hasMember("added"));
+  CHECK(std::string(b["text"]) == std::string(100, 'a') + "b");
+  CHECK(int(b["list"][1]["nested"]) == 3);
+
+  XmlRpcValue c = a, d = a;
+  c = std::string("replaced");
+  CHECK(d == a);
+
+  // Moves, of long and short strings and of containers
+  const char* TEXTS[] = { "short", "a string that is too long to be short" };
+  for (int i=0; i<2; ++i) {
+    XmlRpcValue s(TEXTS[i]);
+    XmlRpcValue moved(std::move(s));
+    CHECK( ! s.valid());
+    CHECK(std::string(moved) == TEXTS[i]);
+    XmlRpcValue assigned;
+    assigned = std::move(moved);
+    CHECK( ! moved.valid());
+    CHECK(std::string(assigned) == TEXTS[i]);
+  }
+  XmlRpcValue copy = a;
+  XmlRpcValue moved(std::move(a));
+  CHECK( ! a.valid());
+  CHECK(moved == copy);
+  a = std::move(moved);
+  CHECK( ! moved.valid());
+  CHECK(a == copy);
+}
+
+// Strings of up to 15 chars are stored in the value
+static void
+testShortStrings()
+{
+  std::string s15(15, 'x'), s16(16, 'y');
+  CHECK(ValueProbe(XmlRpcValue(s15)).isShort());
+  CHECK( ! ValueProbe(XmlRpcValue(s16)).isShort());
+  CHECK(ValueProbe(parseValue("<value>" + s15 + "</value>")).isShort());
+  CHECK(std::string(parseValue("<value>" + s16 + "</value>")) == s16);
+
+  // Growing a short string past the limit, and swapping short and long ones
+  XmlRpcValue a(s15), b(s16);
+  std::string& grown = a;
+  grown += "z";
+  CHECK(std::string(a) == s15 + "z");
+  a.swap(b);
+  CHECK(std::string(a) == s16 && std::string(b) == s15 + "z");
+  XmlRpcValue c(s15), d(s16);
+  c.swap(d);
+  CHECK(std::string(c) == s16 && std::string(d) == s15);
+  CHECK(ValueProbe(d).isShort() && ! ValueProbe(c).isShort());
+  CHECK(XmlRpcValue(s15).toXml() == "<value>" + s15 + "</value>");
+  CHECK(XmlRpcValue(s16).toXml() == "<value>" + s16 + "</value>");
+}
+
+// Struct members are kept sorted by name, and names are interned up to a
+// limit after which they are stored in each member
+static void
+testStructs()
+{
+  std::vector<std::string> names;
+  for (int i=0; i<200; ++i)
+    names.push_back("member" + std::to_string(i));
+  std::shuffle(names.begin(), names.end(), rng);
+
+  XmlRpcValue::ValueStruct members;
+  for (size_t i=0; i<names.size(); ++i)
+    CHECK(members.emplace(names[i], XmlRpcValue(int(i))).second);
+  CHECK( ! members.emplace(names[0], XmlRpcValue(-1)).second);
+  CHECK(members.size() == 200);
+  for (XmlRpcValue::ValueStruct::iterator it = members.begin(); it + 1 < members.end(); ++it)
+    CHECK(it->first.str() < (it + 1)->first.str());
+  for (size_t i=0; i<names.size(); ++i) {
+    XmlRpcValue::ValueStruct::iterator it = members.find(names[i]);
+    CHECK(it != members.end() && int(it->second) == int(i));
+  }
+  CHECK(members.find("member") == members.end());
+  CHECK( ! members["member"].valid());
+  CHECK(members.size() == 201);
+
+  // Far more names than are interned
+  std::vector<std::string> many;
+  int interned = 0;
+  for (int i=0; i<5000; ++i) {
+    many.push_back("interned" + std::to_string(i));
+    interned += XmlRpcValue::Name(many.back()).isInterned() ? 1 : 0;
+  }
+  CHECK(interned <= 4096);
+  CHECK( ! XmlRpcValue::Name(many.back()).isInterned());
+  CHECK( ! XmlRpcValue::Name(std::string(100, 'n')).isInterned());
+
+  XmlRpcValue v;
+  for (size_t i=0; i<many.size(); ++i)
+    v[many[i]] = int(i);
+  v[std::string(100, 'n')] = -1;
+  CHECK(v.size() == 5001);
+  for (size_t i=0; i<many.size(); i += 7)
+    CHECK(v.hasMember(many[i]) && int(v[many[i]]) == int(i));
+  CHECK(int(v[std::string(100, 'n')]) == -1);
+  CHECK( ! v.hasMember("interned5000"));
+  CHECK(XmlRpcValue::Name(many[0]) == XmlRpcValue::Name(many[0]));
+  CHECK(XmlRpcValue::Name(many[0]) != XmlRpcValue::Name(many.back()));
+  CHECK(XmlRpcValue::Name(many.back()) == XmlRpcValue::Name(many.back()));
+
+  // Parsed structs are found the same way
+  XmlRpcValue parsed = parseValue(v.toXml());
+  CHECK(parsed == v);
+  CHECK(int(parsed[many.back()]) == int(many.size()) - 1);
+}
+
+static void
+testValues()
+{
+  testSerializer();
+  testCopyOnWrite();
+  testShortStrings();
+  testStructs();
+}
+
+
+// Time the kernels chosen for this cpu, or limited by XMLRPC_SIMD
+template <class F>
+static void
+bench(const char* name, size_t bytes, F const& f)
+{
+  const int N = 20;
+  auto start = std::chrono::steady_clock::now();
+  for (int i=0; i<N; ++i)
+    f();
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("%-28s %8.1f MB/s\n", name, double(bytes) * N / s / 1e6);
+}
+
+// Time f, which handles n items, and print the time per item along with the
+// allocations made per call
+template <class F>
+static void
+benchItems(const char* name, size_t n, F const& f)
+{
+  const int N = 15;
+  double best = 0.0;
+  size_t allocations = 0;
+  for (int i=0; i<N; ++i) {
+    size_t before = nAllocations.load();
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    allocations = nAllocations.load() - before;
+    if (i == 0 || s < best) best = s;
+  }
+  double ns = best / double(n) * 1e9;
+  if (ns < 10000.0)
+    printf("%-36s %10.1f ns/item %8zu allocations\n", name, ns, allocations);
+  else
+    printf("%-36s %10.1f us/item %8zu allocations\n", name, ns / 1000.0, allocations);
+}
+
+// An array of 200 nested structs
+static std::string
+nestedStructsXml()
+{
+  XmlRpcValue array;
+  array.setSize(200);
+  for (int i=0; i<200; ++i) {
+    XmlRpcValue& s = array[i];
+    for (int j=0; j<4; ++j) {
+      std::string name = "member" + std::to_string(j);
+      s[name]["text"] = randomText(64, RAW_ENTITIES, 0.02);
+      s[name]["count"] = j;
+      s[name]["ratio"] = j / 3.0;
+      XmlRpcValue& list = s[name]["list"];
+      list.setSize(8);
+      for (int k=0; k<8; ++k)
+        list[k] = k;
+    }
+  }
+  return array.toXml();
+}
+
+// Allocations and time taken to parse a large value, on the heap as
+// clients do, and as the server parses parameters into an arena
+static void
+benchParsing()
+{
+  std::string xml = nestedStructsXml();
+  printf("\nParsing a %zu KB array of 200 nested structs, per parse:\n", xml.size() / 1024);
+  benchItems("heap", 1, [&]() {
+    int offset = 0;
+    XmlRpcValue v(xml, &offset);
+  });
+  benchItems("arena, borrowed strings", 1, [&]() {
+    std::pmr::monotonic_buffer_resource arena(xml.size());
+    int offset = 0;
+    XmlRpcValue v(xml, &offset, &arena, XmlRpcValue::BorrowStrings);
+  });
+  benchItems("arena, borrowed strings, deferred", 1, [&]() {
+    std::pmr::monotonic_buffer_resource arena(xml.size());
+    int offset = 0;
+    XmlRpcValue v(xml, &offset, &arena, XmlRpcValue::BorrowStrings | XmlRpcValue::DeferContainers);
+  });
+}
+
+// printf and strto* against to_chars and from_chars, on 100k random values
+static void
+benchNumbers()
+{
+  const size_t N = 100000;
+  std::mt19937_64 rng64(1);
+  std::vector<int> ints(N);
+  std::vector<double> doubles(N);
+  std::vector<std::string> intTexts(N), doubleTexts(N);
+  char buf[64];
+  for (size_t i=0; i<N; ++i) {
+    ints[i] = int(rng64());
+    doubles[i] = std::uniform_real_distribution<double>(-1e6, 1e6)(rng64);
+    intTexts[i] = std::to_string(ints[i]);
+    snprintf(buf, sizeof(buf), "%.17g", doubles[i]);
+    doubleTexts[i] = buf;
+  }
+
+  printf("\nNumbers:\n");
+  volatile size_t sink = 0;
+  benchItems("int format, snprintf", N, [&]() {
+    for (size_t i=0; i<N; ++i) sink += snprintf(buf, sizeof(buf), "%d", ints[i]);
+  });
+  benchItems("int format, to_chars", N, [&]() {
+    for (size_t i=0; i<N; ++i) sink += std::to_chars(buf, buf + sizeof(buf), ints[i]).ptr - buf;
+  });
+  benchItems("int parse, strtol", N, [&]() {
+    for (size_t i=0; i<N; ++i) sink += strtol(intTexts[i].c_str(), 0, 10);
+  });
+  benchItems("int parse, from_chars", N, [&]() {
+    for (size_t i=0; i<N; ++i) {
+      int n;
+      std::from_chars(intTexts[i].data(), intTexts[i].data() + intTexts[i].size(), n);
+      sink += n;
+    }
+  });
+  benchItems("double parse, strtod", N, [&]() {
+    for (size_t i=0; i<N; ++i) sink += size_t(strtod(doubleTexts[i].c_str(), 0));
+  });
+  benchItems("double parse, from_chars", N, [&]() {
+    for (size_t i=0; i<N; ++i) {
+      double d;
+      std::from_chars(doubleTexts[i].data(), doubleTexts[i].data() + doubleTexts[i].size(), d);
+      sink += size_t(d);
+    }
+  });
+
+  // Doubles through the serializer, with the old format and the default
+  std::string out;
+  std::string saved = XmlRpcValue::getDoubleFormat();
+  XmlRpcValue::setDoubleFormat("%f");
+  benchItems("double toXml, \"%f\"", N, [&]() {
+    out.clear();
+    for (size_t i=0; i<N; ++i) XmlRpcValue(doubles[i]).toXml(out);
+  });
+  XmlRpcValue::setDoubleFormat("");
+  benchItems("double toXml, shortest", N, [&]() {
+    out.clear();
+    for (size_t i=0; i<N; ++i) XmlRpcValue(doubles[i]).toXml(out);
+  });
+  XmlRpcValue::setDoubleFormat(saved.c_str());
+}
+
+// The XmlRpcUtil tag functions against the tokenizer
+static void
+benchTags()
+{
+  XmlRpcValue params;
+  params.setSize(1);
+  int offset = 0;
+  XmlRpcValue structs(nestedStructsXml(), &offset);
+  for (int i=0; i<24; ++i)
+    params[0][i] = structs[i];
+  std::string request = callBody("examples.walk", "<param>" + params[0].toXml() + "</param>");
+
+  printf("\nTags of a %zu KB request:\n", request.size() / 1024);
+  volatile size_t sink = 0;
+  benchItems("walk all tags, getNextTag", 1, [&]() {
+    int offset = 0;
+    while (offset < int(request.size())) {
+      if ( ! XmlRpcUtil::getNextTag(request, &offset).empty())
+        ++sink;
+      else {
+        size_t next = request.find('<', size_t(offset));
+        if (next == std::string::npos) break;
+        offset = int(next);
+      }
+    }
+  });
+  benchItems("walk all tags, tokenizer", 1, [&]() {
+    XmlRpcTokenizer tokens(request.data(), request.size());
+    for (XmlRpcTokenizer::Token t; (t = tokens.next()) != XmlRpcTokenizer::End && t != XmlRpcTokenizer::Error; )
+      if (t != XmlRpcTokenizer::Text)
+        ++sink;
+  });
+
+  const int N = 100000;
+  benchItems("methodName, parseTag", N, [&]() {
+    for (int i=0; i<N; ++i) {
+      int offset = 0;
+      sink += XmlRpcUtil::parseTag("<methodName>", request, &offset).size();
+    }
+  });
+  benchItems("methodName, tokenizer", N, [&]() {
+    for (int i=0; i<N; ++i) {
+      XmlRpcTokenizer tokens(request.data(), request.size());
+      for (XmlRpcTokenizer::Token t; (t = tokens.next()) != XmlRpcTokenizer::End && t != XmlRpcTokenizer::Error; )
+        if (t == XmlRpcTokenizer::StartTag && tokens.getName() == "methodName") {
+          if (tokens.next() == XmlRpcTokenizer::Text)
+            sink += std::string(tokens.getText()).size();
+          break;
+        }
+    }
+  });
+}
+
+static void
+runBenchmarks()
+{
+  const size_t SIZE = 4 << 20;
+  std::string clean = randomText(SIZE, RAW_ENTITIES, 0.0);
+  std::string sparse = randomText(SIZE, RAW_ENTITIES, 0.01);
+  std::string encoded = XmlRpcUtil::xmlEncode(sparse);
+  std::string out;
+
+  bench("xmlEncode, no entities", SIZE, [&]() { out.clear(); XmlRpcUtil::xmlEncode(clean, out); });
+  bench("xmlEncode, 1% entities", SIZE, [&]() { out.clear(); XmlRpcUtil::xmlEncode(sparse, out); });
+  bench("xmlDecode, 1% entities", encoded.size(), [&]() { out = XmlRpcUtil::xmlDecode(encoded); });
+
+  std::string binary = randomBytes(SIZE);
+  std::string b64;
+  XmlRpcBase64::encode(binary.data(), binary.size(), b64);
+  bench("base64 encode", SIZE, [&]() { out.clear(); XmlRpcBase64::encode(binary.data(), binary.size(), out); });
+  bench("base64 decode", b64.size(), [&]() { out.clear(); XmlRpcBase64::decode(b64, out); });
+
+  benchParsing();
+  benchNumbers();
+  benchTags();
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  XmlRpc::setVerbosity(0);
+
+  // In a child process run by runKernelTests
+  if (argc > 1 && strcmp(argv[1], "kernels") == 0) {
+    testKernels();
+    printf("%d checks, %d failures\n", nChecks, nFailures);
+    return nFailures ? 1 : 0;
+  }
+
+  if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+    runBenchmarks();
+    return 0;
+  }
+
+  runKernelTests(argv[0]);
+  testNumbers();
+  testTokenizer();
+  testTokenizerMutations();
+  testValues();
+  testPollers();
+  testTimers();
+
+  testPipelinedWorkers();
+  testWorkersRestart();
+  testContentLength();
+  testAsyncMethods();
+  testShutdownParked();
+  testParamsLifetime();
+  testStreamedMethods();
+  testReactors();
+  testWriteBuffers();
+  testDeferAcceptFailure();
+  testRemoveClosedSources();
+
+  printf("%d checks, %d failures\n", nChecks, nFailures);
+  return nFailures ? 1 : 0;
+}